@@ -7,8 +7,11 @@
 #include "dclock.h"
 #include "lcd.h"
 #include "bsp.h"
+#include "settings.h"
 
 #include <stdio.h>
+#include <stddef.h>
+#include <avr/eeprom.h>
 
 Q_DEFINE_THIS_FILE;
 
@@ -30,25 +33,51 @@ static QState snoozeState(struct Alarm *me);
 static QState snoozeNormalState(struct Alarm *me);
 static QState snoozeDecimalState(struct Alarm *me);
 
-#ifndef SNOOZE_MINUTES
-#define SNOOZE_MINUTES 5
-#endif
 #ifndef MAX_SNOOZE_COUNT
 #define MAX_SNOOZE_COUNT 4
 #endif
-#ifndef ALARM_SOUND_SECONDS
-#define ALARM_SOUND_SECONDS 30
+/* The defaults for the snooze time and the alarm sound time are in
+   settings.h. */
+#define ALARM_SOUND_COUNT \
+	(37 * (uint16_t)settings_get(SETTING_ALARM_SOUND_SECONDS)) /* Approximate */
+
+#if NALARMS < 1 || NALARMS > 9
+#error "NALARMS must be from 1 to 9"
 #endif
-#define ALARM_SOUND_COUNT (37 * ALARM_SOUND_SECONDS) /* Approximate */
 
 
-void get_alarm_times(struct Alarm *me, uint8_t *times)
+/**
+ * The alarm settings as they are kept in EEPROM.
+ */
+struct AlarmStore {
+	uint8_t magic;
+	uint8_t nalarms;
+	struct AlarmSetting settings[NALARMS];
+	uint8_t check;
+};
+
+#define ALARM_STORE_MAGIC 0xa1
+
+static struct AlarmStore EEMEM alarmStore;
+
+/** The copy that settings_poll() writes to alarmStore. */
+static struct AlarmStore alarmStoreCopy;
+
+static void load_alarm_settings(struct Alarm *me);
+static void save_alarm_settings(struct Alarm *me);
+static void sort_alarms(struct Alarm *me);
+
+
+void get_alarm_times(struct Alarm *me, uint8_t n, uint8_t *times)
 {
 	uint32_t sec;
+	struct AlarmSetting *s;
 
+	Q_ASSERT( n < NALARMS );
+	s = &(me->settings[n]);
 	switch (get_time_mode()) {
 	case DECIMAL_MODE:
-		sec = me->decimalAlarmTime;
+		sec = s->decimalTime;
 		Q_ASSERT( sec <= 99999 );
 		times[2] = 0;	/* Force seconds to 0. */
 		sec /= 100;
@@ -57,11 +86,11 @@ void get_alarm_times(struct Alarm *me, uint8_t *times)
 		times[0] = sec % 10;
 		break;
 	case NORMAL_MODE:
-		Q_ASSERT( me->normalAlarmTime.h <= 23 );
-		Q_ASSERT( me->normalAlarmTime.m <= 59 );
-		Q_ASSERT( me->normalAlarmTime.s <= 59 );
-		times[0] = me->normalAlarmTime.h;
-		times[1] = me->normalAlarmTime.m;
+		Q_ASSERT( s->normalTime.h <= 23 );
+		Q_ASSERT( s->normalTime.m <= 59 );
+		Q_ASSERT( s->normalTime.s <= 59 );
+		times[0] = s->normalTime.h;
+		times[1] = s->normalTime.m;
 		times[2] = 0;	/* Force seconds to 0. */
 		break;
 	default:
@@ -70,17 +99,58 @@ void get_alarm_times(struct Alarm *me, uint8_t *times)
 }
 
 
-void set_decimal_alarm_time(struct Alarm *me, uint32_t at)
+uint8_t get_alarm_on(struct Alarm *me, uint8_t n)
+{
+	Q_ASSERT( n < NALARMS );
+	return me->settings[n].on;
+}
+
+
+uint8_t get_alarm_days(struct Alarm *me, uint8_t n)
 {
-	me->decimalAlarmTime = at;
-	me->decimalSnoozeTime = at;
+	Q_ASSERT( n < NALARMS );
+	return me->settings[n].days;
 }
 
 
-void set_normal_alarm_time(struct Alarm *me, struct NormalTime nt)
+uint8_t get_alarm_max_snooze(struct Alarm *me, uint8_t n)
 {
-	me->normalAlarmTime = nt;
-	me->normalSnoozeTime = nt;
+	Q_ASSERT( n < NALARMS );
+	return me->settings[n].maxSnooze;
+}
+
+
+uint8_t alarm_settings_loaded(struct Alarm *me)
+{
+	return me->loaded;
+}
+
+
+/**
+ * Change the time of one alarm, and turn it on or off.
+ *
+ * The alarm must be sent ALARM_ON_SIGNAL afterwards so it can work out which
+ * alarm goes off next.
+ */
+void set_alarm_time_on(struct Alarm *me, uint8_t n,
+		       uint32_t dat, struct NormalTime nat, uint8_t on)
+{
+	Q_ASSERT( n < NALARMS );
+	me->settings[n].decimalTime = dat;
+	me->settings[n].normalTime = nat;
+	me->settings[n].on = on;
+	sort_alarms(me);
+	save_alarm_settings(me);
+}
+
+
+void set_alarm_options(struct Alarm *me, uint8_t n,
+		       uint8_t days, uint8_t maxSnooze)
+{
+	Q_ASSERT( n < NALARMS );
+	me->settings[n].days = days & 0x7f;
+	me->settings[n].maxSnooze = maxSnooze;
+	save_alarm_settings(me);
 }
 
 
@@ -102,6 +172,22 @@ void alarm_ctor(void)
 	serial_drain();
 	QActive_ctor((QActive*)(&alarm), (QStateHandler)&initialState);
 
+	for (uint8_t i=0; i<NALARMS; i++) {
+		alarm.settings[i].decimalTime = 50000;
+		alarm.settings[i].normalTime.h = 12;
+		alarm.settings[i].normalTime.m = 0;
+		alarm.settings[i].normalTime.s = 0;
+		alarm.settings[i].normalTime.pad = 0;
+		alarm.settings[i].on = 0;
+		alarm.settings[i].maxSnooze = MAX_SNOOZE_COUNT;
+		alarm.settings[i].days = 0;
+		alarm.order[i] = i;
+	}
+	alarm.current = 0;
+	alarm.daysAhead = 0;
+	alarm.loaded = 0;
+	load_alarm_settings(&alarm);
+
 	alarm.decimalAlarmTime = 50000;
 	alarm.normalAlarmTime.h =  12;
 	alarm.normalAlarmTime.m = 0;
@@ -115,11 +201,348 @@ void alarm_ctor(void)
 	alarm.normalSnoozeTime.pad = 0;
 	alarm.snoozeCount = 0;
 
+	timer_ctor(&alarm.runningTimer, (QActive*)(&alarm),
+		   ALARM_RUNNING_TIMEOUT_SIGNAL);
+	timer_ctor(&alarm.beepTimer, (QActive*)(&alarm),
+		   ALARM_BEEP_TIMEOUT_SIGNAL);
+
 	alarm.ready = 0;
 	alarm.armed = 0;
+	alarm.rtcAlarmKnown = 0;
+}
+
+
+/**
+ * The length of a day in the current mode's seconds.
+ */
+static uint32_t day_length(void)
+{
+	switch (get_time_mode()) {
+	case DECIMAL_MODE:
+		return 100000L;
+	case NORMAL_MODE:
+		return 86400L;
+	default:
+		Q_ASSERT( 0 );
+		return 1;
+	}
+}
+
+
+/**
+ * Get a time of day in the current mode's seconds.
+ */
+static uint32_t time_of_day(uint32_t dtime, struct NormalTime ntime)
+{
+	switch (get_time_mode()) {
+	case DECIMAL_MODE:
+		return dtime;
+	case NORMAL_MODE:
+		return normal_day_seconds(&ntime);
+	default:
+		Q_ASSERT( 0 );
+		return 0;
+	}
+}
+
+
+/**
+ * Keep me->order[] sorted by the alarm times.  There are only a few alarms,
+ * so an insertion sort is fine.
+ */
+static void sort_alarms(struct Alarm *me)
+{
+	for (uint8_t i=1; i<NALARMS; i++) {
+		uint8_t n = me->order[i];
+		uint32_t t = normal_day_seconds(&(me->settings[n].normalTime));
+		uint8_t j = i;
+		while (j > 0 && normal_day_seconds(&(me->settings[
+				   me->order[j-1]].normalTime)) > t) {
+			me->order[j] = me->order[j-1];
+			j--;
+		}
+		me->order[j] = n;
+	}
+}
+
+
+/**
+ * Find the alarm that goes off next, and make it the current alarm.
+ *
+ * We start looking at the first alarm after the current time in me->order[],
+ * so the first alarm that can go off today is the one we want, and we can
+ * stop looking.  Otherwise we take the one that goes off soonest in the next
+ * week.  If tick is true, an alarm at the current time can go off now.
+ *
+ * @return false if there are no alarms on.
+ */
+static uint8_t pick_next_alarm(struct Alarm *me, uint8_t tick)
+{
+	uint32_t now;
+	uint32_t day;
+	uint32_t soonest;
+	uint8_t today;
+	uint8_t first;
+	uint8_t found;
+
+	now = time_of_day(get_decimal_time(), get_normal_time());
+	day = day_length();
+	today = get_day_of_week();
+
+	first = 0;
+	while (first < NALARMS) {
+		struct AlarmSetting *s = &(me->settings[me->order[first]]);
+		uint32_t t = time_of_day(s->decimalTime, s->normalTime);
+		if (t > now || (tick && t == now)) {
+			break;
+		}
+		first ++;
+	}
+
+	found = 0;
+	soonest = 0;
+	for (uint8_t i=0; i<NALARMS; i++) {
+		uint8_t index = first + i;
+		uint8_t later;
+		uint8_t d;
+		uint8_t n;
+		uint32_t until;
+		struct AlarmSetting *s;
+
+		/* Alarms before the current time go off tomorrow at the
+		   earliest. */
+		if (index >= NALARMS) {
+			index -= NALARMS;
+			later = 1;
+		} else {
+			later = 0;
+		}
+		n = me->order[index];
+		s = &(me->settings[n]);
+		if (! s->on) {
+			continue;
+		}
+		d = later;
+		while (s->days && ! (s->days & (1 << ((today + d) % 7)))) {
+			d ++;
+		}
+		until = (d * day) + time_of_day(s->decimalTime, s->normalTime)
+			- now;
+		if (! found || until < soonest) {
+			found = 73;
+			soonest = until;
+			me->current = n;
+			me->daysAhead = d - later;
+			if (0 == d) {
+				break;
+			}
+		}
+	}
+	if (found) {
+		me->decimalAlarmTime = me->settings[me->current].decimalTime;
+		me->normalAlarmTime = me->settings[me->current].normalTime;
+	}
+	return found;
+}
+
+
+/**
+ * Have timekeeper put the alarm time, and whether the alarm is on, into the
+ * RTC, unless that's what it has already.  Each change is a TWI write.
+ */
+static void set_rtc_alarm(struct Alarm *me)
+{
+	if (me->rtcAlarmKnown
+	    && me->rtcAlarmArmed == me->armed
+	    && me->rtcAlarmTime.h == me->normalAlarmTime.h
+	    && me->rtcAlarmTime.m == me->normalAlarmTime.m
+	    && me->rtcAlarmTime.s == me->normalAlarmTime.s) {
+		return;
+	}
+	me->rtcAlarmTime = me->normalAlarmTime;
+	me->rtcAlarmArmed = me->armed;
+	me->rtcAlarmKnown = 73;
+	post((&timekeeper), SET_NORMAL_ALARM_SIGNAL,
+	     nt2it(me->normalAlarmTime));
+}
+
+
+/**
+ * Find the next alarm again, after the alarms or the day have changed.
+ *
+ * @return true if the same alarm goes off next at the same time, so we can
+ * stay in the on state.
+ */
+static uint8_t same_next_alarm(struct Alarm *me)
+{
+	uint8_t current = me->current;
+	uint32_t dat = me->decimalAlarmTime;
+	struct NormalTime nat = me->normalAlarmTime;
+
+	if (! pick_next_alarm(me, 0)) {
+		return 0;
+	}
+	return current == me->current
+		&& dat == me->decimalAlarmTime
+		&& nat.h == me->normalAlarmTime.h
+		&& nat.m == me->normalAlarmTime.m
+		&& nat.s == me->normalAlarmTime.s;
+}
+
+
+/**
+ * Go to the on state for the next alarm, or the off state if no alarms are
+ * on.
+ */
+static QState next_alarm_state(struct Alarm *me)
+{
+	if (! pick_next_alarm(me, 0)) {
+		return Q_TRAN(offState);
+	}
+	switch (get_time_mode()) {
+	case NORMAL_MODE:
+		return Q_TRAN(onNormalState);
+	case DECIMAL_MODE:
+		return Q_TRAN(onDecimalState);
+	default:
+		Q_ASSERT( 0 );
+		return Q_HANDLED();
+	}
+}
+
+
+/**
+ * The current alarm has finished going off.  If it only goes off once, turn
+ * it off, then find the next one.
+ */
+static QState alarm_finished(struct Alarm *me)
+{
+	if (0 == me->settings[me->current].days) {
+		me->settings[me->current].on = 0;
+		save_alarm_settings(me);
+	}
+	return next_alarm_state(me);
 }
 
 
+static uint8_t alarm_store_check(struct AlarmStore *store)
+{
+	uint8_t *p = (uint8_t *)store;
+	uint8_t sum = 0;
+
+	for (uint8_t i=0; i<offsetof(struct AlarmStore, check); i++) {
+		sum += p[i];
+	}
+	return ~sum;
+}
+
+
+static void load_alarm_settings(struct Alarm *me)
+{
+	struct AlarmStore store;
+
+	eeprom_read_block(&store, &alarmStore, sizeof(store));
+	if (store.magic != ALARM_STORE_MAGIC
+	    || store.nalarms != NALARMS
+	    || store.check != alarm_store_check(&store)) {
+		SERIALSTR("alarm settings not in EEPROM\r\n");
+		return;
+	}
+	for (uint8_t i=0; i<NALARMS; i++) {
+		struct AlarmSetting *s = &(store.settings[i]);
+		if (s->normalTime.h > 23 || s->normalTime.m > 59
+		    || s->normalTime.s > 59 || s->decimalTime > 99999L) {
+			SERIALSTR("bad alarm settings in EEPROM\r\n");
+			return;
+		}
+	}
+	for (uint8_t i=0; i<NALARMS; i++) {
+		me->settings[i] = store.settings[i];
+	}
+	sort_alarms(me);
+	me->loaded = 73;
+}
+
+
+/**
+ * Save the alarms to EEPROM.  This is called from other objects' handlers,
+ * so the bytes are written in the background by settings_poll(), one each
+ * tick, instead of making the caller wait 3.3ms for each one.  Only the bytes
+ * that have changed are written.
+ */
+static void save_alarm_settings(struct Alarm *me)
+{
+	struct AlarmStore *store = &alarmStoreCopy;
+
+	store->magic = ALARM_STORE_MAGIC;
+	store->nalarms = NALARMS;
+	for (uint8_t i=0; i<NALARMS; i++) {
+		store->settings[i] = me->settings[i];
+	}
+	store->check = alarm_store_check(store);
+	settings_write_block(&alarmStore, store, sizeof(*store));
+	me->loaded = 73;
+}
+
+
+#ifndef RTC_ALARM_INTERRUPT
+/**
+ * Work out how many ticks there are until the alarm goes off, in the current
+ * mode's seconds, from the current time to the given alarm or snooze time,
+ * plus some whole days.
+ *
+ * If the alarm time is the current time, the countdown is zero when we've
+ * been told about this second by a tick, and we go off now.  Otherwise we've
+ * just arrived here and we go off in a day's time.
+ */
+static void start_countdown(struct Alarm *me, uint32_t dtime,
+			    struct NormalTime ntime, uint8_t days,
+			    uint8_t tick)
+{
+	uint32_t now;
+	uint32_t then;
+	uint32_t day;
+
+	now = time_of_day(get_decimal_time(), get_normal_time());
+	then = time_of_day(dtime, ntime);
+	day = day_length();
+	if (then < now) {
+		then += day;
+	}
+	me->countdown = then - now;
+	if ((0 == me->countdown) && ! tick) {
+		me->countdown = day;
+	}
+	me->countdown += days * day;
+}
+
+
+/**
+ * Count one tick towards the alarm or snooze time.
+ *
+ * The ticks are coalesced by timekeeper, so also count any that we missed
+ * while we were busy.  If that takes us past the alarm time, go off now.
+ */
+static QState countdown_tick(struct Alarm *me)
+{
+	uint8_t ticks;
+
+	Q_ASSERT( me->countdown );
+	ticks = 1 + QF_LATEST_SKIPPED(Q_PAR(me));
+	if (me->countdown > ticks) {
+		me->countdown -= ticks;
+	} else {
+		me->countdown = 0;
+	}
+	if (0 == me->countdown) {
+		return Q_TRAN(alarmedState);
+	} else {
+		return Q_HANDLED();
+	}
+}
+#endif
+
+
 static QState initialState(struct Alarm *me)
 {
 	SERIALSTR("alarm initialState()\r\n");
@@ -139,28 +562,13 @@ static QState topState(struct Alarm *me)
 		SERIALSTR("alarm ALARM_OFF_SIGNAL\r\n");
 		return Q_TRAN(offState);
 	case ALARM_ON_SIGNAL:
+		/* One or more of the alarms has changed, so find out which
+		   one is next. */
 		SERIALSTR("alarm ALARM_ON_SIGNAL\r\n");
-		switch (get_time_mode()) {
-		case NORMAL_MODE:
-			return Q_TRAN(onNormalState);
-		case DECIMAL_MODE:
-			return Q_TRAN(onDecimalState);
-		default:
-			Q_ASSERT( 0 );
-			return Q_HANDLED();
-		}
+		return next_alarm_state(me);
 	case NORMAL_MODE_SIGNAL:
-		if (me->armed) {
-			return Q_TRAN(onNormalState);
-		} else {
-			return Q_TRAN(offState);
-		}
 	case DECIMAL_MODE_SIGNAL:
-		if (me->armed) {
-			return Q_TRAN(onDecimalState);
-		} else {
-			return Q_TRAN(offState);
-		}
+		return next_alarm_state(me);
 	case BUTTON_SELECT_PRESS_SIGNAL:
 	case BUTTON_SELECT_LONG_PRESS_SIGNAL:
 	case BUTTON_SELECT_REPEAT_SIGNAL:
@@ -184,15 +592,63 @@ static QState onState(struct Alarm *me)
 {
 	switch (Q_SIG(me)) {
 	case Q_ENTRY_SIG:
-		SERIALSTR("> alarm onState\r\n");
+		SERIALSTR("> alarm onState ");
+		serial_send_int(me->current + 1);
+		SERIALSTR(" +");
+		serial_send_int(me->daysAhead);
+		SERIALSTR("\r\n");
 		me->armed = 73;
 		me->decimalSnoozeTime = me->decimalAlarmTime;
 		me->normalSnoozeTime = me->normalAlarmTime;
 		me->snoozeCount = 0;
 		post((&timedisplay), ALARM_ON_SIGNAL, 0);
+		/* We may have been snoozing, or the next alarm may be a
+		   different one, so put the RTC alarm to the alarm time. */
+		set_rtc_alarm(me);
+#ifndef RTC_ALARM_INTERRUPT
+		start_countdown(me, me->decimalAlarmTime,
+				me->normalAlarmTime, me->daysAhead, 0);
+#endif
 		return Q_HANDLED();
-	case ALARM_ON_SIGNAL:
+#ifdef RTC_ALARM_INTERRUPT
+	case RTC_ALARM_SIGNAL:
+		/* The RTC alarm goes off every day at this time, so wait for
+		   the right day. */
+		if (me->daysAhead) {
+			me->daysAhead --;
+			return Q_HANDLED();
+		}
+		return Q_TRAN(alarmedState);
+#else
+	case ALARM_RESYNC_SIGNAL:
+		/* The day may have changed since we chose the current alarm,
+		   so choose again. */
+		pick_next_alarm(me, (uint8_t)Q_PAR(me));
+		me->decimalSnoozeTime = me->decimalAlarmTime;
+		me->normalSnoozeTime = me->normalAlarmTime;
+		start_countdown(me, me->decimalAlarmTime,
+				me->normalAlarmTime, me->daysAhead,
+				(uint8_t)Q_PAR(me));
+		if (0 == me->countdown) {
+			return Q_TRAN(alarmedState);
+		}
 		return Q_HANDLED();
+#endif
+	case ALARM_ON_SIGNAL:
+		/* The alarms have changed.  If the same one still goes off
+		   next at the same time, stay here, so nothing starts again
+		   and the RTC isn't written again.  Its days may have
+		   changed, though. */
+		SERIALSTR("alarm ALARM_ON_SIGNAL\r\n");
+		if (same_next_alarm(me)) {
+#ifndef RTC_ALARM_INTERRUPT
+			start_countdown(me, me->decimalAlarmTime,
+					me->normalAlarmTime, me->daysAhead, 0);
+#endif
+			return Q_HANDLED();
+		}
+		/* Let topState start again with the new alarm. */
+		break;
 	case Q_EXIT_SIG:
 		return Q_HANDLED();
 	}
@@ -202,21 +658,16 @@ static QState onState(struct Alarm *me)
 
 static QState onDecimalState(struct Alarm *me)
 {
-	uint32_t thetime;
-
 	switch (Q_SIG(me)) {
 	case Q_ENTRY_SIG:
 		SERIALSTR("> alarm onDecimalState ");
 		print_decimal_time(me->decimalAlarmTime);
 		SERIALSTR("\r\n");
 		return Q_HANDLED();
+#ifndef RTC_ALARM_INTERRUPT
 	case TICK_DECIMAL_SIGNAL:
-		thetime = Q_PAR(me);
-		if (thetime == me->decimalAlarmTime) {
-			return Q_TRAN(alarmedState);
-		} else {
-			return Q_HANDLED();
-		}
+		return countdown_tick(me);
+#endif
 	}
 	return Q_SUPER(onState);
 }
@@ -224,23 +675,16 @@ static QState onDecimalState(struct Alarm *me)
 
 static QState onNormalState(struct Alarm *me)
 {
-	struct NormalTime *thetimep;
-
 	switch (Q_SIG(me)) {
 	case Q_ENTRY_SIG:
 		SERIALSTR("> alarm onNormalState ");
 		print_normal_time(me->normalAlarmTime);
 		SERIALSTR("\r\n");
 		return Q_HANDLED();
+#ifndef RTC_ALARM_INTERRUPT
 	case TICK_NORMAL_SIGNAL:
-		thetimep = it2ntp(Q_PAR(me));
-		if (thetimep->s == me->normalAlarmTime.s
-		    && thetimep->m == me->normalAlarmTime.m
-		    && thetimep->h == me->normalAlarmTime.h) {
-			return Q_TRAN(alarmedState);
-		} else {
-			return Q_HANDLED();
-		}
+		return countdown_tick(me);
+#endif
 	}
 	return Q_SUPER(onState);
 }
@@ -251,9 +695,8 @@ static QState offState(struct Alarm *me)
 	switch (Q_SIG(me)) {
 	case Q_ENTRY_SIG:
 		me->armed = 0;
-		postISR((&timedisplay), ALARM_OFF_SIGNAL, 0);
-		postISR((&timekeeper), SET_NORMAL_ALARM_SIGNAL,
-			nt2it(me->normalAlarmTime));
+		post((&timedisplay), ALARM_OFF_SIGNAL, 0);
+		set_rtc_alarm(me);
 		return Q_HANDLED();
 	case TICK_DECIMAL_SIGNAL:
 		return Q_HANDLED();
@@ -290,8 +733,7 @@ static QState alarmedState(struct Alarm *me)
 	switch (Q_SIG(me)) {
 	case Q_ENTRY_SIG:
 		SERIALSTR("Alarm\r\n");
-		QActive_arm_sig((QActive*)me, ALARM_SOUND_COUNT,
-				ALARM_RUNNING_TIMEOUT_SIGNAL);
+		timer_arm(&me->runningTimer, ALARM_SOUND_COUNT);
 		me->turnOff = 0;
 		me->alarmSoundCount = 0;
 		post((&timedisplay), ALARM_RUNNING_SIGNAL, 0);
@@ -338,12 +780,13 @@ static QState alarmedState(struct Alarm *me)
 			/* me->turnOff will only be true in response to a long
 			   press of the select button. */
 			SERIALSTR("(me->turnOff)\r\n");
-			return Q_TRAN(offState);
-		} else if (me->snoozeCount >= MAX_SNOOZE_COUNT) {
+			return alarm_finished(me);
+		} else if (me->snoozeCount
+			   >= me->settings[me->current].maxSnooze) {
 			SERIALSTR("(me->snoozeCount==");
 			serial_send_int(me->snoozeCount);
 			SERIALSTR(")\r\n");
-			return Q_TRAN(offState);
+			return alarm_finished(me);
 		} else {
 			switch (get_time_mode()) {
 			case NORMAL_MODE:
@@ -358,6 +801,7 @@ static QState alarmedState(struct Alarm *me)
 		   the ifs before we get here in this switch case. */
 	case Q_EXIT_SIG:
 		SERIALSTR("Alarm stopped\r\n");
+		timer_disarm(&me->runningTimer);
 		return Q_HANDLED();
 	}
 	return Q_SUPER(alarmButtonsState);
@@ -371,7 +815,7 @@ static QState alarmTurningOffNowState(struct Alarm *me)
 		/* We must arm this for two ticks instead of one, because of
 		   the way the timer interacts with the buzzer.  If we only arm
 		   for one tick, we get an almost inaudible short beep. */
-		QActive_arm_sig((QActive*)me, 2, ALARM_BEEP_TIMEOUT_SIGNAL);
+		timer_arm(&me->beepTimer, 2);
 		BSP_buzzer_on(64);
 		return Q_HANDLED();
 	case ALARM_BEEP_TIMEOUT_SIGNAL:
@@ -389,17 +833,17 @@ static QState alarmTurningOffNowState(struct Alarm *me)
 		   continous short beeps. */
 		return Q_HANDLED();
 	case ALARM_RUNNING_TIMEOUT_SIGNAL:
-		/* Our parent state arms the timer with this signal.  It could
-		   be in the queue when we get here, and we don't want it to be
-		   handled, so ignore it.  If we've got here, the user has held
-		   down the select button, and we'll leave when that button is
-		   released, so we don't need the parent's timeout signal any
-		   more. */
+		/* Our parent state's timer is still running, and can run out
+		   while we're here.  We don't want that handled, so ignore it.
+		   If we've got here, the user has held down the select button,
+		   and we'll leave when that button is released, so we don't
+		   need the parent's timeout signal any more. */
 		return Q_HANDLED();
 	case Q_EXIT_SIG:
 		/* If the user lifts the select button before we've done the
 		   timeout in this state, the buzzer will still be on.  So
 		   ensure the buzzer is turned off before we leave here. */
+		timer_disarm(&me->beepTimer);
 		BSP_buzzer_off();
 		return Q_HANDLED();
 	}
@@ -409,16 +853,17 @@ static QState alarmTurningOffNowState(struct Alarm *me)
 
 static void inc_snooze_times(struct Alarm *me)
 {
-	for (uint8_t i=0; i<SNOOZE_MINUTES; i++) {
-		me->normalSnoozeTime.m =
-			inc_normal_minutes(me->normalSnoozeTime.m);
-		if (me->normalSnoozeTime.m == 0) {
-			me->normalSnoozeTime.h =
-				inc_normal_hours(me->normalSnoozeTime.h);
-		}
+	uint8_t snoozeMinutes = settings_get(SETTING_SNOOZE_MINUTES);
+
+	/* The snooze time is less than an hour, so we carry at most one. */
+	me->normalSnoozeTime.m += snoozeMinutes;
+	if (me->normalSnoozeTime.m >= 60) {
+		me->normalSnoozeTime.m -= 60;
+		me->normalSnoozeTime.h =
+			inc_normal_hours(me->normalSnoozeTime.h);
 	}
 
-	me->decimalSnoozeTime += 100 * SNOOZE_MINUTES;
+	me->decimalSnoozeTime += 100 * snoozeMinutes;
 	if (me->decimalSnoozeTime > 99999L) {
 		me->decimalSnoozeTime -= 100000L;
 	}
@@ -435,18 +880,46 @@ static QState snoozeState(struct Alarm *me)
 		switch (get_time_mode()) {
 		case NORMAL_MODE:
 			print_normal_time(me->normalSnoozeTime);
+#ifdef RTC_ALARM_INTERRUPT
+			post((&timekeeper), SET_SNOOZE_ALARM_SIGNAL,
+			     nt2it(me->normalSnoozeTime));
+#endif
 			break;
 		case DECIMAL_MODE:
 			print_decimal_time(me->decimalSnoozeTime);
+#ifdef RTC_ALARM_INTERRUPT
+			post((&timekeeper), SET_SNOOZE_ALARM_SIGNAL,
+			     nt2it(decimal_to_normal(me->decimalSnoozeTime)));
+#endif
 			break;
 		default:
 			Q_ASSERT( 0 );
 		}
+#ifdef RTC_ALARM_INTERRUPT
+		/* The RTC alarm must be put back after the snooze. */
+		me->rtcAlarmKnown = 0;
+#endif
 		SERIALSTR(" snoozeCount==");
 		serial_send_int(me->snoozeCount);
 		SERIALSTR("\r\n");
+#ifndef RTC_ALARM_INTERRUPT
+		start_countdown(me, me->decimalSnoozeTime,
+				me->normalSnoozeTime, 0, 0);
+#endif
 		display_status_on(DSTAT_SNOOZE);
 		return Q_HANDLED();
+#ifdef RTC_ALARM_INTERRUPT
+	case RTC_ALARM_SIGNAL:
+		return Q_TRAN(alarmedState);
+#else
+	case ALARM_RESYNC_SIGNAL:
+		start_countdown(me, me->decimalSnoozeTime,
+				me->normalSnoozeTime, 0, (uint8_t)Q_PAR(me));
+		if (0 == me->countdown) {
+			return Q_TRAN(alarmedState);
+		}
+		return Q_HANDLED();
+#endif
 	case Q_EXIT_SIG:
 		SERIALSTR("< snoozeState\r\n");
 		display_status_off(DSTAT_SNOOZE);
@@ -458,18 +931,11 @@ static QState snoozeState(struct Alarm *me)
 
 static QState snoozeNormalState(struct Alarm *me)
 {
-	struct NormalTime *thetimep;
-
 	switch (Q_SIG(me)) {
+#ifndef RTC_ALARM_INTERRUPT
 	case TICK_NORMAL_SIGNAL:
-		thetimep = it2ntp(Q_PAR(me));
-		if (thetimep->s == me->normalSnoozeTime.s
-		    && thetimep->m == me->normalSnoozeTime.m
-		    && thetimep->h == me->normalSnoozeTime.h) {
-			return Q_TRAN(alarmedState);
-		} else {
-			return Q_HANDLED();
-		}
+		return countdown_tick(me);
+#endif
 	}
 	return Q_SUPER(snoozeState);
 }
@@ -477,16 +943,11 @@ static QState snoozeNormalState(struct Alarm *me)
 
 static QState snoozeDecimalState(struct Alarm *me)
 {
-	uint32_t thetime;
-
 	switch (Q_SIG(me)) {
+#ifndef RTC_ALARM_INTERRUPT
 	case TICK_DECIMAL_SIGNAL:
-		thetime = Q_PAR(me);
-		if (thetime == me->decimalSnoozeTime) {
-			return Q_TRAN(alarmedState);
-		} else {
-			return Q_HANDLED();
-		}
+		return countdown_tick(me);
+#endif
 	}
 	return Q_SUPER(snoozeState);
 }
@@ -3,17 +3,62 @@
 
 #include "time.h"
 #include "qpn_port.h"
+#include "timers.h"
+
+#ifndef NALARMS
+#define NALARMS 1
+#endif
+
+/**
+ * One of the alarms that the user can set.
+ */
+struct AlarmSetting {
+	uint32_t decimalTime;
+	struct NormalTime normalTime;
+	/** True if this alarm is on. */
+	uint8_t on;
+	/** How many times this alarm can be snoozed. */
+	uint8_t maxSnooze;
+	/** The days this alarm goes off, bit 0 for Sunday to bit 6 for
+	    Saturday.  Zero means go off once, then turn off. */
+	uint8_t days;
+};
 
 struct Alarm {
 	QActive super;
+	/** All the alarms. */
+	struct AlarmSetting settings[NALARMS];
+	/** Indexes into settings[], sorted by the time of day. */
+	uint8_t order[NALARMS];
+	/** The index of the alarm that goes off next.  Its times are copied
+	    into decimalAlarmTime and normalAlarmTime. */
+	uint8_t current;
+	/** Whole days to wait before the current alarm goes off, because of
+	    its days of the week. */
+	uint8_t daysAhead;
+	/** True if the settings were read from EEPROM. */
+	uint8_t loaded;
 	uint32_t decimalAlarmTime;
 	struct NormalTime normalAlarmTime;
 	uint32_t decimalSnoozeTime;
 	struct NormalTime normalSnoozeTime;
+	/** Ticks (in the current mode's seconds) until the alarm or snooze
+	    time. */
+	uint32_t countdown;
 	uint16_t alarmSoundCount;
+	/** Runs out when the alarm has sounded for long enough. */
+	struct Timer runningTimer;
+	/** Runs out at the end of the beep when the alarm is turned off. */
+	struct Timer beepTimer;
 	uint8_t snoozeCount;
 	uint8_t turnOff;
 	uint8_t armed;
+	/** The alarm time we last gave timekeeper for the RTC, and whether
+	    the alarm was on then.  rtcAlarmKnown is false before the first
+	    one, and after a snooze time has been given instead. */
+	struct NormalTime rtcAlarmTime;
+	uint8_t rtcAlarmArmed;
+	uint8_t rtcAlarmKnown;
 	/** Set true when we are able to receive signals. */
 	uint8_t ready;
 };
@@ -22,13 +67,19 @@ extern struct Alarm alarm;
 
 void alarm_ctor(void);
 
-void get_alarm_times(struct Alarm *me, uint8_t *dtimes);
+void get_alarm_times(struct Alarm *me, uint8_t n, uint8_t *dtimes);
+uint8_t get_alarm_on(struct Alarm *me, uint8_t n);
+uint8_t get_alarm_days(struct Alarm *me, uint8_t n);
+uint8_t get_alarm_max_snooze(struct Alarm *me, uint8_t n);
+uint8_t alarm_settings_loaded(struct Alarm *me);
 
 uint8_t get_alarm_state(struct Alarm *me);
 void set_alarm_state(struct Alarm *me, uint8_t onoff);
 
-void set_decimal_alarm_time(struct Alarm *me, uint32_t at);
-void set_normal_alarm_time(struct Alarm *me, struct NormalTime nt);
+void set_alarm_time_on(struct Alarm *me, uint8_t n,
+		       uint32_t dat, struct NormalTime nat, uint8_t on);
+void set_alarm_options(struct Alarm *me, uint8_t n,
+		       uint8_t days, uint8_t maxSnooze);
 uint32_t get_decimal_alarm_time(struct Alarm *me);
 struct NormalTime get_normal_alarm_time(struct Alarm *me);
 
@@ -0,0 +1,69 @@
+#include "boot-trace.h"
+#include "bsp.h"
+#include "serial.h"
+
+
+#ifndef BOOT_TRACE
+#error "boot-trace.c must only be compiled with BOOT_TRACE defined"
+#endif
+
+
+/** The most marks we keep.  Later ones are dropped. */
+#define BOOT_TRACE_SIZE 12
+
+struct BootTraceMark {
+	uint16_t ms;
+	char const Q_ROM *what;
+};
+
+static struct BootTraceMark marks[BOOT_TRACE_SIZE];
+static uint8_t nmarks;
+/** True once the trace has been printed.  After that, marks are ignored. */
+static uint8_t done;
+
+
+/**
+ * Remember the time now.
+ *
+ * This doesn't print anything, so the serial port doesn't slow down the
+ * startup we're trying to measure.
+ */
+void boot_trace(char const Q_ROM * const Q_ROM_VAR what)
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	if (! done && nmarks < BOOT_TRACE_SIZE) {
+		marks[nmarks].ms = BSP_boot_ms();
+		marks[nmarks].what = what;
+		nmarks ++;
+	}
+	SREG = sreg;
+}
+
+
+/**
+ * Remember the time of the last mark, and print them all.  Only the first call
+ * does anything.
+ */
+void boot_trace_done(char const Q_ROM * const Q_ROM_VAR what)
+{
+	uint16_t prev = 0;
+
+	if (done) {
+		return;
+	}
+	boot_trace(what);
+	done = 73;
+	for (uint8_t i=0; i<nmarks; i++) {
+		SERIALSTR("boot: ");
+		serial_send_int(marks[i].ms);
+		SERIALSTR("ms +");
+		serial_send_int(marks[i].ms - prev);
+		SERIALSTR(" ");
+		serial_send_rom(marks[i].what);
+		SERIALSTR("\r\n");
+		prev = marks[i].ms;
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef boot_trace_h_INCLUDED
+#define boot_trace_h_INCLUDED
+
+#include "qpn_port.h"
+
+/**
+ * @file
+ *
+ * Record how long each part of the startup takes.
+ *
+ * Build with BOOT_TRACE=1, and the time of each BOOT_TRACE_MARK() since the
+ * start of main() is printed on the serial port when BOOT_TRACE_DONE() is
+ * called.  Without BOOT_TRACE these do nothing.
+ */
+
+#ifdef BOOT_TRACE
+
+void boot_trace(char const Q_ROM * const Q_ROM_VAR what);
+void boot_trace_done(char const Q_ROM * const Q_ROM_VAR what);
+
+#define BOOT_TRACE_MARK(s)					\
+	do {							\
+		static const char PROGMEM ss[] = s;		\
+		boot_trace(ss);					\
+	} while (0)
+
+#define BOOT_TRACE_DONE(s)					\
+	do {							\
+		static const char PROGMEM ss[] = s;		\
+		boot_trace_done(ss);				\
+	} while (0)
+
+#else
+
+#define BOOT_TRACE_MARK(s)
+#define BOOT_TRACE_DONE(s)
+
+#endif
+
+#endif
@@ -7,6 +7,8 @@
 #include "toggle-pin.h"
 #include "morse.h"
 #include "lcd.h"
+#include "timers.h"
+#include "statetrace.h"
 #include <avr/wdt.h>
 
 
@@ -21,12 +23,61 @@ void lcd_assert_nostop(char const Q_ROM * const Q_ROM_VAR file, int line);
 Q_DEFINE_THIS_FILE;
 
 
+#if defined(RTC_ALARM_INTERRUPT) && ! defined(RTC_32KHZ_TIMEBASE)
+#error "RTC_ALARM_INTERRUPT needs RTC_32KHZ_TIMEBASE for the normal seconds"
+#endif
+
+#if defined(TIME_SYNC) && defined(RTC_32KHZ_TIMEBASE)
+/* The slewing is done by changing the timer 1 period. */
+#error "TIME_SYNC needs the timer 1 time base"
+#endif
+
+#if defined(POWER_STATS) && defined(QK_PREEMPTIVE)
+/* With QK, the active objects run inside the interrupt that woke us, so
+   AVR_sleep() can't see how long we were awake. */
+#error "POWER_STATS does not work with QK_PREEMPTIVE"
+#endif
+
+
+/** Timer 1 counts to this value (0xd2f0) at 2MHz, to give 32 ticks per
+    decimal second.  See timer1_init(). */
+#define TIMER1_TOP 54000
+
+
+#if defined(LOW_POWER) && ! defined(RTC_32KHZ_TIMEBASE) && \
+	! defined(TIME_SYNC) && ! defined(BOOT_TRACE) && ! defined(STATE_TRACE)
+/* With LOW_POWER, when nothing needs every decimal tick, timer 3 takes over
+   from the timer 1 interrupt and ticks this many times slower.  We can't do
+   that when timer 3 is the RTC time base or the TIME_SYNC normal second
+   timer, or when the boot and state trace time stamps count every tick.  See
+   start_slow_ticks(). */
+#define SLOW_TICKS 8
+#endif
+
+
 static void timer1_init(void);
+#ifdef LOW_POWER
+static uint8_t decode_button(uint8_t adc_value);
+#endif
+#ifdef SLOW_TICKS
+static uint8_t ticks_idle(void);
+static void slow_ticks_off(void);
+static void stop_slow_ticks(void);
+#endif
+#ifdef RTC_32KHZ_TIMEBASE
+static void timer3_init(void);
+#endif
 static void buttons_init(void);
 static void rtc_int_init(void);
 static void leds_init(void);
 
 
+#ifdef SLOW_TICKS
+/** True while timer 3 is counting the decimal ticks instead of timer 1. */
+static uint8_t slow_ticking;
+#endif
+
+
 void BSP_QF_onStartup(void)
 {
 	/* We setup the periodic interrupt after QF has started, so we don't
@@ -34,12 +85,14 @@ void BSP_QF_onStartup(void)
 	   Timer 1 doesn't generate any events yet, but will eventually scan
 	   the buttons and send button events. */
 	timer1_init();
+#ifdef RTC_32KHZ_TIMEBASE
+	timer3_init();
+#endif
 	buttons_init();
 
 	Q_ASSERT( (SREG & (1<<7)) == 0 );
 
 	sei();
-	lcd_line2("Start");
 }
 
 
@@ -49,10 +102,64 @@ void BSP_enable_rtc_interrupt(void)
 }
 
 
+#ifdef POWER_STATS
+/** Number of times we have woken from sleep. */
+static uint16_t wakeups;
+/** Time spent awake, in timer 1 counts (0.5us). */
+static uint32_t active_counts;
+/** The timer 1 count when we last woke up. */
+static uint16_t awake_at;
+#endif
+
+
+/**
+ * @brief Put the CPU to sleep until the next interrupt.
+ *
+ * We can only use idle mode.  Timer 1 (the decimal ticks and the buzzer),
+ * timer 2 (the LCD backlight PWM), the ADC (the buttons) and the UART all run
+ * from the I/O clock, which is stopped in the deeper sleep modes.  The buttons
+ * are on an ADC input with no pin change interrupt, so we couldn't wake on a
+ * button press anyway.
+ *
+ * With LOW_POWER defined, we instead make each wakeup as short as possible,
+ * and when nothing needs every decimal tick we wake up eight times less often.
+ * See decimal_32_tick() and start_slow_ticks().
+ */
 static void AVR_sleep(void)
 {
+#ifdef POWER_STATS
+	uint16_t now;
+#endif
+
+#ifdef SLOW_TICKS
+	/* Something started while we were ticking slowly, like a timer armed
+	   by an event handler.  Go back to ticking every 1/32 second, and let
+	   the event loop see anything that stopping posted before we sleep. */
+	if (slow_ticking && ! ticks_idle()) {
+		stop_slow_ticks();
+		QK_ISR_EXIT();
+		sei();
+		return;
+	}
+#endif
+
+#ifdef POWER_STATS
+	now = TCNT1;
+	if (now >= awake_at) {
+		active_counts += now - awake_at;
+	} else {
+		active_counts += now + TIMER1_TOP + 1 - awake_at;
+	}
+#endif
+
 	/* Power reduction on SPI (unused) */
+#ifdef LOW_POWER
+	/* Also timer 0 and the USB controller, which we don't use. */
+	PRR0 = (1 << PRSPI) | (1 << PRTIM0);
+	PRR1 = (1 << PRUSB);
+#else
 	PRR0 = (1 << PRSPI);
+#endif
 	/* Idle sleep mode.  We're mains powered, so it's not a big issue. */
 	SMCR = (0b000 << SM0) | (1 << SE);
 
@@ -64,15 +171,221 @@ static void AVR_sleep(void)
 	__asm__ __volatile__ ("sleep" "\n\t" :: );
 
 	SMCR = 0;                                           /* clear the SE bit */
+
+#ifdef POWER_STATS
+	/* We return here after the interrupt handler that woke us, with
+	   interrupts on. */
+	cli();
+	awake_at = TCNT1;
+	wakeups ++;
+	sei();
+#endif
+}
+
+
+#ifdef POWER_STATS
+/**
+ * Get the number of wakeups and the time spent awake since the last call.
+ *
+ * The active time is approximate.  It doesn't include the interrupt handler
+ * that woke us up, and if we stay awake for longer than one timer 1 period we
+ * lose the whole periods.
+ *
+ * @param w the number of wakeups
+ * @param active the active time in units of 0.5us
+ */
+void BSP_get_power_stats(uint16_t *w, uint32_t *active)
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	*w = wakeups;
+	*active = active_counts;
+	wakeups = 0;
+	active_counts = 0;
+	SREG = sreg;
+}
+#endif
+
+
+#ifdef TICK_LATENCY
+/**
+ * Get the time since the last decimal tick interrupt, in units of 0.5us.
+ *
+ * Call this when the TICK_DECIMAL_32_SIGNAL is handled to see how long it
+ * waited in the queue.  Timer 1 and timer 3 both clear their counters on the
+ * compare match that generates the tick.  With the RTC time base, timer 3
+ * counts at 32768Hz, so the result is only accurate to about 30us.
+ */
+uint16_t BSP_tick_latency(void)
+{
+	uint16_t counts;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+#ifdef RTC_32KHZ_TIMEBASE
+	counts = TCNT3 * 61;
+#else
+	counts = TCNT1;
+#endif
+	SREG = sreg;
+	return counts;
+}
+
+
+#ifndef RTC_32KHZ_TIMEBASE
+/** The longest timer 1 interrupt, in 0.5us counts, since the last report. */
+static uint16_t tick_isr_max;
+/** The sum of the timer 1 interrupt times since the last report. */
+static uint32_t tick_isr_total;
+/** The number of timer 1 interrupts since the last report. */
+static uint16_t tick_isr_count;
+
+
+/**
+ * Record how long the timer 1 interrupt took, up to now.  The counter was
+ * cleared by the compare match, so this includes getting into the interrupt.
+ */
+static inline void record_tick_isr_time(void)
+{
+	uint16_t counts = TCNT1;
+
+	if (counts > tick_isr_max) {
+		tick_isr_max = counts;
+	}
+	tick_isr_total += counts;
+	tick_isr_count ++;
+}
+
+
+/**
+ * Get the longest and the mean time taken by the timer 1 interrupt, not
+ * counting the active objects that QK runs at the end of it, in CPU cycles.
+ * Start counting again.
+ */
+void BSP_get_tick_isr_cycles(uint16_t *max, uint16_t *mean)
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	/* Timer 1 counts once every 8 CPU cycles. */
+	*max = tick_isr_max * 8;
+	if (tick_isr_count) {
+		*mean = (tick_isr_total * 8) / tick_isr_count;
+	} else {
+		*mean = 0;
+	}
+	tick_isr_max = 0;
+	tick_isr_total = 0;
+	tick_isr_count = 0;
+	SREG = sreg;
 }
+#endif
+#endif
+
+
+#ifdef BOOT_TRACE
+/** The time from the start of main() to timer1_init(), in ms. */
+static uint16_t boot_ms_at_start;
+/** Decimal ticks since timer1_init(). */
+static uint16_t boot_ticks;
+/** True once timer1_init() has taken over timer 1. */
+static uint8_t boot_ticking;
+
+
+/**
+ * Start counting the time since the start of main().
+ *
+ * Until the ticks start, timer 1 runs freely at 15.625kHz (64us per count),
+ * which lasts for four seconds.
+ */
+static void boot_clock_init(void)
+{
+	TCCR1A = 0;
+	TCCR1B = (5 << CS10);	/* CLKio/1024 */
+	TCNT1 = 0;
+	boot_ticking = 0;
+	boot_ticks = 0;
+}
+
+
+/**
+ * Get the time since the start of main(), in ms.
+ *
+ * After the ticks start, this is the number of ticks (27ms each) plus the
+ * time since the last tick.  If a tick is pending because interrupts are off,
+ * count it here.
+ */
+uint16_t BSP_boot_ms(void)
+{
+	uint32_t ms;
+	uint16_t ticks;
+	uint16_t counts;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	if (! boot_ticking) {
+		ms = (uint32_t)TCNT1 * 8 / 125;
+	} else {
+		ticks = boot_ticks;
+#ifdef RTC_32KHZ_TIMEBASE
+		counts = TCNT3;
+		if (TIFR3 & (1 << OCF3A)) {
+			ticks ++;
+			counts = TCNT3;
+		}
+		/* Timer 3 counts at 32768Hz. */
+		ms = boot_ms_at_start + ticks * 27L + counts / 33;
+#else
+		counts = TCNT1;
+		if (TIFR1 & (1 << OCF1A)) {
+			ticks ++;
+			counts = TCNT1;
+		}
+		/* Timer 1 counts at 2MHz. */
+		ms = boot_ms_at_start + ticks * 27L + counts / 2000;
+#endif
+	}
+	SREG = sreg;
+	return ms;
+}
+#endif
 
 
 void QF_onIdle(void)
 {
+#ifdef STATE_TRACE
+	/* Send the trace a line at a time, and let the interrupts and the
+	   event loop in between.  Only sleep when there's nothing to send, or
+	   no room to send it. */
+	if (state_trace_flush()) {
+		sei();
+		return;
+	}
+#endif
 	AVR_sleep();
 }
 
 
+#ifdef QK_PREEMPTIVE
+void QK_onIdle(void)
+{
+#ifdef STATE_TRACE
+	if (state_trace_flush()) {
+		return;
+	}
+#endif
+	/* AVR_sleep() turns interrupts on again just before it sleeps. */
+	cli();
+	AVR_sleep();
+}
+#endif
+
+
 /* Definitions for the LCD brightness PWM pin. */
 #define BRIGHT_PORT PORTB
 #define BRIGHT_DDR  DDRB
@@ -109,6 +422,7 @@ SIGNAL(WDT_vect)
 	   we don't send this signal we're hosed by the next WDT timeout
 	   anyway. */
 	postISR(&timekeeper, WATCHDOG_SIGNAL, 0);
+	QK_ISR_EXIT();
 }
 
 
@@ -116,6 +430,65 @@ void BSP_startmain(void)
 {
 	wdt_reset();
 	wdt_disable();
+#ifdef BOOT_TRACE
+	boot_clock_init();
+#endif
+}
+
+
+/** Written over the unused RAM at reset, so we can see how deep the stack has
+    been. */
+#define STACK_PAINT 0xc5
+
+/* From the linker script.  _end is just past .bss and .noinit, and __stack is
+   the top of RAM. */
+extern uint8_t _end;
+extern uint8_t __stack;
+
+void BSP_paint_stack(void) __attribute__ ((naked, used, section (".init1")));
+
+/**
+ * Fill the RAM between the end of the static variables and the top of the
+ * stack with STACK_PAINT.
+ *
+ * This runs from .init1, before the C runtime has set up the zero register or
+ * the static variables, so it's all assembler.  Nothing is on the stack yet,
+ * so we can paint all of it.
+ */
+void BSP_paint_stack(void)
+{
+	__asm__ __volatile__ (
+		"	ldi r30, lo8(_end)	\n\t"
+		"	ldi r31, hi8(_end)	\n\t"
+		"	ldi r24, %0		\n\t"
+		"	ldi r25, hi8(__stack)	\n\t"
+		"	rjmp 2f			\n\t"
+		"1:	st Z+, r24		\n\t"
+		"2:	cpi r30, lo8(__stack)	\n\t"
+		"	cpc r31, r25		\n\t"
+		"	brlo 1b			\n\t"
+		"	breq 1b			\n\t"
+		:: "M" (STACK_PAINT));
+}
+
+
+/**
+ * Find out how much of the stack has never been used since reset.
+ *
+ * The stack grows down from the top of RAM, so count the painted bytes from
+ * the end of the static variables up to the first one that has been written.
+ * This is the high-water mark of the stack, including interrupts.
+ */
+uint16_t BSP_stack_unused(void)
+{
+	const uint8_t *p = &_end;
+	uint16_t unused = 0;
+
+	while (p <= &__stack && STACK_PAINT == *p) {
+		p++;
+		unused++;
+	}
+	return unused;
 }
 
 
@@ -200,6 +573,29 @@ void BSP_leds(uint8_t *data)
 }
 
 
+#ifdef RTC_ALARM_INTERRUPT
+
+/**
+ * The RTC's INT/SQW output is an active low alarm interrupt, so we look for
+ * the falling edge.  It stays low until timekeeper clears the alarm flags.
+ */
+static void
+rtc_int_init(void)
+{
+	EICRB = 0b00100000;	/* INT6, falling edge */
+	EIMSK |= (1 << 6);	/* INT6 interrupt enable */
+	PORTE |= (1 << 6);	/* Pullup on the INT6 input */
+}
+
+
+SIGNAL(INT6_vect)
+{
+	postISR((&timekeeper), RTC_ALARM_SIGNAL, 0);
+	QK_ISR_EXIT();
+}
+
+#else
+
 static void
 rtc_int_init(void)
 {
@@ -211,9 +607,12 @@ rtc_int_init(void)
 
 SIGNAL(INT6_vect)
 {
-	postISR((&timekeeper), TICK_NORMAL_SIGNAL, 0);
+	postISR((&timekeeper), TICK_NORMAL_SIGNAL, BSP_NORMAL_FROM_RTC);
+	QK_ISR_EXIT();
 }
 
+#endif
+
 
 /**
  * @brief Set up timer 1 to generate a periodic interrupt.
@@ -237,6 +636,11 @@ SIGNAL(INT6_vect)
  *
  * A secondary function of Timer 1 is producing the buzzer sound.  Normally
  * OC1B is disconnected, but we connect it to its output pin to make the sound.
+ *
+ * If RTC_32KHZ_TIMEBASE is defined, timer 3 counts the RTC's 32kHz output and
+ * generates the decimal ticks instead (see timer3_init()).  Timer 1 keeps
+ * running with the same period so the buzzer still works, but it doesn't
+ * interrupt.
  */
 static void
 timer1_init(void)
@@ -246,6 +650,12 @@ timer1_init(void)
 	sreg = SREG;
 	cli();
 
+#ifdef BOOT_TRACE
+	/* Switch the boot time over to counting ticks. */
+	boot_ms_at_start = (uint32_t)TCNT1 * 8 / 125;
+	boot_ticking = 73;
+	TCNT1 = 0;
+#endif
 	DDRB &= ~(1 << 6);	/* OC1B input */
 	TCCR1A =(0 << COM1A1) |
 		(0 << COM1A0) |	/* OC1A disconnected */
@@ -256,15 +666,87 @@ timer1_init(void)
 	TCCR1B =(1 << WGM13 ) |	/* Fast PWM */
 		(1 << WGM12 ) |	/* Fast PWM */
 		(2 << CS10  );	/* CLKio/8 */
-	OCR1AH = 0xd2;		/* 0xd2f0 = 54000 */
-	OCR1AL = 0xf0;
+	OCR1A = TIMER1_TOP;
 	OCR1BH = 0;
 	OCR1BL = 1;
+#ifdef RTC_32KHZ_TIMEBASE
+	TIMSK1 = 0;
+#else
 	TIMSK1 =(1 << OCIE1A);
+#endif
+
+	SREG = sreg;
+}
+
+
+#ifdef RTC_32KHZ_TIMEBASE
+
+/*
+ * A decimal second is 0.864 normal seconds, or 28311.552 cycles of the RTC's
+ * 32.768kHz output.  One 1/32 of a decimal second is 884.736 cycles, which we
+ * can't count exactly.  So we count either 884 or 885 cycles, choosing the
+ * longer period 92 times out of every 125 (0.736 == 92/125).  Every 125 ticks
+ * (3.375 normal seconds) we have counted exactly 110592 cycles, so the decimal
+ * time has the same accuracy as the RTC and never needs correcting.
+ */
+#define RTC32K_PERIOD       884
+#define RTC32K_FRACTION     92
+#define RTC32K_FRACTION_DEN 125
+
+Q_ASSERT_COMPILE( (RTC32K_PERIOD * RTC32K_FRACTION_DEN + RTC32K_FRACTION)
+		  == (32768L * 27L / 8L) );
+
+/**
+ * Accumulates the fractional part of the timer 3 period.  When this reaches
+ * RTC32K_FRACTION_DEN we count one extra cycle in the next period.
+ */
+static uint8_t timer3_fraction;
+
+#ifdef RTC_ALARM_INTERRUPT
+/**
+ * Counts RTC cycles up to one normal second.  The RTC's INT/SQW pin is used
+ * for the alarm interrupt, so there is no 1Hz square wave, and we count the
+ * normal seconds from the 32kHz output instead.
+ */
+static uint16_t rtc_cycles;
+#endif
+
+
+/**
+ * @brief Set up timer 3 to count the RTC's 32kHz output.
+ *
+ * The DS3232 32kHz output (enabled with EN32kHz in the status register) is
+ * connected to T3 (PC3).  The output is open drain, so we need the pullup.
+ * Timer 3 counts rising edges in CTC mode, and the compare match interrupt
+ * generates the decimal 1/32 second ticks.
+ */
+static void
+timer3_init(void)
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+
+	DDRC &= ~(1 << 3);	/* T3 input */
+	PORTC |= (1 << 3);	/* Pullup on T3 */
+	timer3_fraction = 0;
+	TCCR3A =(0 << COM3A1) |
+		(0 << COM3A0) |	/* OC3A disconnected */
+		(0 << WGM31 ) |	/* CTC, mode 4, count to OCR3A */
+		(0 << WGM30 );
+	TCCR3B =(0 << WGM33 ) |
+		(1 << WGM32 ) |	/* CTC */
+		(7 << CS30  );	/* External clock on T3, rising edge */
+	TCNT3 = 0;
+	OCR3A = RTC32K_PERIOD - 1;
+	TIMSK3 =(1 << OCIE3A);
 
 	SREG = sreg;
 }
 
+#endif /* RTC_32KHZ_TIMEBASE */
+
 
 void BSP_buzzer_on(uint8_t volume)
 {
@@ -296,57 +778,671 @@ void BSP_buzzer_off(void)
 }
 
 
+#ifdef LOW_POWER
+/**
+ * The button that was down at the last decimal tick.  With LOW_POWER, the
+ * buttons are sampled in the timer interrupt, and BSP_getButton() returns
+ * this.
+ */
+static volatile uint8_t button_sample;
+#endif
+
+
 /**
  * Increments each TICK_DECIMAL_32_SIGNAL, so we can see where in the decimal
- * second an event was generated.  Set to zero by the code that ticks over
- * decimal seconds.
+ * second an event was generated.  Counts from 1 to 32 and then starts again,
+ * so timekeeper can work out how many decimal seconds have gone past even if
+ * some of the signals were coalesced.
  */
 static uint8_t decimal_32_counter;
 
 
+#ifdef TIME_SYNC
+
+/** Decimal ticks since timer1_init(), for the time sync stamps. */
+static uint32_t sync_ticks;
+
+/** Timer 1 counts still to be taken out of (positive) or added to (negative)
+    the tick periods. */
+static int32_t slew_counts;
+
+/** The most counts taken out of or added to one tick, 0.1% of the period. */
+#define SLEW_STEP 54
+
+/**
+ * True while the normal seconds are made from timer 1, so the slewing moves
+ * them with the decimal seconds.  Otherwise they come from the RTC's 1Hz
+ * output on INT6.
+ */
+static uint8_t normal_from_timer;
+
+/** Ticks since the start of the current 125 decimal seconds (108 normal
+    seconds), from 0 to 3999. */
+static uint16_t block_ticks;
+
+/** The next normal second in the block, from 0 to 107. */
+static uint8_t normal_index;
+
+
+/**
+ * Get a time stamp for the time sync protocol.
+ *
+ * The stamp counts in 1/65536ths of a decimal second (2048 per tick) since
+ * timer1_init(), and wraps.  If a tick is pending because interrupts are
+ * off, count it here.
+ */
+uint32_t BSP_sync_stamp(void)
+{
+	uint32_t ticks;
+	uint16_t counts;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	ticks = sync_ticks;
+	counts = TCNT1;
+	if (TIFR1 & (1 << OCF1A)) {
+		ticks ++;
+		counts = TCNT1;
+	}
+	SREG = sreg;
+	/* 2048 units per 54000 counts. */
+	return (ticks << 11) + ((uint32_t)counts * 128 / 3375);
+}
+
+
+/**
+ * Get the time sync stamp for the start of the current decimal second.
+ *
+ * The second started at the tick that set decimal_32_counter to 32.
+ */
+uint32_t BSP_sync_second_stamp(void)
+{
+	uint32_t ticks;
+	uint8_t counter;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	ticks = sync_ticks;
+	counter = decimal_32_counter;
+	SREG = sreg;
+	return (ticks - (counter % 32)) << 11;
+}
+
+
+/**
+ * Move the ticks forward (positive) or back (negative) by this many timer 1
+ * counts, a little each tick, so the time never jumps.  This replaces any
+ * slew that hasn't finished.
+ */
+void BSP_slew(int32_t counts)
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	slew_counts = counts;
+	SREG = sreg;
+}
+
+
+uint8_t BSP_slewing(void)
+{
+	uint8_t slewing;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	slewing = (slew_counts != 0);
+	SREG = sreg;
+	return slewing;
+}
+
+
+/**
+ * Set the length of the next tick period.  Called from the timer 1 interrupt.
+ *
+ * OCR1A is double buffered, so this changes the period after the one that
+ * has just started.
+ */
+static inline void slew_tick(void)
+{
+	uint8_t step;
+
+	if (slew_counts > 0) {
+		step = slew_counts > SLEW_STEP ? SLEW_STEP : slew_counts;
+		OCR1A = TIMER1_TOP - step;
+		slew_counts -= step;
+	} else if (slew_counts < 0) {
+		step = slew_counts < -SLEW_STEP ? SLEW_STEP : - slew_counts;
+		OCR1A = TIMER1_TOP + step;
+		slew_counts += step;
+	} else {
+		OCR1A = TIMER1_TOP;
+	}
+}
+
+
+/**
+ * Work out where normal second normal_index starts: the tick before it, and
+ * how many timer 1 counts after that tick.
+ *
+ * There are 4000 ticks in 108 normal seconds, so normal second i starts
+ * i*1000/27 ticks into the block.  A tick is 54000 counts, so each 27th of a
+ * tick is exactly 2000 counts.
+ */
+static inline uint16_t normal_start_tick(uint8_t i)
+{
+	return (uint16_t)i * 1000 / 27;
+}
+
+static inline uint16_t normal_start_counts(uint8_t i)
+{
+	return ((uint16_t)i * 1000 % 27) * 2000;
+}
+
+
+/**
+ * Make the normal seconds from timer 1, starting now.
+ *
+ * Timekeeper calls this at the start of a decimal second, or soon after.
+ *
+ * @param decimal125 how many decimal seconds into the block this one is
+ * @return how many whole normal seconds into the block we are
+ */
+uint8_t BSP_normal_from_timer(uint8_t decimal125)
+{
+	uint8_t i;
+	uint8_t sreg;
+
+	Q_ASSERT( decimal125 < 125 );
+	sreg = SREG;
+	cli();
+	block_ticks = decimal125 * 32 + decimal_32_counter % 32;
+	/* Start with the first normal second whose start tick hasn't
+	   happened yet.  Any that start later in this tick have been
+	   missed, and are counted as already started. */
+	i = 0;
+	while (i < 108 && normal_start_tick(i) <= block_ticks) {
+		i ++;
+	}
+	normal_index = (i == 108) ? 0 : i;
+	normal_from_timer = 73;
+	SREG = sreg;
+	return i - 1;
+}
+
+
+/**
+ * Go back to taking the normal seconds from the RTC.
+ */
+void BSP_normal_from_rtc(void)
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	normal_from_timer = 0;
+	TCCR3B = 0;
+	SREG = sreg;
+}
+
+
+/**
+ * Start the next normal second if it begins during this tick.  Called from the
+ * timer 1 interrupt.
+ *
+ * Timer 3 is free when TIME_SYNC is on, as it's only used for the RTC time
+ * base.  We use it as a one shot to get to the exact count in the tick.  It
+ * counts at the same rate as timer 1, but isn't slewed, so it's up to 54
+ * counts (27us) out.
+ */
+static inline void normal_tick(void)
+{
+	uint16_t counts;
+	uint16_t now;
+
+	if (! normal_from_timer) {
+		return;
+	}
+	block_ticks ++;
+	if (block_ticks >= 4000) {
+		block_ticks = 0;
+	}
+	if (block_ticks != normal_start_tick(normal_index)) {
+		return;
+	}
+	counts = normal_start_counts(normal_index);
+	normal_index ++;
+	if (normal_index >= 108) {
+		normal_index = 0;
+	}
+	/* Timer 1 has counted this far since the tick. */
+	now = TCNT1;
+	if (counts <= now + 1) {
+		postISR((&timekeeper), TICK_NORMAL_SIGNAL,
+			BSP_NORMAL_FROM_TIMER);
+		return;
+	}
+	TCNT3 = 0;
+	OCR3A = counts - now - 1;
+	TIFR3 = (1 << OCF3A);
+	TCCR3A = 0;
+	TCCR3B =(1 << WGM32 ) |	/* CTC, mode 4, count to OCR3A */
+		(2 << CS30  );	/* CLKio/8, like timer 1 */
+}
+
+
+/**
+ * The normal second starts now.
+ */
+SIGNAL(TIMER3_COMPA_vect)
+{
+	TOGGLE_ON();
+	TCCR3B = 0;		/* Stopped until the next normal second. */
+	postISR((&timekeeper), TICK_NORMAL_SIGNAL, BSP_NORMAL_FROM_TIMER);
+	QK_ISR_EXIT();
+}
+
+#endif /* TIME_SYNC */
+
+
+#ifdef STATE_TRACE
+/**
+ * The state trace time stamp at the last decimal tick.  Each tick is 54000
+ * timer 1 counts, or 1687.5 stamp units, so this goes up by 1687 and 1688 in
+ * turn, depending on the new decimal_32_counter.
+ */
+static uint16_t trace_stamp_base;
+
+
+/**
+ * Get a time stamp for the state trace, in units of 16us, which wraps after
+ * about a second.  If a tick is pending because interrupts are off, count it
+ * here.
+ */
+uint16_t BSP_trace_stamp(void)
+{
+	uint16_t base;
+	uint16_t counts;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	base = trace_stamp_base;
+#ifdef RTC_32KHZ_TIMEBASE
+	/* Timer 3 counts at 32768Hz, about 61 timer 1 counts. */
+	counts = TCNT3;
+	if (TIFR3 & (1 << OCF3A)) {
+		base += 1687 + ((decimal_32_counter + 1) & 1);
+		counts = TCNT3;
+	}
+	counts *= 61;
+#else
+	counts = TCNT1;
+	if (TIFR1 & (1 << OCF1A)) {
+		base += 1687 + ((decimal_32_counter + 1) & 1);
+		counts = TCNT1;
+	}
+#endif
+	SREG = sreg;
+	return base + counts / 32;
+}
+#endif
+
+
 void BSP_set_decimal_32_counter(uint8_t dc)
 {
 	uint8_t sreg;
 	sreg = SREG;
 	cli();
+#ifdef SLOW_TICKS
+	/* Don't count the ticks since the last slow one.  They belong to the
+	   old time. */
+	if (slow_ticking) {
+		slow_ticks_off();
+	}
+#endif
 	decimal_32_counter = dc;
 	SREG = sreg;
 }
 
 
 /**
- * @brief Handle the periodic interrupt from timer 1.
+ * Start a new decimal second now.
+ *
+ * With the CPU timer as the time base this is the same as setting the 1/32
+ * counter to zero.  With the RTC as the time base we also restart the timer 3
+ * period, so from here the decimal seconds are locked to the RTC's seconds.
+ */
+void BSP_align_decimal_32_counter(void)
+{
+	uint8_t sreg;
+	sreg = SREG;
+	cli();
+#ifdef SLOW_TICKS
+	/* Don't count the ticks since the last slow one.  They belong to the
+	   old time. */
+	if (slow_ticking) {
+		slow_ticks_off();
+	}
+#endif
+	decimal_32_counter = 0;
+#ifdef RTC_32KHZ_TIMEBASE
+	TCNT3 = 0;
+	OCR3A = RTC32K_PERIOD - 1;
+	timer3_fraction = 0;
+#ifdef RTC_ALARM_INTERRUPT
+	rtc_cycles = 0;
+#endif
+#endif
+	SREG = sreg;
+}
+
+
+#ifdef LOW_POWER
+/**
+ * Pick up the button reading started at the last tick, and start the next
+ * one.  Only wake up the buttons object if a button is down, or if it's still
+ * busy with the last press.
+ */
+static inline void sample_buttons(void)
+{
+	uint8_t button;
+
+	button = decode_button(ADCH);
+	button_sample = button;
+	ADCSRA |= (1 << ADSC);
+	if (button || ! buttons_idle()) {
+		postISR_latest_r((&buttons), TICK_DECIMAL_32_SIGNAL, 0);
+	}
+}
+#endif
+
+
+/**
+ * @brief Handle the periodic decimal tick.
  *
  * The buttons are scanned in response to the TICK_DECIMAL_32_SIGNAL.
  *
- * @todo If the RTC is not functioning, send TICK_RTC32_SIGNALs.
+ * Called from the timer 1 or timer 3 interrupt, depending on the time base.
  */
-SIGNAL(TIMER1_COMPA_vect)
+static inline void decimal_32_tick(void)
 {
+#ifndef LOW_POWER
 	static uint8_t watchdog_counter = 0;
+#endif
 
-	TOGGLE_ON();
 	/* Increment the counter before sending the event.  We should never
 	   send a zero.  No real reason, just the way it is. */
+	if (decimal_32_counter >= 32) {
+		decimal_32_counter = 0;
+	}
 	decimal_32_counter ++;
+#ifdef BOOT_TRACE
+	boot_ticks ++;
+#endif
+#ifdef TIME_SYNC
+	sync_ticks ++;
+#endif
+#ifdef STATE_TRACE
+	trace_stamp_base += 1687 + (decimal_32_counter & 1);
+#endif
 	Q_ASSERT( ((QActive*)(&timekeeper))->prio );
-	postISR_r((&timekeeper), TICK_DECIMAL_32_SIGNAL, decimal_32_counter);
+#ifdef LOW_POWER
+	/* Timekeeper only acts on the last tick of each decimal second, so
+	   don't wake it up for the others.  These can't be coalesced, as the
+	   counter is always 32 and a skipped count would be ambiguous, but
+	   one a second won't fill the queue. */
+	if (32 == decimal_32_counter) {
+		postISR_r((&timekeeper), TICK_DECIMAL_32_SIGNAL,
+			  decimal_32_counter);
+	}
+	sample_buttons();
+	/* We don't send WATCHDOG_SIGNAL from here.  The watchdog interrupt
+	   sends it when it's needed, which saves five wakeups a second. */
+#else
+	/* These are coalesced, so a receiver that's busy with something slow
+	   (like the LCD or the serial port) can't have its queue filled with
+	   ticks. */
+	postISR_latest_r((&timekeeper), TICK_DECIMAL_32_SIGNAL,
+			 decimal_32_counter);
 	/* The buttons don't care where we are in the second, so don't send the
 	   counter with this signal. */
-	postISR_r((&buttons), TICK_DECIMAL_32_SIGNAL, 0);
+	postISR_latest_r((&buttons), TICK_DECIMAL_32_SIGNAL, 0);
 
 	watchdog_counter ++;
 	if (watchdog_counter >= 7) {
-		postISR_r((&timekeeper), WATCHDOG_SIGNAL, 0);
+		postISR_latest_r((&timekeeper), WATCHDOG_SIGNAL, 0);
 		watchdog_counter = 0;
 		/* Turn on the Arduino LED.  It gets turned off when
 		   WATCHDOG_SIGNAL is handled. */
 		PORTB |= (1 << 5);
 	}
+#endif
 
 	QF_tick();
+	timers_tick();
+}
+
+
+#ifdef SLOW_TICKS
+
+/*
+ * Timer 3 counts at CLKio/64, eight times slower than timer 1, so the same
+ * count gives a period of exactly eight decimal ticks (216ms).  The two
+ * timers share the prescaler, so they never drift apart.
+ */
+#define SLOW_TOP TIMER1_TOP
+
+Q_ASSERT_COMPILE( SLOW_TICKS == 8 );
+
+/**
+ * True if nothing needs every decimal tick: the buttons have nothing to time,
+ * and no QP-nano or timers.c timer is running.
+ */
+static uint8_t ticks_idle(void)
+{
+	return buttons_idle() && ! QF_timerSet_ && ! timers_running();
+}
+
+
+/**
+ * Count SLOW_TICKS decimal ticks at once, and sample the buttons.
+ *
+ * We only tick slowly from a multiple of SLOW_TICKS, so the counter still
+ * lands on 32 at the end of each decimal second.
+ */
+static void count_slow_ticks(void)
+{
+	if (decimal_32_counter >= 32) {
+		decimal_32_counter = 0;
+	}
+	decimal_32_counter += SLOW_TICKS;
+	if (32 == decimal_32_counter) {
+		postISR_r((&timekeeper), TICK_DECIMAL_32_SIGNAL,
+			  decimal_32_counter);
+	}
+	sample_buttons();
+}
+
+
+/**
+ * Hand the decimal ticks over from timer 1 to timer 3.
+ *
+ * Called from the timer 1 interrupt, on a tick that is a multiple of
+ * SLOW_TICKS.  Timer 1 keeps running for the buzzer, but stops interrupting.
+ * The first timer 3 compare match comes three timer 3 counts (12us) after
+ * the timer 1 compare match SLOW_TICKS ticks from now, and so does every one
+ * after that.
+ */
+static void start_slow_ticks(void)
+{
+	uint16_t counts;
+
+	counts = TCNT1;
+	TCCR3B = 0;
+	TCCR3A =(0 << COM3A1) |
+		(0 << COM3A0) |	/* OC3A disconnected */
+		(0 << WGM31 ) |	/* CTC, mode 4, count to OCR3A */
+		(0 << WGM30 );
+	TCNT3 = 0;
+	OCR3A = SLOW_TOP + 3 - counts / 8;
+	TIFR3 = (1 << OCF3A);
+	TIMSK3 = (1 << OCIE3A);
+	TIMSK1 = 0;
+	TCCR3B =(0 << WGM33 ) |
+		(1 << WGM32 ) |	/* CTC */
+		(3 << CS30  );	/* CLKio/64 */
+	slow_ticking = 73;
+}
+
+
+/**
+ * Stop timer 3, and let timer 1 interrupt again from its next compare match.
+ * Call with interrupts off.
+ */
+static void slow_ticks_off(void)
+{
+	TCCR3B = 0;
+	TIMSK3 = 0;
+	TIFR3 = (1 << OCF3A);
+	TIFR1 = (1 << OCF1A);
+	TIMSK1 = (1 << OCIE1A);
+	slow_ticking = 0;
+}
+
+
+/**
+ * Hand the decimal ticks back to timer 1.
+ *
+ * Count the timer 1 periods that have finished since the last slow tick, so
+ * the decimal seconds carry on from the right place.  Call with interrupts
+ * off, while ticking slowly.
+ */
+static void stop_slow_ticks(void)
+{
+	uint16_t counts;
+	uint32_t since;
+	uint8_t ticks;
+
+	/* Keep away from the timer 1 compare match, and from the timer 3 one
+	   just after it, so we know which side of them we're on.  This waits
+	   for 100us at most. */
+	do {
+		counts = TCNT1;
+	} while (counts > TIMER1_TOP - 64 || counts < 128);
+	/* Time since the last counted tick, in timer 1 counts. */
+	since = ((uint32_t)TCNT3 + 3) * 8;
+	if (TIFR3 & (1 << OCF3A)) {
+		/* A slow tick that we haven't counted yet. */
+		since += (uint32_t)SLOW_TICKS * (TIMER1_TOP + 1);
+	}
+	/* The number of whole timer 1 periods in that time.  The timer 1 count
+	   tells us exactly where we are in the current one, so round off any
+	   error in since. */
+	ticks = (since + (TIMER1_TOP + 1) / 2 - counts) / (TIMER1_TOP + 1);
+
+	slow_ticks_off();
+
+	if (ticks) {
+		if (decimal_32_counter >= 32) {
+			decimal_32_counter = 0;
+		}
+		decimal_32_counter += ticks;
+		if (decimal_32_counter >= 32) {
+			/* Late, but timekeeper only counts them. */
+			postISR_r((&timekeeper), TICK_DECIMAL_32_SIGNAL, 32);
+			if (decimal_32_counter > 32) {
+				decimal_32_counter -= 32;
+			}
+		}
+	}
 }
 
+
+/**
+ * @brief Handle the slow decimal tick from timer 3.
+ *
+ * Go back to timer 1 as soon as a button is down or something else needs
+ * every tick.
+ */
+SIGNAL(TIMER3_COMPA_vect)
+{
+	TOGGLE_ON();
+	OCR3A = SLOW_TOP;
+	count_slow_ticks();
+	if (button_sample || ! ticks_idle()) {
+		stop_slow_ticks();
+	}
+	QK_ISR_EXIT();
+}
+
+#endif /* SLOW_TICKS */
+
+
+#ifdef RTC_32KHZ_TIMEBASE
+
+/**
+ * @brief Handle the compare match interrupt from timer 3.
+ *
+ * Choose the length of the next period before doing anything else.  The
+ * timer has only counted a couple of RTC cycles since the compare match, so
+ * it's safe to change OCR3A here.
+ */
+SIGNAL(TIMER3_COMPA_vect)
+{
+	TOGGLE_ON();
+#ifdef RTC_ALARM_INTERRUPT
+	/* Count the period that has just finished. */
+	rtc_cycles += OCR3A + 1;
+	if (rtc_cycles >= 32768U) {
+		rtc_cycles -= 32768U;
+		postISR((&timekeeper), TICK_NORMAL_SIGNAL,
+			BSP_NORMAL_FROM_RTC);
+	}
+#endif
+	timer3_fraction += RTC32K_FRACTION;
+	if (timer3_fraction >= RTC32K_FRACTION_DEN) {
+		timer3_fraction -= RTC32K_FRACTION_DEN;
+		OCR3A = RTC32K_PERIOD;
+	} else {
+		OCR3A = RTC32K_PERIOD - 1;
+	}
+	decimal_32_tick();
+	QK_ISR_EXIT();
+}
+
+#else
+
+/**
+ * @brief Handle the periodic interrupt from timer 1.
+ *
+ * @todo If the RTC is not functioning, send TICK_RTC32_SIGNALs.
+ */
+SIGNAL(TIMER1_COMPA_vect)
+{
+	TOGGLE_ON();
+#ifdef TIME_SYNC
+	slew_tick();
+	normal_tick();
+#endif
+	decimal_32_tick();
+#ifdef TICK_LATENCY
+	record_tick_isr_time();
+#endif
+#ifdef SLOW_TICKS
+	if (0 == decimal_32_counter % SLOW_TICKS && ! button_sample
+	    && ticks_idle()) {
+		start_slow_ticks();
+	}
+#endif
+	QK_ISR_EXIT();
+}
+
+#endif
+
 SIGNAL(INT0_vect        ) { Q_ASSERT(0); }
 SIGNAL(INT1_vect        ) { Q_ASSERT(0); }
 SIGNAL(INT2_vect        ) { Q_ASSERT(0); }
@@ -363,7 +1459,9 @@ SIGNAL(TIMER2_COMPA_vect) { Q_ASSERT(0); }
 SIGNAL(TIMER2_COMPB_vect) { Q_ASSERT(0); }
 SIGNAL(TIMER2_OVF_vect  ) { Q_ASSERT(0); }
 SIGNAL(TIMER1_CAPT_vect ) { Q_ASSERT(0); }
-//SIGNAL(TIMER1_COMPA_vect) { Q_ASSERT(0); }
+#ifdef RTC_32KHZ_TIMEBASE
+SIGNAL(TIMER1_COMPA_vect) { Q_ASSERT(0); }
+#endif
 SIGNAL(TIMER1_COMPB_vect) { Q_ASSERT(0); }
 SIGNAL(TIMER1_COMPC_vect) { Q_ASSERT(0); }
 SIGNAL(TIMER1_OVF_vect  ) { Q_ASSERT(0); }
@@ -371,14 +1469,16 @@ SIGNAL(TIMER0_COMPA_vect) { Q_ASSERT(0); }
 SIGNAL(TIMER0_COMPB_vect) { Q_ASSERT(0); }
 SIGNAL(TIMER0_OVF_vect  ) { Q_ASSERT(0); }
 SIGNAL(SPI_STC_vect     ) { Q_ASSERT(0); }
-SIGNAL(USART1_RX_vect   ) { Q_ASSERT(0); }
+//SIGNAL(USART1_RX_vect   ) { Q_ASSERT(0); }
 //SIGNAL(USART1_UDRE_vect ) { Q_ASSERT(0); }
 SIGNAL(USART1_TX_vect   ) { Q_ASSERT(0); }
 SIGNAL(ANALOG_COMP_vect ) { Q_ASSERT(0); }
 SIGNAL(ADC_vect         ) { Q_ASSERT(0); }
 SIGNAL(EE_READY_vect    ) { Q_ASSERT(0); }
 SIGNAL(TIMER3_CAPT_vect ) { Q_ASSERT(0); }
+#if ! defined(RTC_32KHZ_TIMEBASE) && ! defined(TIME_SYNC) && ! defined(SLOW_TICKS)
 SIGNAL(TIMER3_COMPA_vect) { Q_ASSERT(0); }
+#endif
 SIGNAL(TIMER3_COMPB_vect) { Q_ASSERT(0); }
 SIGNAL(TIMER3_COMPC_vect) { Q_ASSERT(0); }
 SIGNAL(TIMER3_OVF_vect  ) { Q_ASSERT(0); }
@@ -404,6 +1504,11 @@ buttons_init(void)
 		(0b110 << ADPS0); /* 16MHZ/64 = 250kHz ADC clock, for speed */
 	ADCSRB = (0 << ACME) |
 		(0b000 << ADTS0);
+#ifdef LOW_POWER
+	/* Start the first conversion, so there's a button reading ready at
+	   the first decimal tick. */
+	ADCSRA |= (1 << ADSC);
+#endif
 }
 
 
@@ -426,6 +1531,29 @@ buttons_init(void)
 #define DOWN_MAX   (12  + HYSTERESIS)
 
 
+#ifdef LOW_POWER
+
+static uint8_t
+decode_button(uint8_t adc_value)
+{
+	if (adc_value >= SELECT_MIN && adc_value <= SELECT_MAX)
+		return 1;
+	if (adc_value >= UP_MIN && adc_value <= UP_MAX)
+		return 2;
+	if (adc_value >= DOWN_MIN && adc_value <= DOWN_MAX)
+		return 3;
+	return 0;
+}
+
+
+uint8_t
+BSP_getButton(void)
+{
+	return button_sample;
+}
+
+#else
+
 uint8_t
 BSP_getButton(void)
 {
@@ -445,6 +1573,8 @@ BSP_getButton(void)
 	return 0;
 }
 
+#endif
+
 
 /**
  * Generate a PWM signal for LCD brightness.
@@ -54,8 +54,44 @@ void BSP_enable_rtc_interrupt(void);
 
 void BSP_watchdog(void);
 
+#ifdef POWER_STATS
+void BSP_get_power_stats(uint16_t *wakeups, uint32_t *active);
+#endif
+
+#ifdef TICK_LATENCY
+uint16_t BSP_tick_latency(void);
+#ifndef RTC_32KHZ_TIMEBASE
+void BSP_get_tick_isr_cycles(uint16_t *max, uint16_t *mean);
+#endif
+#endif
+
+uint16_t BSP_stack_unused(void);
+
+#ifdef BOOT_TRACE
+uint16_t BSP_boot_ms(void);
+#endif
+
+#ifdef STATE_TRACE
+uint16_t BSP_trace_stamp(void);
+#endif
+
+#ifdef TIME_SYNC
+uint32_t BSP_sync_stamp(void);
+uint32_t BSP_sync_second_stamp(void);
+void BSP_slew(int32_t counts);
+uint8_t BSP_slewing(void);
+uint8_t BSP_normal_from_timer(uint8_t decimal125);
+void BSP_normal_from_rtc(void);
+#endif
+
+/* The parameter of TICK_NORMAL_SIGNAL says where the normal second came from,
+   so timekeeper can drop any that were queued before it changed source. */
+#define BSP_NORMAL_FROM_RTC 0
+#define BSP_NORMAL_FROM_TIMER 1
+
 
 void BSP_set_decimal_32_counter(uint8_t dc);
+void BSP_align_decimal_32_counter(void);
 
 void BSP_reset(void);
 
@@ -92,6 +92,20 @@ buttons_ctor(void)
 }
 
 
+/**
+ * Returns true if no button is down and we're not waiting for the rest of the
+ * secret sequence.  In that case we don't need the decimal ticks until a
+ * button is pressed.
+ *
+ * This is called from the timer interrupt.
+ */
+uint8_t
+buttons_idle(void)
+{
+	return (0 == buttons.whichButton) && (0 == secretTimeout);
+}
+
+
 static QState buttonsInitial(struct Buttons *me)
 {
 	return Q_TRAN(&buttonsState);
@@ -101,6 +115,7 @@ static QState buttonsInitial(struct Buttons *me)
 static QState buttonsState(struct Buttons *me)
 {
 	uint8_t button;
+	uint8_t ticks;
 
 	switch (Q_SIG(me)) {
 	case Q_ENTRY_SIG:
@@ -110,8 +125,12 @@ static QState buttonsState(struct Buttons *me)
 		return Q_HANDLED();
 	case TICK_DECIMAL_32_SIGNAL:
 		if (secretTimeout) {
-			secretTimeout --;
-			if (0 == secretTimeout) {
+			/* Count the ticks we missed if they were coalesced. */
+			ticks = 1 + QF_LATEST_SKIPPED(Q_PAR(me));
+			if (secretTimeout > ticks) {
+				secretTimeout -= ticks;
+			} else {
+				secretTimeout = 0;
 				secretIndex = 0;
 			}
 		}
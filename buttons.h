@@ -34,6 +34,7 @@ extern struct Buttons buttons;
 
 
 void buttons_ctor(void);
+uint8_t buttons_idle(void);
 
 
 #endif
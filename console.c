@@ -0,0 +1,528 @@
+/**
+ * @file
+ *
+ * A command console on the serial port, so the clock can be set up and
+ * checked by a script instead of with the buttons.
+ *
+ * Each command is one line.  Every command gets exactly one line back, which
+ * starts with "= " for an answer or "? " for an error, so the answers can be
+ * picked out of the debug output.  Commands that change something answer
+ * "= ok" once the change has been passed on.
+ *
+ *	time			= time 12:34:56 05.24.30 N
+ *	time 12:34:56		Set the normal time.
+ *	time 5.24.30		Set the decimal time.
+ *	day [0-6]		Get or set the day of the week, 0 for Sunday.
+ *	alarm [n]		= alarm 0 07:00:00 02.91.66 on days 62 snoozes 4
+ *	alarm [n] [time] [on|off] [days 0-127] [snoozes 0-9]
+ *				Change any of the settings of alarm n (default
+ *				0).  The time is HH:MM or H.MM.
+ *	bright [0-4]		Get or set the LCD brightness.
+ *	mode [normal|decimal|toggle]
+ *				Get or set the time mode.
+ *	stats			= stats stack 1234 txlost 0 rxlost 0 rxerr 0
+ *				With QEP_TRAN_CACHE, also " tranhit 12 tranmiss 3",
+ *				the transitions QHsm_dispatch() found in its
+ *				cache and those it had to work out.
+ *
+ * The console is the lowest priority active object, so when it runs the other
+ * objects' queues are empty and it can post to them.  It only runs one
+ * command each time it is dispatched, so a script sending commands quickly
+ * can't fill those queues.
+ */
+
+#include "console.h"
+#include "dclock.h"
+#include "alarm.h"
+#include "bsp.h"
+#include "lcd.h"
+#include "serial.h"
+#include "settings.h"
+#include "time.h"
+#include "timekeeper.h"
+#include <string.h>
+
+
+Q_DEFINE_THIS_FILE;
+
+
+struct Console console;
+
+
+/** The most words in a command line. */
+#define CONSOLE_MAX_WORDS 9
+
+
+static QState consoleInitial (struct Console *me);
+static QState consoleState   (struct Console *me);
+
+static uint8_t read_line(struct Console *me);
+static void run_command(struct Console *me);
+
+
+void console_ctor(void)
+{
+	QActive_ctor((QActive*)(&console), (QStateHandler)(&consoleInitial));
+	console.len = 0;
+	console.overflow = 0;
+	console.ready = 0;
+}
+
+
+static QState consoleInitial(struct Console *me)
+{
+	me->ready = 73;
+	return Q_TRAN(consoleState);
+}
+
+
+static QState consoleState(struct Console *me)
+{
+	switch (Q_SIG(me)) {
+	case CONSOLE_RX_SIGNAL:
+		if (read_line(me)) {
+			run_command(me);
+			/* There may be more commands waiting.  Let the other
+			   objects handle what this one sent them first. */
+			post_latest(me, CONSOLE_RX_SIGNAL, 0);
+		}
+		return Q_HANDLED();
+	}
+	return Q_SUPER(&QHsm_top);
+}
+
+
+/**
+ * Add the received bytes to the line, until the end of a line.
+ *
+ * @return true if there is a whole line in me->line.
+ */
+static uint8_t read_line(struct Console *me)
+{
+	char c;
+
+	while (serial_recv_char(&c)) {
+		if ('\r' == c || '\n' == c) {
+			if (me->overflow) {
+				me->overflow = 0;
+				me->len = 0;
+				SERIALSTR("? too long\r\n");
+				continue;
+			}
+			if (0 == me->len) {
+				/* Blank line, or the second half of CR LF. */
+				continue;
+			}
+			me->line[me->len] = '\0';
+			me->len = 0;
+			return 73;
+		}
+		if (me->len < CONSOLE_LINE_LEN) {
+			me->line[me->len++] = c;
+		} else {
+			me->overflow = 73;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * Split a line into words, in place.
+ *
+ * @return the number of words, or CONSOLE_MAX_WORDS + 1 if there are too
+ * many.
+ */
+static uint8_t split_words(char *line, char **words)
+{
+	uint8_t nwords = 0;
+
+	while (1) {
+		while (' ' == *line || '\t' == *line) {
+			*line++ = '\0';
+		}
+		if (! *line) {
+			return nwords;
+		}
+		if (nwords == CONSOLE_MAX_WORDS) {
+			return nwords + 1;
+		}
+		words[nwords++] = line;
+		while (*line && ' ' != *line && '\t' != *line) {
+			line++;
+		}
+	}
+}
+
+
+/**
+ * Read an unsigned number.
+ *
+ * @return true if the whole word is a number no bigger than max.
+ */
+static uint8_t parse_number(const char *s, uint8_t max, uint8_t *n)
+{
+	uint16_t value = 0;
+
+	if (! *s) {
+		return 0;
+	}
+	while (*s) {
+		if (*s < '0' || *s > '9') {
+			return 0;
+		}
+		value = value * 10 + (*s - '0');
+		if (value > max) {
+			return 0;
+		}
+		s++;
+	}
+	*n = value;
+	return 73;
+}
+
+
+/**
+ * Read a time, HH:MM[:SS] for normal time or H.MM[.SS] for decimal time.
+ *
+ * @param times set to the hours, minutes and seconds.  The seconds are zero
+ * if they're not given.
+ * @return NORMAL_MODE or DECIMAL_MODE depending on the separator, or 0 if
+ * the word isn't a valid time.
+ */
+static uint8_t parse_time(const char *s, uint8_t *times)
+{
+	char sep = 0;
+	uint8_t part = 0;
+	uint8_t digits = 0;
+
+	times[0] = times[1] = times[2] = 0;
+	for ( ; *s; s++) {
+		if (*s >= '0' && *s <= '9') {
+			if (++digits > 2) {
+				return 0;
+			}
+			times[part] = times[part] * 10 + (*s - '0');
+		} else if ((':' == *s || '.' == *s) && digits && part < 2
+			   && (! sep || sep == *s)) {
+			sep = *s;
+			part++;
+			digits = 0;
+		} else {
+			return 0;
+		}
+	}
+	if (! sep || ! digits) {
+		return 0;
+	}
+	if (':' == sep) {
+		if (times[0] > 23 || times[1] > 59 || times[2] > 59) {
+			return 0;
+		}
+		return NORMAL_MODE;
+	} else {
+		if (times[0] > 9) {
+			return 0;
+		}
+		return DECIMAL_MODE;
+	}
+}
+
+
+static void reply_ok(void)
+{
+	SERIALSTR("= ok\r\n");
+}
+
+
+static void reply_error(void)
+{
+	SERIALSTR("? bad arguments\r\n");
+}
+
+
+static void send_mode(uint8_t mode)
+{
+	serial_send_char(' ');
+	serial_send_char(mode);
+}
+
+
+static void time_command(uint8_t nwords, char **words)
+{
+	uint8_t times[3];
+	struct NormalTime nt;
+
+	if (1 == nwords) {
+		SERIALSTR("= time ");
+		print_normal_time(get_normal_time());
+		serial_send_char(' ');
+		print_decimal_time(get_decimal_time());
+		send_mode(get_time_mode());
+		SERIALSTR("\r\n");
+		return;
+	}
+	if (2 != nwords) {
+		reply_error();
+		return;
+	}
+	switch (parse_time(words[1], times)) {
+	case NORMAL_MODE:
+		nt.h = times[0];
+		nt.m = times[1];
+		nt.s = times[2];
+		nt.pad = 0;
+		set_normal_time(nt);
+		break;
+	case DECIMAL_MODE:
+		set_decimal_time(dtimes_to_decimal(times));
+		break;
+	default:
+		reply_error();
+		return;
+	}
+	reply_ok();
+}
+
+
+static void day_command(uint8_t nwords, char **words)
+{
+	uint8_t day;
+
+	if (1 == nwords) {
+		SERIALSTR("= day ");
+		serial_send_int(get_day_of_week());
+		SERIALSTR("\r\n");
+	} else if (2 == nwords && parse_number(words[1], 6, &day)) {
+		set_day_of_week(day);
+		reply_ok();
+	} else {
+		reply_error();
+	}
+}
+
+
+static void send_alarm(uint8_t n)
+{
+	struct AlarmSetting *s = &(alarm.settings[n]);
+
+	SERIALSTR("= alarm ");
+	serial_send_int(n);
+	serial_send_char(' ');
+	print_normal_time(s->normalTime);
+	serial_send_char(' ');
+	print_decimal_time(s->decimalTime);
+	if (s->on) {
+		SERIALSTR(" on days ");
+	} else {
+		SERIALSTR(" off days ");
+	}
+	serial_send_int(s->days);
+	SERIALSTR(" snoozes ");
+	serial_send_int(s->maxSnooze);
+	SERIALSTR("\r\n");
+}
+
+
+static void alarm_command(uint8_t nwords, char **words)
+{
+	uint8_t n = 0;
+	uint8_t i = 1;
+	uint8_t times[3];
+	uint8_t timeMode = 0;
+	uint8_t on;
+	uint8_t days;
+	uint8_t snoozes;
+	uint8_t options = 0;
+	uint32_t dat;
+	struct NormalTime nat;
+
+	if (i < nwords && parse_number(words[i], 9, &n)) {
+		if (n >= NALARMS) {
+			reply_error();
+			return;
+		}
+		i++;
+	}
+	if (i == nwords) {
+		send_alarm(n);
+		return;
+	}
+
+	on = get_alarm_on(&alarm, n);
+	days = get_alarm_days(&alarm, n);
+	snoozes = get_alarm_max_snooze(&alarm, n);
+	for ( ; i < nwords; i++) {
+		if (! strcmp_P(words[i], PSTR("on"))) {
+			on = 73;
+		} else if (! strcmp_P(words[i], PSTR("off"))) {
+			on = 0;
+		} else if (! strcmp_P(words[i], PSTR("days")) && i+1 < nwords
+			   && parse_number(words[i+1], 0x7f, &days)) {
+			options = 73;
+			i++;
+		} else if (! strcmp_P(words[i], PSTR("snoozes")) && i+1 < nwords
+			   && parse_number(words[i+1], 9, &snoozes)) {
+			options = 73;
+			i++;
+		} else if (! timeMode
+			   && (timeMode = parse_time(words[i], times))
+			   && 0 == times[2]) {
+			/* Alarms are only set to the minute. */
+		} else {
+			reply_error();
+			return;
+		}
+	}
+
+	switch (timeMode) {
+	case NORMAL_MODE:
+		nat.h = times[0];
+		nat.m = times[1];
+		nat.s = 0;
+		nat.pad = 0;
+		dat = normal_to_decimal(nat);
+		break;
+	case DECIMAL_MODE:
+		dat = dtimes_to_decimal(times);
+		nat = decimal_to_normal(dat);
+		break;
+	default:
+		dat = alarm.settings[n].decimalTime;
+		nat = alarm.settings[n].normalTime;
+		break;
+	}
+	if (options) {
+		set_alarm_options(&alarm, n, days, snoozes);
+	}
+	set_alarm_time_on(&alarm, n, dat, nat, on);
+	/* The alarm works out which alarm is next, and tells timekeeper to
+	   write that one to the RTC. */
+	post((&alarm), ALARM_ON_SIGNAL, 0);
+	reply_ok();
+}
+
+
+static void bright_command(uint8_t nwords, char **words)
+{
+	uint8_t b;
+
+	if (1 == nwords) {
+		SERIALSTR("= bright ");
+		serial_send_int(lcd_get_brightness());
+		SERIALSTR("\r\n");
+	} else if (2 == nwords && parse_number(words[1], 4, &b)) {
+		lcd_set_brightness(b);
+		settings_set(SETTING_BRIGHTNESS, b);
+		reply_ok();
+	} else {
+		reply_error();
+	}
+}
+
+
+static void mode_command(uint8_t nwords, char **words)
+{
+	if (1 == nwords) {
+		SERIALSTR("= mode");
+		send_mode(get_time_mode());
+		SERIALSTR("\r\n");
+		return;
+	}
+	if (2 != nwords) {
+		reply_error();
+		return;
+	}
+	if (! strcmp_P(words[1], PSTR("normal"))) {
+		set_time_mode(NORMAL_MODE);
+	} else if (! strcmp_P(words[1], PSTR("decimal"))) {
+		set_time_mode(DECIMAL_MODE);
+	} else if (! strcmp_P(words[1], PSTR("toggle"))) {
+		toggle_time_mode();
+	} else {
+		reply_error();
+		return;
+	}
+	reply_ok();
+}
+
+
+static void stats_command(uint8_t nwords, char **words)
+{
+	uint16_t txlost;
+	uint16_t rxlost;
+	uint16_t rxerrors;
+#ifdef QEP_TRAN_CACHE
+	uint16_t tranhits;
+	uint16_t tranmisses;
+#endif
+
+	if (1 != nwords) {
+		reply_error();
+		return;
+	}
+	serial_get_stats(&txlost, &rxlost, &rxerrors);
+	SERIALSTR("= stats stack ");
+	serial_send_int(BSP_stack_unused());
+	SERIALSTR(" txlost ");
+	serial_send_int(txlost);
+	SERIALSTR(" rxlost ");
+	serial_send_int(rxlost);
+	SERIALSTR(" rxerr ");
+	serial_send_int(rxerrors);
+#ifdef QEP_TRAN_CACHE
+	QHsm_getTranCacheStats(&tranhits, &tranmisses);
+	SERIALSTR(" tranhit ");
+	serial_send_int(tranhits);
+	SERIALSTR(" tranmiss ");
+	serial_send_int(tranmisses);
+#endif
+	SERIALSTR("\r\n");
+}
+
+
+/**
+ * Run the command in me->line.
+ *
+ * With QK_PREEMPTIVE, nothing else may run while a command changes the
+ * other objects' settings, just as for timesetter.
+ */
+static void run_command(struct Console *me)
+{
+	char *words[CONSOLE_MAX_WORDS];
+	uint8_t nwords;
+#ifdef QK_PREEMPTIVE
+	QMutex mutex;
+#endif
+
+	nwords = split_words(me->line, words);
+	if (0 == nwords) {
+		return;
+	}
+	if (nwords > CONSOLE_MAX_WORDS) {
+		reply_error();
+		return;
+	}
+
+#ifdef QK_PREEMPTIVE
+	mutex = QK_mutexLock(QF_MAX_ACTIVE);
+#endif
+	if (! strcmp_P(words[0], PSTR("time"))) {
+		time_command(nwords, words);
+	} else if (! strcmp_P(words[0], PSTR("day"))) {
+		day_command(nwords, words);
+	} else if (! strcmp_P(words[0], PSTR("alarm"))) {
+		alarm_command(nwords, words);
+	} else if (! strcmp_P(words[0], PSTR("bright"))) {
+		bright_command(nwords, words);
+	} else if (! strcmp_P(words[0], PSTR("mode"))) {
+		mode_command(nwords, words);
+	} else if (! strcmp_P(words[0], PSTR("stats"))) {
+		stats_command(nwords, words);
+	} else {
+		SERIALSTR("? unknown command\r\n");
+	}
+#ifdef QK_PREEMPTIVE
+	QK_mutexUnlock(mutex);
+#endif
+}
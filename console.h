@@ -0,0 +1,34 @@
+#ifndef console_h_INCLUDED
+#define console_h_INCLUDED
+
+#include "qpn_port.h"
+
+/**
+ * The longest command line, not counting the line ending.
+ */
+#define CONSOLE_LINE_LEN 40
+
+
+/**
+ * Reads commands from the serial port, and answers them.
+ */
+struct Console {
+	QActive super;
+	/** The line read so far. */
+	char line[CONSOLE_LINE_LEN + 1];
+	/** The number of characters in line[]. */
+	uint8_t len;
+	/** True if the line got too long.  The rest of it is ignored. */
+	uint8_t overflow;
+	/** Set true when we are able to receive signals. */
+	uint8_t ready;
+};
+
+
+extern struct Console console;
+
+
+void console_ctor(void);
+
+
+#endif
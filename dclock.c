@@ -3,18 +3,20 @@
  */
 
 #include "alarm.h"
+#include "boot-trace.h"
 #include "bsp.h"
 #include "buttons.h"
+#include "console.h"
 #include "dclock.h"
 #include "lcd.h"
 #include "serial.h"
+#include "settings.h"
 #include "timedisplay.h"
 #include "timekeeper.h"
 #include "timesetter.h"
 #include "toggle-pin.h"
 #include "twi.h"
 #include "version.h"
-#include <string.h>
 
 
 Q_DEFINE_THIS_FILE;
@@ -26,6 +28,7 @@ static QEvent alarmQueue[4];
 static QEvent timekeeperQueue[4];
 static QEvent timesetterQueue[4];
 static QEvent timedisplayQueue[4];
+static QEvent consoleQueue[2];
 
 /* The order of these objects is important, firstly because it determines
    priority, but also because it determines the order in which they are
@@ -46,12 +49,32 @@ static QEvent timedisplayQueue[4];
    processed before timekeeper's.
 
    Yes, this is weird and fragile, and should be fixed.
+
+   console is at the bottom, so a script typing at it can't hold up anything
+   else, and everything it posts to has an empty queue when it runs.
+
+   With QK_PREEMPTIVE, a higher priority AO runs as soon as it has an event,
+   even if a lower priority one is halfway through handling something.  So
+   twi and timekeeper go above timedisplay and buttons, and a slow display
+   update can't hold up the ticks or the RTC.  twi is still initialised
+   before timekeeper, and alarm is still above timekeeper.  timesetter stays
+   at the top, because it calls straight into alarm and timekeeper to change
+   their settings, and they mustn't preempt it while it does that.  The
+   objects that share the LCD lock each other out with a QK mutex - see
+   lcd.c.
  */
 QActiveCB const Q_ROM Q_ROM_VAR QF_active[] = {
 	{ (QActive *)0              , (QEvent *)0      , 0                        },
+	{ (QActive *)(&console)     , consoleQueue     , Q_DIM(consoleQueue)      },
+#ifdef QK_PREEMPTIVE
+	{ (QActive *)(&timedisplay) , timedisplayQueue , Q_DIM(timedisplayQueue)  },
+	{ (QActive *)(&buttons)     , buttonsQueue     , Q_DIM(buttonsQueue)      },
+	{ (QActive *)(&twi)         , twiQueue         , Q_DIM(twiQueue)          },
+#else
 	{ (QActive *)(&twi)         , twiQueue         , Q_DIM(twiQueue)          },
 	{ (QActive *)(&timedisplay) , timedisplayQueue , Q_DIM(timedisplayQueue)  },
 	{ (QActive *)(&buttons)     , buttonsQueue     , Q_DIM(buttonsQueue)      },
+#endif
 	{ (QActive *)(&timekeeper)  , timekeeperQueue  , Q_DIM(timekeeperQueue)   },
 	{ (QActive *)(&alarm)       , alarmQueue       , Q_DIM(alarmQueue)        },
 	{ (QActive *)(&timesetter)  , timesetterQueue  , Q_DIM(timesetterQueue)   },
@@ -65,7 +88,7 @@ Q_ASSERT_COMPILE(QF_MAX_ACTIVE == Q_DIM(QF_active) - 1);
 int main(int argc, char **argv)
 {
 	uint8_t mcusr;
-	char startupmsg[17];
+	uint8_t warm;
 
  startmain:
 	cli();
@@ -82,21 +105,31 @@ int main(int argc, char **argv)
 	if (mcusr & (1 << EXTRF)) SERIALSTR(" EXT");
 	if (mcusr & (1 << PORF)) SERIALSTR(" PO");
 	SERIALSTR("\r\n");
+	settings_init();
 	twi_ctor();
 	timekeeper_ctor();
-	lcd_init();
-	// Show the startup reason on the LCD.
-	strcpy(startupmsg, "Startup: ----");
-	if (mcusr & (1<<3)) startupmsg[9] = 'W';
-	if (mcusr & (1<<2)) startupmsg[10] = 'B';
-	if (mcusr & (1<<1)) startupmsg[11] = 'X';
-	if (mcusr & (1<<0)) startupmsg[12] = 'P';
-	lcd_line1(startupmsg);
-	_delay_ms(500);
+	/* If only the watchdog reset us, the RAM has kept its contents, so we
+	   can carry on with the time we had and skip the slow parts of the
+	   startup.  The time is checked against the RTC later. */
+	warm = 0;
+	if ((mcusr & ((1 << WDRF) | (1 << BORF) | (1 << PORF))) == (1 << WDRF)) {
+		warm = timekeeper_warm_start();
+	}
+	if (warm) {
+		SERIALSTR("*** Warm start\r\n");
+		lcd_warm_init();
+	} else {
+		/* This doesn't wait for the LCD.  Timedisplay finishes
+		   starting it, and shows the startup reason, while timekeeper
+		   reads the RTC. */
+		lcd_init();
+	}
 	buttons_ctor();
 	alarm_ctor();
-	timedisplay_ctor();
+	timedisplay_ctor(mcusr);
 	timesetter_ctor();
+	console_ctor();
+	BOOT_TRACE_MARK("objects made");
 
 	/* Drain the serial output just before the watchdog timer is
 	   reenabled. */
@@ -124,8 +157,10 @@ void QF_onStartup(void)
 	Q_ASSERT(alarm.ready);
 	Q_ASSERT(timedisplay.ready);
 	Q_ASSERT(timesetter.ready);
+	Q_ASSERT(console.ready);
 
 	serial_drain();
 
+	BOOT_TRACE_MARK("QF started");
 	BSP_QF_onStartup();
 }
@@ -86,14 +86,37 @@ enum DClockSignals {
 	UPDATE_MINUTES_TIMEOUT_SIGNAL,
 	UPDATE_SECONDS_TIMEOUT_SIGNAL,
 	UPDATE_ALARM_TIMEOUT_SIGNAL,
+	UPDATE_ALARM_NUMBER_TIMEOUT_SIGNAL,
+	UPDATE_DAYS_TIMEOUT_SIGNAL,
+	UPDATE_SNOOZES_TIMEOUT_SIGNAL,
 
 	/**
 	 * The time has been changed, so set it and write to the RTC.
 	 */
 	SET_DECIMAL_TIME_SIGNAL,
 	SET_NORMAL_TIME_SIGNAL,
+	/**
+	 * The day of the week has been changed, so write it to the RTC and
+	 * tell the alarm.
+	 */
+	SET_DAY_SIGNAL,
 
 	SET_NORMAL_ALARM_SIGNAL,
+	/**
+	 * Sent by the alarm to timekeeper when snoozing, so the RTC alarm can
+	 * be set to the snooze time.
+	 */
+	SET_SNOOZE_ALARM_SIGNAL,
+	/**
+	 * The RTC alarm interrupt has fired.  Sent to timekeeper by the
+	 * interrupt handler, and from there to the alarm.
+	 */
+	RTC_ALARM_SIGNAL,
+	/**
+	 * Sent by timekeeper to itself when the host stops keeping it in step,
+	 * so it goes back to the RTC's time.
+	 */
+	READ_RTC_SIGNAL,
 
 	TWI_REQUEST_SIGNAL,
 	TWI_REPLY_SIGNAL,
@@ -103,6 +126,13 @@ enum DClockSignals {
 
 	ALARM_ON_SIGNAL,
 	ALARM_OFF_SIGNAL,
+	/**
+	 * Sent by timekeeper to the alarm when the time has been set or the
+	 * decimal time has been resynchronised, so the alarm can count down
+	 * from the new time.  The parameter is true if this also counts as a
+	 * tick.
+	 */
+	ALARM_RESYNC_SIGNAL,
 
 	/**
 	 * The alarm has started running.
@@ -131,6 +161,18 @@ enum DClockSignals {
 	 */
 	ALARM_SOUND_OFF_SIGNAL,
 
+	/**
+	 * Sent to the console by the serial receive interrupt when there are
+	 * bytes to read.
+	 */
+	CONSOLE_RX_SIGNAL,
+
+	/**
+	 * Sent by the serial transmit interrupt when everything that was
+	 * queued has been sent.  See serial_flush().
+	 */
+	SERIAL_FLUSHED_SIGNAL,
+
 	MAX_PUB_SIG,
 	MAX_SIG,
 };
@@ -187,4 +229,44 @@ enum DClockSignals {
 			postISR(o, sig, par);	\
 	} while (0)
 
+/**
+ * Post a periodic event, replacing the same signal if it's still in the
+ * queue.
+ *
+ * Use this for ticks, where a slow receiver only needs the latest value and
+ * a count of the ticks it missed.  The count is in the top byte of the
+ * parameter (QF_LATEST_SKIPPED()), so the value must fit in the lower three
+ * bytes.
+ *
+ * @see QActive_postLatest()
+ */
+#define post_latest(o, sig, par)					\
+	QActive_postLatest((QActive *)(o), sig, (QParam)(par))
+
+/**
+ * @see post_latest()
+ */
+#define postISR_latest(o, sig, par)					\
+	QActive_postLatestISR((QActive *)(o), sig, (QParam)(par))
+
+/**
+ * @see post_latest()
+ * @see post_r()
+ */
+#define post_latest_r(o, sig, par)			\
+	do {						\
+		if (o->ready)				\
+			post_latest(o, sig, par);	\
+	} while (0)
+
+/**
+ * @see post_latest()
+ * @see post_r()
+ */
+#define postISR_latest_r(o, sig, par)			\
+	do {						\
+		if (o->ready)				\
+			postISR_latest(o, sig, par);	\
+	} while (0)
+
 #endif
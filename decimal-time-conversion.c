@@ -3,30 +3,80 @@
 #include <string.h>
 #include <stdint.h>
 #include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "time-conversion.h"
+#include "time-conversion-bulk.h"
+#include "decimal-time-shm.h"
 
 static char *myname;
 
 static void usage(int retcode)
 {
 	fprintf(stderr, "Usage: %s [time]\n"
+		"       %s -b [-s] [file]\n"
+		"       %s -m [-i] [-j threads] [-s] file\n"
+		"       %s -f [-t] [-n count] [-r] [-s]\n"
+		"       %s -p [-r] [-s]\n"
+		"       %s -P\n"
+		"       %s -B\n"
 		"  Time can be in decimal (xx.xx.xx) or normal (xx:xx:xx)\n"
 		"  Prints the time in the opposite system\n"
-		"  With no time, convert the current time to decimal.\n",
-		myname);
+		"  With no time, convert the current time to decimal.\n"
+		"  -b  Convert one time on each line of the file, or stdin.\n"
+		"      A line can be normal (HH:MM:SS), decimal (H.MM.SS), or\n"
+		"      seconds since the epoch, which are converted to the\n"
+		"      local decimal time.  Bad lines are printed as \"?\".\n"
+		"  -m  Copy the file to stdout with every HH:MM:SS changed to\n"
+		"      decimal, using a thread for each CPU.\n"
+		"  -i  With -m, change the file itself instead.\n"
+		"  -j  With -m, use this many threads.\n"
+		"  -f  Print the decimal time at the start of each decimal\n"
+		"      second, until interrupted.\n"
+		"  -t  With -f, print it every 1/32 of a decimal second,\n"
+		"      with the 1/32s after a slash.\n"
+		"  -n  With -f, stop after this many.\n"
+		"  -p  Keep the time in shared memory, every 1/32 of a decimal\n"
+		"      second, until interrupted.  See decimal-time-shm.h.\n"
+		"  -P  Time reading the shared memory, calling localtime(), and\n"
+		"      running this program, while -p is running.\n"
+		"  -r  With -f or -p, run with real time priority if allowed.\n"
+		"  -s  With -b or -m, print the throughput on stderr.  With -f\n"
+		"      or -p, print how late the wake ups were.\n"
+		"  -B  Check each way of converting arrays of times against the\n"
+		"      exact conversion, for every time of day, and print the\n"
+		"      number of conversions per second for each.\n",
+		myname, myname, myname, myname, myname, myname, myname);
 	exit(retcode);
 }
 
 
+/**
+ * Convert a normal time to decimal seconds since midnight, exactly as the
+ * clock does.
+ */
+static uint32_t normalToDecimalSeconds(uint8_t h, uint8_t m, uint8_t s)
+{
+	return normal_seconds_to_decimal(h * 3600L + m * 60L + s);
+}
+
+
 static void printNormalToDecimal(uint8_t h, uint8_t m, uint8_t s)
 {
-	uint32_t seconds;
 	uint32_t dSeconds;
 	uint8_t dh;
 	uint8_t dm;
 	uint8_t ds;
 
-	seconds = h * 3600 + m * 60 + s;
-	dSeconds = (uint32_t) (((float)seconds) * 125.0f / 108.0f);
+	dSeconds = normalToDecimalSeconds(h, m, s);
 	ds = dSeconds % 100;
 	dSeconds /= 100;
 	dm = dSeconds % 100;
@@ -111,7 +161,7 @@ static void decimalToNormal(const char *sn)
 			myname, dSeconds);
 		exit(5);
 	}
-	seconds = (uint32_t) (((float)dSeconds) * 108.0f / 125.0f);
+	seconds = decimal_seconds_to_normal(dSeconds);
 	if (seconds >= 86400) {
 		fprintf(stderr, "%s: real seconds > 86400 (%u) How?\n",
 			myname, seconds);
@@ -126,9 +176,998 @@ static void decimalToNormal(const char *sn)
 }
 
 
+/* Batch conversion.  The input is read and the output written in big blocks,
+   and the lines are parsed and formatted by hand, since stdio's line at a
+   time functions and printf() are much slower than the conversion itself. */
+
+#define BATCH_BUFSIZE 65536
+
+/** Longer lines than this can't be valid. */
+#define BATCH_MAXLINE 32
+
+static int batchIn;
+static char batchInBuf[BATCH_BUFSIZE];
+static char batchOutBuf[BATCH_BUFSIZE];
+static size_t batchOutLen;
+static unsigned long batchLines;
+static unsigned long batchErrors;
+
+
+static void batchFlush(void)
+{
+	if (batchOutLen && fwrite(batchOutBuf, 1, batchOutLen, stdout)
+	    != batchOutLen) {
+		perror(myname);
+		exit(6);
+	}
+	batchOutLen = 0;
+}
+
+
+/**
+ * Add two digits and a separator to the output.
+ */
+static inline char *putTwo(char *p, unsigned v, char sep)
+{
+	p[0] = '0' + v / 10;
+	p[1] = '0' + v % 10;
+	p[2] = sep;
+	return p + 3;
+}
+
+
+/**
+ * Get a two digit number from s.
+ *
+ * @return the number, or -1 if those aren't two digits.
+ */
+static inline int getTwo(const char *s)
+{
+	unsigned a = (unsigned char)s[0] - '0';
+	unsigned b = (unsigned char)s[1] - '0';
+
+	if (a > 9 || b > 9)
+		return -1;
+	return 10 * a + b;
+}
+
+
+/**
+ * Convert one line, without its newline, and add the result to the output.
+ *
+ * @return 0 for success, or -1 if the line is not a valid time.
+ */
+static int batchLine(const char *s, size_t len, char *out)
+{
+	int h, m, sec;
+	char sep;
+	uint32_t seconds;
+	uint32_t dSeconds;
+	uint64_t epoch;
+	time_t timet;
+	struct tm tm;
+	size_t i;
+
+	if (len && s[len-1] == '\r')
+		len--;
+	if (len == 7 || len == 8) {
+		sep = s[len-3];
+		if ((sep != ':' && sep != '.') || s[len-6] != sep)
+			goto epoch;
+		if (len == 7) {
+			h = (unsigned char)s[0] - '0';
+			if (h < 0 || h > 9)
+				return -1;
+		} else {
+			h = getTwo(s);
+		}
+		m = getTwo(s + len - 5);
+		sec = getTwo(s + len - 2);
+		if (h < 0 || m < 0 || sec < 0)
+			return -1;
+		if (sep == ':') {
+			if (h >= 24 || m >= 60 || sec >= 60)
+				return -1;
+			dSeconds = normalToDecimalSeconds(h, m, sec);
+			out = putTwo(out, dSeconds / 10000, '.');
+			out = putTwo(out, dSeconds / 100 % 100, '.');
+			putTwo(out, dSeconds % 100, '\n');
+		} else {
+			/* 10.00.00 is midnight, as in decimalToNormal(). */
+			if (h > 10)
+				return -1;
+			if (h == 10)
+				h = 0;
+			seconds = decimal_seconds_to_normal(h * 10000L
+							    + m * 100L + sec);
+			out = putTwo(out, seconds / 3600, ':');
+			out = putTwo(out, seconds / 60 % 60, ':');
+			putTwo(out, seconds % 60, '\n');
+		}
+		return 0;
+	}
+
+ epoch:
+	/* Eighteen digits can't overflow, and is a long way past any time
+	   that localtime() can handle. */
+	if (len == 0 || len > 18)
+		return -1;
+	epoch = 0;
+	for (i=0; i<len; i++) {
+		unsigned d = (unsigned char)s[i] - '0';
+		if (d > 9)
+			return -1;
+		epoch = epoch * 10 + d;
+	}
+	timet = (time_t)epoch;
+	if ((uint64_t)timet != epoch || ! localtime_r(&timet, &tm))
+		return -1;
+	dSeconds = normalToDecimalSeconds(tm.tm_hour, tm.tm_min,
+					  /* Leap seconds count as 59. */
+					  tm.tm_sec > 59 ? 59 : tm.tm_sec);
+	out = putTwo(out, dSeconds / 10000, '.');
+	out = putTwo(out, dSeconds / 100 % 100, '.');
+	putTwo(out, dSeconds % 100, '\n');
+	return 0;
+}
+
+
+static void batchConvert(const char *s, size_t len)
+{
+	/* Every valid result is nine characters. */
+	if (batchOutLen + 9 > sizeof(batchOutBuf))
+		batchFlush();
+	batchLines++;
+	if (len <= BATCH_MAXLINE
+	    && batchLine(s, len, batchOutBuf + batchOutLen) == 0) {
+		batchOutLen += 9;
+	} else {
+		batchErrors++;
+		batchOutBuf[batchOutLen++] = '?';
+		batchOutBuf[batchOutLen++] = '\n';
+	}
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void batch(const char *filename, int stats)
+{
+	size_t have = 0;
+	ssize_t got;
+	char *p;
+	char *end;
+	char *nl;
+	int skipping = 0;
+	double start;
+	double elapsed;
+
+	if (filename && strcmp(filename, "-")) {
+		if (! freopen(filename, "r", stdin)) {
+			perror(filename);
+			exit(3);
+		}
+	}
+	batchIn = fileno(stdin);
+	start = now();
+
+	for (;;) {
+		got = read(batchIn, batchInBuf + have,
+			   sizeof(batchInBuf) - have);
+		if (got < 0) {
+			perror(filename ? filename : "stdin");
+			exit(3);
+		}
+		if (got == 0)
+			break;
+		p = batchInBuf;
+		end = batchInBuf + have + got;
+		while ((nl = memchr(p, '\n', end - p))) {
+			if (skipping)
+				skipping = 0;
+			else
+				batchConvert(p, nl - p);
+			p = nl + 1;
+		}
+		have = end - p;
+		if (have == sizeof(batchInBuf)) {
+			/* A whole buffer with no newline.  That line is bad,
+			   so throw it away up to its newline. */
+			if (! skipping)
+				batchConvert(p, have);
+			skipping = 1;
+			have = 0;
+		} else {
+			memmove(batchInBuf, p, have);
+		}
+	}
+	/* The last line may not have a newline. */
+	if (have && ! skipping)
+		batchConvert(batchInBuf, have);
+	batchFlush();
+	if (fflush(stdout)) {
+		perror(myname);
+		exit(6);
+	}
+
+	if (stats) {
+		elapsed = now() - start;
+		fprintf(stderr, "%s: %lu lines in %.3f s, %.0f lines/s\n",
+			myname, batchLines, elapsed,
+			elapsed > 0 ? batchLines / elapsed : 0.0);
+	}
+	if (batchErrors) {
+		fprintf(stderr, "%s: %lu bad lines\n", myname, batchErrors);
+		exit(5);
+	}
+}
+
+
+/* Log conversion.  Every HH:MM:SS field in the file is replaced by the same
+   time in decimal, as 0H.MM.SS, which is the same length.  So each part of
+   the file can be converted on its own, by its own thread, and the output
+   lines up with the input.
+
+   The file is mapped into memory and split into blocks of about
+   LOG_BLOCKSIZE, each ending at the end of a line.  The threads take the
+   next block, convert it into their own buffer, then wait for their turn to
+   write it, so the output is in order and only one block per thread is in
+   memory.  With -i the mapping is shared and the blocks are converted in
+   place instead. */
+
+#define LOG_BLOCKSIZE (4 * 1024 * 1024)
+
+/** Don't start more threads than this. */
+#define LOG_MAXTHREADS 256
+
+struct LogBlock {
+	size_t start;
+	size_t end;
+};
+
+static char *logMap;
+static struct LogBlock *logBlocks;
+static size_t logNBlocks;
+static int logInPlace;
+
+static pthread_mutex_t logMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logCond = PTHREAD_COND_INITIALIZER;
+/** The next block for a thread to take. */
+static size_t logNextBlock;
+/** The next block to be written out. */
+static size_t logNextWrite;
+static unsigned long logFields;
+
+
+static inline int isTimeChar(char c)
+{
+	return (c >= '0' && c <= '9') || c == ':';
+}
+
+
+/**
+ * Convert all the times in s, which is a whole number of lines.
+ *
+ * @return the number of times converted.
+ */
+static unsigned long logConvert(char *s, size_t len)
+{
+	char *p = s;
+	char *end = s + len;
+	char *c;
+	int h, m, sec;
+	uint32_t dSeconds;
+	unsigned long n = 0;
+
+	/* c is the first colon of a possible HH:MM:SS. */
+	while ((c = memchr(p, ':', end - p))) {
+		p = c + 1;
+		if (c - s < 2 || end - c < 6 || c[3] != ':')
+			continue;
+		if ((c - s > 2 && isTimeChar(c[-3]))
+		    || (end - c > 6 && isTimeChar(c[6])))
+			continue;
+		h = getTwo(c - 2);
+		m = getTwo(c + 1);
+		sec = getTwo(c + 4);
+		if (h < 0 || m < 0 || sec < 0
+		    || h >= 24 || m >= 60 || sec >= 60)
+			continue;
+		dSeconds = normalToDecimalSeconds(h, m, sec);
+		c = putTwo(c - 2, dSeconds / 10000, '.');
+		c = putTwo(c, dSeconds / 100 % 100, '.');
+		c[0] = '0' + dSeconds % 100 / 10;
+		c[1] = '0' + dSeconds % 10;
+		p = c + 2;
+		n++;
+	}
+	return n;
+}
+
+
+static void *logThread(void *arg)
+{
+	char *buf = 0;
+	size_t bufSize = 0;
+	size_t b;
+	size_t len;
+	unsigned long n = 0;
+	char *p;
+	ssize_t done;
+
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&logMutex);
+		b = logNextBlock++;
+		pthread_mutex_unlock(&logMutex);
+		if (b >= logNBlocks)
+			break;
+		len = logBlocks[b].end - logBlocks[b].start;
+
+		if (logInPlace) {
+			n += logConvert(logMap + logBlocks[b].start, len);
+			continue;
+		}
+
+		if (len > bufSize) {
+			free(buf);
+			bufSize = len;
+			buf = malloc(bufSize);
+			if (! buf) {
+				perror(myname);
+				exit(4);
+			}
+		}
+		memcpy(buf, logMap + logBlocks[b].start, len);
+		n += logConvert(buf, len);
+
+		pthread_mutex_lock(&logMutex);
+		while (logNextWrite != b)
+			pthread_cond_wait(&logCond, &logMutex);
+		pthread_mutex_unlock(&logMutex);
+
+		/* It's our turn, so nobody else writes until we're done. */
+		for (p=buf; p<buf+len; p+=done) {
+			done = write(1, p, buf + len - p);
+			if (done < 0) {
+				perror(myname);
+				exit(6);
+			}
+		}
+
+		pthread_mutex_lock(&logMutex);
+		logNextWrite++;
+		pthread_cond_broadcast(&logCond);
+		pthread_mutex_unlock(&logMutex);
+	}
+	free(buf);
+
+	pthread_mutex_lock(&logMutex);
+	logFields += n;
+	pthread_mutex_unlock(&logMutex);
+	return 0;
+}
+
+
+static void logFile(const char *filename, int inPlace, long nthreads,
+		    int stats)
+{
+	int fd;
+	struct stat st;
+	size_t size;
+	size_t start;
+	size_t end;
+	char *nl;
+	pthread_t threads[LOG_MAXTHREADS];
+	long i;
+	double startTime;
+	double elapsed;
+
+	if (nthreads <= 0) {
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nthreads <= 0)
+			nthreads = 1;
+	}
+	if (nthreads > LOG_MAXTHREADS)
+		nthreads = LOG_MAXTHREADS;
+
+	fd = open(filename, inPlace ? O_RDWR : O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(filename);
+		exit(3);
+	}
+	if (! S_ISREG(st.st_mode)) {
+		fprintf(stderr, "%s: %s is not a file\n", myname, filename);
+		exit(3);
+	}
+	size = st.st_size;
+	startTime = now();
+	if (size) {
+		logMap = mmap(0, size, inPlace ? PROT_READ | PROT_WRITE
+			      : PROT_READ, inPlace ? MAP_SHARED : MAP_PRIVATE,
+			      fd, 0);
+		if (logMap == MAP_FAILED) {
+			perror(filename);
+			exit(3);
+		}
+		madvise(logMap, size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	/* Split at line ends. */
+	logBlocks = malloc((size / LOG_BLOCKSIZE + 1) * sizeof(*logBlocks));
+	if (! logBlocks) {
+		perror(myname);
+		exit(4);
+	}
+	for (start=0; start<size; start=end) {
+		end = start + LOG_BLOCKSIZE;
+		if (end >= size) {
+			end = size;
+		} else {
+			nl = memchr(logMap + end, '\n', size - end);
+			end = nl ? (size_t)(nl - logMap) + 1 : size;
+		}
+		logBlocks[logNBlocks].start = start;
+		logBlocks[logNBlocks].end = end;
+		logNBlocks++;
+	}
+	logInPlace = inPlace;
+
+	if (nthreads > (long)logNBlocks)
+		nthreads = logNBlocks ? logNBlocks : 1;
+	for (i=0; i<nthreads; i++) {
+		if (pthread_create(&threads[i], 0, logThread, 0)) {
+			perror(myname);
+			exit(4);
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		pthread_join(threads[i], 0);
+	}
+	if (size && inPlace && msync(logMap, size, MS_SYNC)) {
+		perror(filename);
+		exit(6);
+	}
+
+	if (stats) {
+		elapsed = now() - startTime;
+		fprintf(stderr, "%s: %zu bytes, %lu times, %ld threads,"
+			" %.3f s, %.0f MB/s\n", myname, size, logFields,
+			nthreads, elapsed,
+			elapsed > 0 ? size / elapsed / 1e6 : 0.0);
+	}
+	if (size)
+		munmap(logMap, size);
+	free(logBlocks);
+}
+
+
+/* Follow mode.  Print the decimal time as each decimal second (0.864s) of
+   the local day starts, or each 1/32 of one (27ms), like the clock's timer1
+   ticks.  Each wake up is an absolute CLOCK_REALTIME deadline, worked out
+   again from the local midnight every time, so errors don't add up and
+   clock changes are followed.  How late each wake up was is recorded, and
+   shown at the end with -s.
+
+   With -p, nothing is printed.  Instead the time is put in shared memory
+   every 1/32 of a decimal second, for decimal-time-shm.h to read. */
+
+#define FOLLOW_NS_PER_SECOND 1000000000LL
+
+/** A decimal second is 0.864 normal seconds. */
+#define FOLLOW_DECIMAL_NS 864000000LL
+
+static volatile sig_atomic_t followStop;
+
+static void followSignal(int sig)
+{
+	(void)sig;
+	followStop = 1;
+}
+
+
+/**
+ * @return the nanoseconds since local midnight at t.
+ */
+static int64_t followDayNs(const struct timespec *t)
+{
+	struct tm tm;
+	int64_t daySeconds;
+
+	localtime_r(&t->tv_sec, &tm);
+	daySeconds = tm.tm_hour * 3600 + tm.tm_min * 60
+		+ (tm.tm_sec > 59 ? 59 : tm.tm_sec);
+	return daySeconds * FOLLOW_NS_PER_SECOND + t->tv_nsec;
+}
+
+
+/**
+ * Put the time at the start of a tick into the shared memory.
+ */
+static void followPublish(struct DecimalTimeShm *shm, int64_t target,
+			  int64_t dayNs, uint32_t dSeconds, uint8_t tick)
+{
+	uint32_t seconds = dayNs / FOLLOW_NS_PER_SECOND;
+
+	/* Odd while we change it, so the readers know to wait. */
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	shm->now.dseconds = dSeconds;
+	shm->now.tick = tick;
+	shm->now.h = seconds / 3600;
+	shm->now.m = seconds / 60 % 60;
+	shm->now.s = seconds % 60;
+	shm->now.realtime_ns = target;
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+}
+
+
+static void follow(int ticks, long count, int realtime, int stats,
+		   struct DecimalTimeShm *shm)
+{
+	const int64_t period = ticks ? FOLLOW_DECIMAL_NS / 32
+		: FOLLOW_DECIMAL_NS;
+	struct timespec t;
+	struct timespec deadline;
+	struct sigaction sa;
+	int64_t dayNs;
+	int64_t index;
+	int64_t expected = -1;
+	int64_t target;
+	int64_t late;
+	int64_t lateMin = INT64_MAX;
+	int64_t lateMax = 0;
+	double lateSum = 0;
+	double lateSumSq = 0;
+	unsigned long wakeups = 0;
+	unsigned long missed = 0;
+	unsigned long overMs = 0;
+	uint32_t dSeconds;
+	char line[16];
+	char *p;
+	double mean;
+	double sd;
+
+	if (realtime) {
+		struct sched_param sp;
+
+		/* Page faults and other processes make the wake ups late. */
+		sp.sched_priority = sched_get_priority_max(SCHED_FIFO);
+		if (mlockall(MCL_CURRENT | MCL_FUTURE)
+		    || sched_setscheduler(0, SCHED_FIFO, &sp))
+			fprintf(stderr, "%s: can't run in real time: %s\n",
+				myname, strerror(errno));
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = followSignal;
+	sigaction(SIGINT, &sa, 0);
+	sigaction(SIGTERM, &sa, 0);
+
+	while (! followStop && (count <= 0 || wakeups < (unsigned long)count)) {
+		clock_gettime(CLOCK_REALTIME, &t);
+		dayNs = followDayNs(&t);
+		index = dayNs / period + 1;
+		if (expected >= 0 && index > expected)
+			missed += index - expected;
+		target = (int64_t)t.tv_sec * FOLLOW_NS_PER_SECOND + t.tv_nsec
+			- dayNs + index * period;
+		deadline.tv_sec = target / FOLLOW_NS_PER_SECOND;
+		deadline.tv_nsec = target % FOLLOW_NS_PER_SECOND;
+		if (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME,
+				    &deadline, 0))
+			continue;
+		clock_gettime(CLOCK_REALTIME, &t);
+
+		late = (int64_t)t.tv_sec * FOLLOW_NS_PER_SECOND + t.tv_nsec
+			- target;
+		wakeups++;
+		if (late < lateMin)
+			lateMin = late;
+		if (late > lateMax)
+			lateMax = late;
+		if (late > FOLLOW_NS_PER_SECOND / 1000)
+			overMs++;
+		lateSum += late;
+		lateSumSq += (double)late * late;
+
+		/* The day has exactly 100000 decimal seconds, so the last
+		   boundary is the next day's midnight. */
+		dSeconds = (index * period / FOLLOW_DECIMAL_NS) % 100000;
+		expected = index + 1;
+		if (shm) {
+			followPublish(shm, target, (index * period)
+				      % (86400 * FOLLOW_NS_PER_SECOND),
+				      dSeconds, index % 32);
+			continue;
+		}
+		p = putTwo(line, dSeconds / 10000, '.');
+		p = putTwo(p, dSeconds / 100 % 100, '.');
+		if (ticks) {
+			p = putTwo(p, dSeconds % 100, '/');
+			p = putTwo(p, index % 32, '\n');
+		} else {
+			p = putTwo(p, dSeconds % 100, '\n');
+		}
+		if (write(1, line, p - line) < 0) {
+			perror(myname);
+			exit(6);
+		}
+	}
+
+	if (stats && wakeups) {
+		mean = lateSum / wakeups;
+		sd = lateSumSq / wakeups - mean * mean;
+		sd = sd > 0 ? sqrt(sd) : 0;
+		fprintf(stderr, "%s: %lu wake ups, late by min %.1f us,"
+			" mean %.1f us, max %.1f us, sd %.1f us\n",
+			myname, wakeups, lateMin / 1e3, mean / 1e3,
+			lateMax / 1e3, sd / 1e3);
+		fprintf(stderr, "%s: %lu more than 1ms late, %lu missed\n",
+			myname, overMs, missed);
+	}
+}
+
+
+/* Shared memory.  -p publishes the time, and -P compares the time it takes
+   to read it from the shared memory with the other ways of getting the
+   decimal time. */
+
+#define SHM_BENCH_READS 10000000
+#define SHM_BENCH_LOCALTIMES 1000000
+#define SHM_BENCH_SPAWNS 200
+
+
+static void publish(int realtime, int stats)
+{
+	int fd;
+	struct DecimalTimeShm *shm;
+
+	fd = shm_open(DECIMAL_TIME_SHM_NAME, O_RDWR | O_CREAT, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(*shm))) {
+		perror(DECIMAL_TIME_SHM_NAME);
+		exit(3);
+	}
+	shm = mmap(0, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+	if (shm == MAP_FAILED) {
+		perror(DECIMAL_TIME_SHM_NAME);
+		exit(3);
+	}
+	close(fd);
+
+	/* The memory may be left from a publisher that was killed, perhaps
+	   half way through an update with seq odd.  Start it again, so
+	   readers waiting for seq to go even aren't stuck for good. */
+	__atomic_store_n(&shm->magic, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&shm->seq, 0, __ATOMIC_RELAXED);
+	memset(&shm->now, 0, sizeof(shm->now));
+
+	/* The first tick comes within 27ms, so readers that see the magic
+	   number will soon see a time. */
+	__atomic_store_n(&shm->magic, DECIMAL_TIME_SHM_MAGIC,
+			 __ATOMIC_RELEASE);
+	follow(1, 0, realtime, stats, shm);
+
+	__atomic_store_n(&shm->magic, 0, __ATOMIC_RELEASE);
+	shm_unlink(DECIMAL_TIME_SHM_NAME);
+}
+
+
+static void shmBench(const char *self)
+{
+	const struct DecimalTimeShm *shm;
+	struct DecimalTimeNow dtn;
+	unsigned long i;
+	volatile uint32_t sink = 0;
+	double start;
+	double elapsed;
+	time_t timet;
+	struct tm tm;
+	FILE *f;
+	char buf[32];
+	char command[1024];
+
+	shm = decimal_time_shm_open();
+	if (! shm || ! decimal_time_shm_read(shm, &dtn)) {
+		fprintf(stderr, "%s: the publisher (%s -p) is not running\n",
+			myname, myname);
+		exit(3);
+	}
+	start = now();
+	for (i=0; i<SHM_BENCH_READS; i++) {
+		decimal_time_shm_read(shm, &dtn);
+		sink += dtn.dseconds;
+	}
+	elapsed = now() - start;
+	printf("shared memory  %10.1f ns per read\n",
+	       elapsed / SHM_BENCH_READS * 1e9);
+
+	start = now();
+	for (i=0; i<SHM_BENCH_LOCALTIMES; i++) {
+		timet = time(0);
+		localtime_r(&timet, &tm);
+		sink += normalToDecimalSeconds(tm.tm_hour, tm.tm_min,
+					       tm.tm_sec > 59 ? 59 : tm.tm_sec);
+	}
+	elapsed = now() - start;
+	printf("localtime()    %10.1f ns per read\n",
+	       elapsed / SHM_BENCH_LOCALTIMES * 1e9);
+
+	snprintf(command, sizeof(command), "'%s'", self);
+	start = now();
+	for (i=0; i<SHM_BENCH_SPAWNS; i++) {
+		f = popen(command, "r");
+		if (! f || ! fgets(buf, sizeof(buf), f)) {
+			perror(command);
+			exit(3);
+		}
+		pclose(f);
+	}
+	elapsed = now() - start;
+	printf("run the tool   %10.1f ns per read\n",
+	       elapsed / SHM_BENCH_SPAWNS * 1e9);
+	(void)sink;
+}
+
+
+/* Checking and timing the array conversions. */
+
+#define BULK_DAY_NORMAL 86400
+#define BULK_DAY_DECIMAL 100000
+
+/** The array size for timing.  Big enough to take a while, small enough to
+    stay in the cache. */
+#define BULK_BENCH_N 8192
+
+/** Time each conversion for at least this long. */
+#define BULK_BENCH_SECONDS 0.5
+
+static uint32_t bulkIn[BULK_DAY_DECIMAL + 8];
+static uint32_t bulkOut[BULK_DAY_DECIMAL + 8];
+
+
+/**
+ * Check one array conversion against the exact one, for every time of day,
+ * and at every alignment and length up to twenty so the leftovers at the
+ * ends get checked too.
+ *
+ * @return the number of wrong answers.
+ */
+static unsigned long bulkCheck(void (*convert)(const uint32_t *, uint32_t *,
+					       size_t),
+			       uint32_t (*exact)(uint32_t), uint32_t ntimes)
+{
+	unsigned long errors = 0;
+	uint32_t i;
+	size_t offset;
+	size_t n;
+
+	for (i=0; i<ntimes; i++) {
+		bulkIn[i] = i;
+	}
+	convert(bulkIn, bulkOut, ntimes);
+	for (i=0; i<ntimes; i++) {
+		if (bulkOut[i] != exact(i)) {
+			if (! errors)
+				fprintf(stderr, "%s: %u gives %u, not %u\n",
+					myname, i, bulkOut[i], exact(i));
+			errors++;
+		}
+	}
+
+	for (offset=0; offset<8; offset++) {
+		for (n=0; n<=20; n++) {
+			for (i=0; i<n+8; i++) {
+				bulkIn[i] = ntimes - 1 - i;
+				bulkOut[i] = 0xdeadbeef;
+			}
+			convert(bulkIn + offset, bulkOut + offset, n);
+			for (i=0; i<n+8; i++) {
+				if (i >= offset && i < offset + n) {
+					if (bulkOut[i] != exact(bulkIn[i]))
+						errors++;
+				} else if (bulkOut[i] != 0xdeadbeef) {
+					/* Written outside the array. */
+					errors++;
+				}
+			}
+		}
+	}
+
+	/* Converting in place. */
+	for (i=0; i<ntimes; i++) {
+		bulkOut[i] = i;
+	}
+	convert(bulkOut, bulkOut, ntimes);
+	for (i=0; i<ntimes; i++) {
+		if (bulkOut[i] != exact(i))
+			errors++;
+	}
+	return errors;
+}
+
+
+/**
+ * @return the number of conversions per second.
+ */
+static double bulkBench(void (*convert)(const uint32_t *, uint32_t *, size_t),
+			uint32_t ntimes)
+{
+	uint32_t i;
+	unsigned long rounds = 0;
+	double start;
+	double elapsed;
+	volatile uint32_t sink;
+
+	for (i=0; i<BULK_BENCH_N; i++) {
+		bulkIn[i] = (i * 7919) % ntimes;
+	}
+	start = now();
+	do {
+		for (i=0; i<100; i++) {
+			convert(bulkIn, bulkOut, BULK_BENCH_N);
+		}
+		rounds += 100;
+		elapsed = now() - start;
+	} while (elapsed < BULK_BENCH_SECONDS);
+	sink = bulkOut[BULK_BENCH_N - 1];
+	(void)sink;
+	return (double)rounds * BULK_BENCH_N / elapsed;
+}
+
+
+static void bulk(void)
+{
+	const struct BulkConversion *bc;
+	unsigned long errors = 0;
+	unsigned long e;
+
+	for (bc=bulk_conversions; bc->name; bc++) {
+		if (! bc->available()) {
+			printf("%-8s not available on this CPU\n", bc->name);
+			continue;
+		}
+		e = bulkCheck(bc->normalToDecimal, normal_seconds_to_decimal,
+			      BULK_DAY_NORMAL);
+		e += bulkCheck(bc->decimalToNormal, decimal_seconds_to_normal,
+			       BULK_DAY_DECIMAL);
+		printf("%-8s %s  normal->decimal %6.0f M/s"
+		       "  decimal->normal %6.0f M/s\n", bc->name,
+		       e ? "WRONG" : "ok   ",
+		       bulkBench(bc->normalToDecimal, BULK_DAY_NORMAL) / 1e6,
+		       bulkBench(bc->decimalToNormal, BULK_DAY_DECIMAL) / 1e6);
+		errors += e;
+	}
+	if (errors) {
+		fprintf(stderr, "%s: %lu wrong conversions\n", myname, errors);
+		exit(5);
+	}
+}
+
+
 int main(int argc, char **argv)
 {
+	int opt;
+	int batchMode = 0;
+	int stats = 0;
+	int bulkMode = 0;
+	int logMode = 0;
+	int inPlace = 0;
+	long nthreads = 0;
+	int followMode = 0;
+	int ticks = 0;
+	long count = 0;
+	int realtime = 0;
+	int publishMode = 0;
+	int shmBenchMode = 0;
+	char *endp;
+
 	myname = argv[0];
+	while ((opt = getopt(argc, argv, "bsBmij:ftn:rpP")) != -1) {
+		switch (opt) {
+		case 'b':
+			batchMode = 1;
+			break;
+		case 's':
+			stats = 1;
+			break;
+		case 'B':
+			bulkMode = 1;
+			break;
+		case 'm':
+			logMode = 1;
+			break;
+		case 'i':
+			inPlace = 1;
+			break;
+		case 'f':
+			followMode = 1;
+			break;
+		case 't':
+			ticks = 1;
+			break;
+		case 'n':
+			count = strtol(optarg, &endp, 10);
+			if (*endp || count <= 0)
+				usage(1);
+			break;
+		case 'r':
+			realtime = 1;
+			break;
+		case 'p':
+			publishMode = 1;
+			break;
+		case 'P':
+			shmBenchMode = 1;
+			break;
+		case 'j':
+			nthreads = strtol(optarg, &endp, 10);
+			if (*endp || nthreads < 0)
+				usage(1);
+			break;
+		default:
+			usage(1);
+		}
+	}
+	if ((inPlace || nthreads) && ! logMode)
+		usage(1);
+	if ((ticks || count) && ! followMode)
+		usage(1);
+	if (realtime && ! followMode && ! publishMode)
+		usage(1);
+	if (followMode) {
+		if (batchMode || bulkMode || logMode || publishMode
+		    || shmBenchMode || argc != optind)
+			usage(1);
+		follow(ticks, count, realtime, stats, 0);
+		return 0;
+	}
+	if (publishMode) {
+		if (batchMode || bulkMode || logMode || shmBenchMode
+		    || argc != optind)
+			usage(1);
+		publish(realtime, stats);
+		return 0;
+	}
+	if (shmBenchMode) {
+		if (batchMode || bulkMode || logMode || stats
+		    || argc != optind)
+			usage(1);
+		shmBench(argv[0]);
+		return 0;
+	}
+	if (logMode) {
+		if (batchMode || bulkMode || argc - optind != 1)
+			usage(1);
+		logFile(argv[optind], inPlace, nthreads, stats);
+		return 0;
+	}
+	if (bulkMode) {
+		if (batchMode || stats || argc != optind)
+			usage(1);
+		bulk();
+		return 0;
+	}
+	if (batchMode) {
+		if (argc - optind > 1)
+			usage(1);
+		batch(argv[optind], stats);
+		return 0;
+	}
+	if (stats)
+		usage(1);
+
+	argc -= optind - 1;
+	argv += optind - 1;
 	if (argc == 1)
 		nowToDecimal();
 	else if (argc != 2)
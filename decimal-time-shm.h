@@ -0,0 +1,101 @@
+#ifndef decimal_time_shm_h_INCLUDED
+#define decimal_time_shm_h_INCLUDED
+
+/* Read the current decimal time from the shared memory that
+   "decimal-time-conversion -p" keeps up to date, without a system call.
+
+	const struct DecimalTimeShm *shm = decimal_time_shm_open();
+	struct DecimalTimeNow now;
+
+	if (shm && decimal_time_shm_read(shm, &now))
+		... use now.dseconds, now.tick, now.h, now.m, now.s ...
+
+   This file is all there is to the reader.  Link with -lrt on older C
+   libraries. */
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define DECIMAL_TIME_SHM_NAME "/decimal-time"
+#define DECIMAL_TIME_SHM_MAGIC 0x44434c4bU /* "DCLK" */
+
+/**
+ * The current time, as written by the publisher.
+ */
+struct DecimalTimeNow {
+	/** Decimal seconds since midnight, 0 to 99999. */
+	uint32_t dseconds;
+	/** The 1/32 of the decimal second, 0 to 31. */
+	uint8_t tick;
+	/** The normal time at the start of the tick. */
+	uint8_t h;
+	uint8_t m;
+	uint8_t s;
+	/** CLOCK_REALTIME, in nanoseconds, at the start of the tick. */
+	int64_t realtime_ns;
+};
+
+/**
+ * The shared memory.  The publisher makes seq odd while it changes now, and
+ * even again when it's done.
+ */
+struct DecimalTimeShm {
+	uint32_t magic;
+	uint32_t seq;
+	struct DecimalTimeNow now;
+};
+
+
+/**
+ * Map the publisher's shared memory.
+ *
+ * @return the shared memory, or null if the publisher is not running.
+ */
+static inline const struct DecimalTimeShm *decimal_time_shm_open(void)
+{
+	int fd;
+	void *p;
+
+	fd = shm_open(DECIMAL_TIME_SHM_NAME, O_RDONLY, 0);
+	if (fd < 0)
+		return 0;
+	p = mmap(0, sizeof(struct DecimalTimeShm), PROT_READ, MAP_SHARED,
+		 fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return 0;
+	return (const struct DecimalTimeShm *)p;
+}
+
+
+/**
+ * Copy the current time.  If the publisher is part way through an update,
+ * wait for it to finish.
+ *
+ * @return 1 for success, 0 if the publisher has stopped or this isn't its
+ * memory.
+ */
+static inline int decimal_time_shm_read(const struct DecimalTimeShm *shm,
+					struct DecimalTimeNow *now)
+{
+	uint32_t seq;
+
+	for (;;) {
+		/* Checked each time round, so we give up if the publisher
+		   stops while we wait. */
+		if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE)
+		    != DECIMAL_TIME_SHM_MAGIC)
+			return 0;
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		*now = shm->now;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+			return 1;
+	}
+}
+
+#endif
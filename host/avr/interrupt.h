@@ -0,0 +1,15 @@
+#ifndef host_avr_interrupt_h_INCLUDED
+#define host_avr_interrupt_h_INCLUDED
+
+/* On the host, the "interrupts" are called by time-sync-host.c's main loop,
+   so they never preempt anything.  SREG is kept up to date anyway, as
+   serial_drain() checks it. */
+
+#include <avr/io.h>
+
+#define cli() do { SREG &= ~(1 << 7); } while (0)
+#define sei() do { SREG |= (1 << 7); } while (0)
+
+#define SIGNAL(vector) void vector(void); void vector(void)
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef host_avr_io_h_INCLUDED
+#define host_avr_io_h_INCLUDED
+
+/* Just enough of the AVR registers for serial.c and timesync.c to build on
+   the host, in time-sync-host.  The registers are variables, defined in
+   time-sync-host.c. */
+
+#include <stdint.h>
+
+extern volatile uint8_t SREG;
+
+extern volatile uint8_t UDR1;
+extern volatile uint8_t UCSR1A;
+extern volatile uint8_t UCSR1B;
+extern volatile uint8_t UCSR1C;
+extern volatile uint8_t UBRR1H;
+extern volatile uint8_t UBRR1L;
+
+extern volatile uint8_t DDRD;
+extern volatile uint8_t PORTD;
+
+/* UCSR1A */
+#define RXC1   7
+#define TXC1   6
+#define UDRE1  5
+#define FE1    4
+#define DOR1   3
+#define UPE1   2
+#define U2X1   1
+#define MPCM1  0
+
+/* UCSR1B */
+#define RXCIE1 7
+#define TXCIE1 6
+#define UDRIE1 5
+#define RXEN1  4
+#define TXEN1  3
+#define UCSZ12 2
+#define RXB81  1
+#define TXB81  0
+
+/* UCSR1C */
+#define UMSEL11 7
+#define UMSEL10 6
+#define UPM11   5
+#define UPM10   4
+#define USBS1   3
+#define UCSZ11  2
+#define UCSZ10  1
+#define UCPOL1  0
+
+#endif
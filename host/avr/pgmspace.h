@@ -0,0 +1,12 @@
+#ifndef host_avr_pgmspace_h_INCLUDED
+#define host_avr_pgmspace_h_INCLUDED
+
+/* There's only one address space on the host. */
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte_near(address) (*(const uint8_t *)(address))
+#define pgm_read_word_near(address) (*(const uint16_t *)(address))
+
+#endif
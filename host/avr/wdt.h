@@ -0,0 +1,9 @@
+#ifndef host_avr_wdt_h_INCLUDED
+#define host_avr_wdt_h_INCLUDED
+
+/* There is no watchdog on the host. */
+
+#define wdt_reset() do { } while (0)
+#define wdt_disable() do { } while (0)
+
+#endif
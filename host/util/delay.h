@@ -0,0 +1,9 @@
+#ifndef host_util_delay_h_INCLUDED
+#define host_util_delay_h_INCLUDED
+
+#include <unistd.h>
+
+#define _delay_ms(ms) usleep((useconds_t)((ms) * 1000))
+#define _delay_us(us) usleep((useconds_t)(us))
+
+#endif
@@ -8,6 +8,7 @@
 #include "bsp.h"
 #include "cpu-speed.h"
 #include "qpn_port.h"
+#include "settings.h"
 #include <util/delay.h>
 #include <avr/wdt.h>
 
@@ -62,6 +63,13 @@ Q_DEFINE_THIS_FILE;
     really turn off the back light we need to disconnect the timer PWM. */
 static uint8_t brightness;
 
+/** True once the LCD has been through its power on sequence.  Until then
+    anything written to it is dropped. */
+static uint8_t ready;
+
+/** The next part of the power on sequence for lcd_init_next(). */
+static uint8_t initStep;
+
 
 /** Set an IO bit. */
 #define SB(port,bit)				\
@@ -119,14 +127,160 @@ static uint8_t brightness;
 	do { if (x) SB(D7_PORT, D7_BIT); else CB(D7_PORT, D7_BIT); } while (0)
 
 
-static void lcd_init2(void);
+#ifdef QK_PREEMPTIVE
+
+/**
+ * The highest priority of the active objects that write to the LCD.  That's
+ * timesetter, at the top of QF_active[].
+ */
+#define LCD_PRIO_CEILING QF_MAX_ACTIVE
+
+/** Returned by lcd_lock() when it didn't need to lock anything. */
+#define LCD_NOT_LOCKED 0xff
+
+/**
+ * Stop other active objects from using the LCD until lcd_unlock().
+ *
+ * With the preemptive kernel, timesetter could otherwise write to the LCD in
+ * the middle of timedisplay writing a line.  one_char() is safe on its own,
+ * but a line or a cursor move is several of those.
+ *
+ * Before the kernel starts, and with interrupts off (in an assertion
+ * handler), nothing can preempt us, so we don't need the mutex then.
+ */
+static QMutex lcd_lock(void)
+{
+	if ((SREG & (1 << 7)) && QK_currPrio_ <= QF_MAX_ACTIVE) {
+		return QK_mutexLock(LCD_PRIO_CEILING);
+	} else {
+		return LCD_NOT_LOCKED;
+	}
+}
+
+static void lcd_unlock(QMutex mutex)
+{
+	if (LCD_NOT_LOCKED != mutex) {
+		QK_mutexUnlock(mutex);
+	}
+}
+
+#define LCD_LOCK() QMutex lcd_mutex = lcd_lock()
+#define LCD_UNLOCK() lcd_unlock(lcd_mutex)
+
+#else
+
+#define LCD_LOCK()
+#define LCD_UNLOCK()
+
+#endif
+
+
+static void lcd_pins(void);
 static void one_char(uint8_t rs, char c);
+static void send_char(uint8_t rs, char c);
 static void half_char(uint8_t rs, char c);
 static void lcd_on(void);
 static void lcd_off(void);
 
 
+/**
+ * Start the LCD.
+ *
+ * This only sets up the pins and the backlight.  The LCD needs long delays
+ * after power on and between the parts of its initialisation, so the rest is
+ * done by lcd_init_next(), which the caller runs from a timer while the rest
+ * of the clock starts.
+ */
 void lcd_init(void)
+{
+	ready = 0;
+	initStep = 0;
+	lcd_pins();
+}
+
+
+/**
+ * The instructions that lcd_init_next() sends, twice over, as the two halves
+ * of each, and the milliseconds to wait after each one.
+ */
+static const Q_ROM uint8_t initSequence[][3] = {
+	{ 0b00100000, 0b11000000,  5 },	/* DL=0, N=1 (2 line), F=X */
+	{ 0b00100000, 0b11000000,  5 },	/* DL=0, N=1 (2 line), F=X */
+	{ 0b00000000, 0b11000000,  5 },	/* Display on, cursor off, blink off */
+	{ 0b00000000, 0b00010000, 10 },	/* Display clear */
+	{ 0b00000000, 0b01100000,  5 },	/* I/D=increment, shift=0 */
+};
+
+#define INIT_STEPS (sizeof(initSequence) / sizeof(initSequence[0]))
+
+
+/**
+ * Do the next part of the LCD power on sequence.  Wait at least 55ms after
+ * lcd_init() before the first call.
+ *
+ * Each call sends at most a couple of instructions and returns, so the
+ * caller can wait with a timer between them instead of stopping everything.
+ *
+ * @return the number of milliseconds to wait before calling this again, or
+ * zero when the LCD is ready.
+ */
+uint8_t lcd_init_next(void)
+{
+	uint8_t i;
+
+	/* This is the sequence that results in the QP5520 LCD module working
+	   in 4 bit mode (or any mode at all).  Looks weird, but I spend ages
+	   figuring this out.  It goes through initSequence[] twice, with a
+	   cursor move and a display mode between. */
+	if (initStep < INIT_STEPS) {
+		i = initStep;
+	} else if (initStep == INIT_STEPS) {
+		send_char(0, 0x80);		/* Position 0, 0 */
+		send_char(0, 0b00001111);	/* Display on, Cursor on, Blink on */
+		initStep ++;
+		return 55;
+	} else if (initStep <= 2 * INIT_STEPS) {
+		i = initStep - INIT_STEPS - 1;
+	} else if (initStep == 2 * INIT_STEPS + 1) {
+		initStep ++;
+		ready = 73;
+		lcd_set_brightness(settings_get(SETTING_BRIGHTNESS));
+		return 0;
+	} else {
+		return 0;
+	}
+	half_char(0, Q_ROM_BYTE(initSequence[i][0]));
+	half_char(0, Q_ROM_BYTE(initSequence[i][1]));
+	initStep ++;
+	return Q_ROM_BYTE(initSequence[i][2]);
+}
+
+
+/**
+ * Finish the LCD power on sequence now, waiting for as long as it takes.
+ */
+void lcd_init_finish(void)
+{
+	uint8_t ms;
+
+	while ((ms = lcd_init_next())) {
+		while (ms--) {
+			_delay_ms(1);
+		}
+	}
+}
+
+
+uint8_t lcd_ready(void)
+{
+	return ready;
+}
+
+
+/**
+ * Set all the display pins as outputs, and turn on the backlight.
+ */
+static void lcd_pins(void)
 {
 	uint8_t sreg;
 
@@ -137,7 +291,6 @@ void lcd_init(void)
 	BSP_lcd_init(BRIGHTNESS_2);
 	BSP_lcd_pwm_on();
 
-	/* Set all the display pins as outputs. */
 	SB(RS_DDR, RS_BIT);
 	SB(RW_DDR, RW_BIT);
 	SB(EN_DDR, EN_BIT);
@@ -155,40 +308,44 @@ void lcd_init(void)
 	D6(1);
 	D7(1);
 
-	/* This is the sequence that results in the QP5520 LCD module working
-	   in 4 bit mode (or any mode at all).  Looks weird, but I spend ages
-	   figuring this out. */
-	_delay_ms(50);
-	lcd_init2();
-	lcd_set_cursor(0, 0);
-	_delay_ms(50);
-	lcd_init2();
-
-	lcd_line1("Hello!");
-	_delay_ms(100);
-
 	SREG = sreg;
 }
 
 
-static void lcd_init2(void)
+/**
+ * Set up the LCD after a watchdog reset.
+ *
+ * The LCD kept its power and its settings through the reset, so we don't need
+ * the long power on delays in lcd_init().  But we may have been reset halfway
+ * through sending a char, so put the LCD back into 8 bit mode (which works
+ * from any state) and then into 4 bit mode again.
+ */
+void lcd_warm_init(void)
 {
+	uint8_t sreg;
+
+	lcd_pins();
+
+	sreg = SREG;
+	cli();
+
+	half_char(0, 0b00110000); /* DL=1 */
 	_delay_ms(5);
-	for (uint8_t i=0; i<2; i++) {
-		half_char(0, 0b00100000); /* DL=0 */
-		half_char(0, 0b11000000); /* N=1 (2 line), F=X */
-		_delay_ms(5);
-	}
-	half_char(0, 0b00000000);
-	half_char(0, 0b11000000); /* Display on, cursor off, blink off */
-	_delay_ms(5);
-	half_char(0, 0b00000000);
-	half_char(0, 0b00010000); /* Display clear */
-	_delay_ms(5);
-	_delay_ms(5);
-	half_char(0, 0b00000000);
-	half_char(0, 0b01100000); /* I/D=increment, shift=0 */
-	_delay_ms(5);
+	half_char(0, 0b00110000);
+	_delay_us(100);
+	half_char(0, 0b00110000);
+	half_char(0, 0b00100000); /* DL=0 */
+	send_char(0, 0b00101100); /* DL=0, N=1 (2 line), F=1 */
+	send_char(0, 0b00001100); /* Display on, Cursor off, Blink off */
+	send_char(0, 0b00000110); /* I/D=increment, shift=0 */
+	send_char(0, 0x01);	  /* Display clear */
+	_delay_ms(2);
+	initStep = 2 * INIT_STEPS + 2;
+	ready = 73;
+
+	SREG = sreg;
+
+	lcd_set_brightness(settings_get(SETTING_BRIGHTNESS));
 }
 
 
@@ -243,8 +400,10 @@ void lcd_assert(char const Q_ROM * const Q_ROM_VAR file, int line)
 
 void lcd_clear(void)
 {
+	LCD_LOCK();
 	one_char(0, 0x01);
 	_delay_ms(2);
+	LCD_UNLOCK();
 }
 
 
@@ -263,8 +422,10 @@ void lcd_setpos(uint8_t line, uint8_t pos)
 
 void lcd_set_cursor(uint8_t line, uint8_t pos)
 {
+	LCD_LOCK();
 	lcd_setpos(line, pos);
 	one_char(0, 0b00001111);	/* Display on, Cursor on, Blink on */
+	LCD_UNLOCK();
 }
 
 
@@ -276,19 +437,23 @@ void lcd_cursor_off(void)
 
 void lcd_line1(const char *line)
 {
+	LCD_LOCK();
 	lcd_setpos(0, 0);
 	for (uint8_t i=0; i<16 && line[i]; i++) {
 		one_char(1, line[i]);
 	}
+	LCD_UNLOCK();
 }
 
 
 void lcd_line2(const char *line)
 {
+	LCD_LOCK();
 	lcd_setpos(1, 0);
 	for (uint8_t i=0; i<16 && line[i]; i++) {
 		one_char(1, line[i]);
 	}
+	LCD_UNLOCK();
 }
 
 
@@ -297,6 +462,8 @@ void lcd_line1_rom(char const Q_ROM * const Q_ROM_VAR s)
 	static char line[16];
 	uint8_t i;
 	char c;
+	/* Also protects line[]. */
+	LCD_LOCK();
 
 	for (i=0; i<16; i++) {
 		line[i] = ' ';
@@ -310,6 +477,7 @@ void lcd_line1_rom(char const Q_ROM * const Q_ROM_VAR s)
 		line[i] = c;
 	}
 	lcd_line1(line);
+	LCD_UNLOCK();
 }
 
 
@@ -318,6 +486,8 @@ void lcd_line2_rom(char const Q_ROM * const Q_ROM_VAR s)
 	static char line[16];
 	uint8_t i;
 	char c;
+	/* Also protects line[]. */
+	LCD_LOCK();
 
 	for (i=0; i<16; i++) {
 		line[i] = ' ';
@@ -331,6 +501,18 @@ void lcd_line2_rom(char const Q_ROM * const Q_ROM_VAR s)
 		line[i] = c;
 	}
 	lcd_line2(line);
+	LCD_UNLOCK();
+}
+
+
+/**
+ * Send one char to the HD44780, if it's ready.
+ */
+static void one_char(uint8_t rs, char c)
+{
+	if (ready) {
+		send_char(rs, c);
+	}
 }
 
 
@@ -341,7 +523,7 @@ void lcd_line2_rom(char const Q_ROM * const Q_ROM_VAR s)
  * off.  But we manage the interrupt state so you can call this with interrupts
  * on or off, and we will return in the same state.
  */
-static void one_char(uint8_t rs, char c)
+static void send_char(uint8_t rs, char c)
 {
 	uint8_t sreg;
 
@@ -458,6 +640,8 @@ static void lcd_off(void)
 
 void lcd_set_brightness(uint8_t b)
 {
+	LCD_LOCK();
+
 	Q_ASSERT( b < 5 );
 
 	switch (b) {
@@ -490,6 +674,7 @@ void lcd_set_brightness(uint8_t b)
 		lcd_on();
 	}
 	brightness = b;
+	LCD_UNLOCK();
 }
 
 
@@ -5,6 +5,10 @@
 
 
 void lcd_init(void);
+uint8_t lcd_init_next(void);
+void lcd_init_finish(void);
+uint8_t lcd_ready(void);
+void lcd_warm_init(void);
 void lcd_clear(void);
 void lcd_setpos(uint8_t line, uint8_t pos);
 void lcd_set_cursor(uint8_t line, uint8_t pos);
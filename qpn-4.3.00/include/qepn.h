@@ -99,6 +99,29 @@
     */
     #define Q_REENTRANT
 #endif
+#ifdef QEP_TRAN_CACHE
+#ifndef QEP_TRAN_CACHE_SIZE /* if NOT defined, provide the default definition */
+
+    /** \brief The number of transition paths QHsm_dispatch() keeps with
+    * QEP_TRAN_CACHE. Must be a power of two.
+    */
+    #define QEP_TRAN_CACHE_SIZE 8
+#endif
+#endif
+#ifndef QEP_TRACE_TRAN     /* if NOT defined, provide the default definitions */
+
+    /** \brief Trace hooks for QEP-nano.
+    *
+    * QHsm_dispatch() calls QEP_TRACE_TRAN() when state handler \a source_
+    * takes a transition to \a target_, and QEP_TRACE_ENTRY() and
+    * QEP_TRACE_EXIT() just before it enters or exits each state. A port can
+    * define all three to record what the state machines do. By default they
+    * do nothing.
+    */
+    #define QEP_TRACE_TRAN(source_, target_)    ((void)0)
+    #define QEP_TRACE_ENTRY(state_)             ((void)0)
+    #define QEP_TRACE_EXIT(state_)              ((void)0)
+#endif
 
 /****************************************************************************/
 /** helper macro to calculate static dimension of a 1-dim array \a array_ */
@@ -195,6 +218,9 @@ typedef QState (*QStateHandler)(void *me);
 typedef struct QFsmTag {
     QStateHandler state;                /**< current active state (private) */
     QEvent evt;       /**< currently processed event in the FSM (protected) */
+#ifdef QEP_TRAN_CACHE
+    uint8_t dynSuper;    /**< set by Q_SUPER_DYNAMIC() (private, see qepn.c) */
+#endif
 } QFsm;
 
 /** \brief macro to access the signal of the current event of a state machine
@@ -305,6 +331,21 @@ void QFsm_init(QFsm *me);
 #define Q_SUPER(super_)  \
     (((QFsm *)me)->state = (QStateHandler)(super_),  Q_RET_SUPER)
 
+/** \brief Designates a superstate that is not always the same.
+*
+* A state that works out its superstate at run time, for example from a mode
+* kept in the state machine, must return Q_SUPER_DYNAMIC() instead of
+* Q_SUPER(). With QEP_TRAN_CACHE, QHsm_dispatch() doesn't keep the path of a
+* transition that goes through such a state, because the path may be
+* different the next time. Otherwise it is the same as Q_SUPER().
+*/
+#ifdef QEP_TRAN_CACHE
+#define Q_SUPER_DYNAMIC(super_)  \
+    (((QFsm *)me)->dynSuper = (uint8_t)1, Q_SUPER(super_))
+#else
+#define Q_SUPER_DYNAMIC(super_)  Q_SUPER(super_)
+#endif
+
 
 /****************************************************************************/
 #ifndef Q_NHSM
@@ -360,6 +401,18 @@ void QHsm_init(QHsm *me);
     void QHsm_dispatch(QHsm *me) Q_REENTRANT;
 #endif
 
+#ifdef QEP_TRAN_CACHE
+    /** \brief Gets the transition cache counts.
+    *
+    * With QEP_TRAN_CACHE, QHsm_dispatch() keeps the path of each transition
+    * it takes, and the next time the same transition is taken from the same
+    * state it exits and enters the same states again without asking each
+    * state for its superstate. \a hits is the number of transitions found in
+    * the cache, and \a misses the number whose path had to be found.
+    */
+    void QHsm_getTranCacheStats(uint16_t *hits, uint16_t *misses);
+#endif
+
 /* protected methods... */
 
 /** \brief The top-state.
@@ -230,6 +230,44 @@ typedef struct QActiveTag {
     * \sa QF_post()
     */
     void QActive_postISR(QActive *me, QSignal sig, QParam par);
+
+#if (Q_PARAM_SIZE > 1)
+    /** \brief Bit position of the skipped event count in the parameter of
+    * an event posted with QActive_postLatest() or QActive_postLatestISR().
+    */
+    #define QF_LATEST_SHIFT         ((Q_PARAM_SIZE * 8) - 8)
+
+    /** \brief The value part of a "latest value" event parameter. */
+    #define QF_LATEST_VALUE(par_) \
+        ((QParam)(par_) & (((QParam)1 << QF_LATEST_SHIFT) - (QParam)1))
+
+    /** \brief The number of events that were overwritten by this one. */
+    #define QF_LATEST_SKIPPED(par_) \
+        ((uint8_t)((QParam)(par_) >> QF_LATEST_SHIFT))
+
+    /** \brief Posts an event to the active object \a me, replacing an
+    * event with the same signal if one is still waiting in the queue.
+    *
+    * This is intended for periodic events where only the most recent value
+    * matters, such as clock ticks. When an event is replaced it keeps its
+    * place in the queue, its value becomes \a par, and the count of
+    * skipped events in the top byte of its parameter is incremented
+    * (saturating at 255). The receiver can use QF_LATEST_SKIPPED() to catch
+    * up on the events it missed. A signal posted only this way can occupy
+    * at most one place in the queue, so it can never fill the queue.
+    *
+    * The top byte of \a par is ignored.
+    *
+    * \note This function is intended only to be used at the task level.
+    */
+    void QActive_postLatest(QActive *me, QSignal sig, QParam par);
+
+    /** \brief The ISR version of QActive_postLatest().
+    *
+    * \note This function assumes that interrupts do not nest.
+    */
+    void QActive_postLatestISR(QActive *me, QSignal sig, QParam par);
+#endif
 #else
     void QActive_post(QActive *me, QSignal sig);
     void QActive_postISR(QActive *me, QSignal sig);
@@ -284,16 +322,22 @@ typedef struct QActiveTag {
         do {                                                \
             QF_INT_LOCK();                                  \
             (me_)->tickCtr = (QTimeEvtCtr)(tout_);          \
-            if (sig) {                                      \
+            if (sig_) {                                     \
                 (me_)->timerSig = (QSignal)(sig_);          \
             }                                               \
+            if ((me_)->tickCtr != (QTimeEvtCtr)0) {         \
+                QF_timerSet_ |= (uint8_t)(1U << ((me_)->prio - 1)); \
+            }                                               \
+            else {                                          \
+                QF_timerSet_ &= (uint8_t)~(1U << ((me_)->prio - 1)); \
+            }                                               \
             QF_INT_UNLOCK();                                \
         } while (0)
 
 
-    /** \brief Disarm a time event. Since the tick counter
-    * is a single byte in this case, the time event can be atomically
-    * disarmed without using a critical section.
+    /** \brief Disarm a time event. The tick counter is a single byte in
+    * this case, but QF_timerSet_ has to be updated with it, so this is
+    * still done in a critical section.
     *
     * The time event of the active object \param me_ gets disarmed (stopped).
     *
@@ -301,7 +345,13 @@ typedef struct QActiveTag {
     * arrive after you disarm the time event. The timeout evetn could be
     * already in the event queue.
     */
-    #define QActive_disarm(me_)     ((me_)->tickCtr = (QTimeEvtCtr)0)
+    #define QActive_disarm(me_)                             \
+        do {                                                \
+            QF_INT_LOCK();                                  \
+            (me_)->tickCtr = (QTimeEvtCtr)0;                \
+            QF_timerSet_ &= (uint8_t)~(1U << ((me_)->prio - 1)); \
+            QF_INT_UNLOCK();                                \
+        } while (0)
 
 #else                                            /* multi-byte tick counter */
 
@@ -447,6 +497,29 @@ typedef struct QActiveCBTag {
                                            /** active object control blocks */
 extern QActiveCB const Q_ROM Q_ROM_VAR QF_active[];
 
+#ifndef QF_TRACE_POST      /* if NOT defined, provide the default definitions */
+
+    /** \brief Trace hooks for QF-nano.
+    *
+    * QF_run() and QK_sched_() call QF_TRACE_INIT() or QF_TRACE_DISPATCH()
+    * just before the initial transition of active object \a a_ or the
+    * dispatch of an event to it, and QF_TRACE_DONE() just after.
+    * QActive_post() and QActive_postISR() call QF_TRACE_POST() and
+    * QF_TRACE_POST_ISR() with the receiver \a a_ and the signal \a sig_, and
+    * QActive_postLatest() and QActive_postLatestISR() call QF_TRACE_LATEST()
+    * and QF_TRACE_LATEST_ISR() when they replace an event in the queue. A
+    * port can define all of them to record what the active objects do. By
+    * default they do nothing.
+    */
+    #define QF_TRACE_INIT(a_)                   ((void)0)
+    #define QF_TRACE_DISPATCH(a_)               ((void)0)
+    #define QF_TRACE_DONE(a_)                   ((void)0)
+    #define QF_TRACE_POST(a_, sig_)             ((void)0)
+    #define QF_TRACE_POST_ISR(a_, sig_)         ((void)0)
+    #define QF_TRACE_LATEST(a_, sig_)           ((void)0)
+    #define QF_TRACE_LATEST_ISR(a_, sig_)       ((void)0)
+#endif
+
 /** \brief Ready set of QF-nano.
 *
 * The QF-nano ready set keeps track of active objects that are ready to run.
@@ -459,4 +532,14 @@ extern QActiveCB const Q_ROM Q_ROM_VAR QF_active[];
 */
 extern uint8_t volatile QF_readySet_;
 
+#if (QF_TIMEEVT_CTR_SIZE != 0)
+/** \brief Timer set of QF-nano.
+*
+* Like the ready set, but a bit is set if the corresponding active object
+* has its time event armed (a non-zero tickCtr). QF_tickISR() only looks at
+* those active objects, instead of reading every one out of QF_active[].
+*/
+extern uint8_t volatile QF_timerSet_;
+#endif
+
 #endif                                                             /* qfn_h */
@@ -0,0 +1,78 @@
+/*****************************************************************************
+* Product: QK-nano public interface
+*
+* A small preemptive run-to-completion kernel for QF-nano, following the
+* interface of the QK-nano kernel from Quantum Leaps.  Only used when
+* QK_PREEMPTIVE is defined.
+*****************************************************************************/
+#ifndef qkn_h
+#define qkn_h
+
+/**
+* \file
+* \ingroup qkn
+* \brief Public QK-nano interface.
+*
+* This header file is included from qpn_port.h when QK_PREEMPTIVE is
+* defined.  QF_run() is then provided by qkn.c instead of qfn.c.
+*/
+
+/** \brief Priority of the currently running active object, or zero when
+* the kernel is idle.
+*
+* Before QF_run() starts the kernel this is (QF_MAX_ACTIVE + 1), so no
+* events are dispatched while the active objects are being initialised.
+*/
+extern uint8_t volatile QK_currPrio_;
+
+/** \brief Find the highest priority active object that is ready to run and
+* has a higher priority than the current one.
+*
+* \return the priority, or zero if nothing should preempt the current
+* active object.
+*
+* \note Must be called with interrupts locked.
+*/
+uint8_t QK_schedPrio_(void);
+
+/** \brief Run all active objects that are ready and have a higher priority
+* than the current one, starting with priority \a p.
+*
+* Interrupts are unlocked while each event is dispatched, and locked again
+* on return.
+*
+* \note Must be called with interrupts locked.
+*/
+void QK_sched_(uint8_t p);
+
+/** \brief Called repeatedly by QF_run() when there is nothing to do.
+*
+* Called with interrupts unlocked.  Every event is dispatched either by the
+* active object that posted it, or at the end of the interrupt that posted
+* it (see QK_ISR_EXIT()), so there is nothing left to check here before
+* putting the CPU to sleep.
+*/
+void QK_onIdle(void);
+
+#ifndef QK_NO_MUTEX
+    /** \brief The saved priority returned by QK_mutexLock(). */
+    typedef uint8_t QMutex;
+
+    /** \brief Stop active objects with priorities up to \a prioCeiling from
+    * preempting the current one.
+    *
+    * Use this to share a resource between active objects of different
+    * priorities.  \a prioCeiling should be the highest priority of the
+    * active objects that use the resource.  Interrupts are not affected.
+    *
+    * \note Must be called at the task level with interrupts unlocked.
+    */
+    QMutex QK_mutexLock(uint8_t prioCeiling);
+
+    /** \brief Undo QK_mutexLock(), and run anything that became ready while
+    * the mutex was locked.
+    */
+    void QK_mutexUnlock(QMutex mutex);
+#endif
+
+#endif                                                             /* qkn_h */
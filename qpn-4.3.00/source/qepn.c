@@ -43,6 +43,60 @@ Q_DEFINE_THIS_MODULE(qepn)
 /** maximum depth of state nesting (including the top level), must be >= 2 */
 #define QEP_MAX_NEST_DEPTH_   5
 
+#if defined(QEP_TRAN_CACHE) && !defined(Q_NHSM)
+
+/** size of a transition path, with room for the states exited after the
+* states entered
+*/
+#define QEP_TRAN_PATH_        (2 * QEP_MAX_NEST_DEPTH_)
+
+/** \brief A transition path found by QHsm_dispatch().
+*
+* The states exited and entered on the way from the current state to the
+* target depend only on the current state, the source and the target, unless
+* a superstate on the way is chosen with Q_SUPER_DYNAMIC(). The first time a
+* transition is taken, its path is found by asking each state for its
+* superstate and kept here, and after that it is played back without asking.
+*/
+typedef struct QEPTranTag {
+    QStateHandler leaf;           /**< current state when the event came in */
+    QStateHandler source;               /**< state that took the transition */
+    QStateHandler target;                     /**< target of the transition */
+    int8_t ip;                       /**< index of the first state to enter */
+    QStateHandler path[QEP_TRAN_PATH_];     /**< entry path, then exit path */
+} QEPTran;
+
+                      /** the transition cache, looked up by QEP_TRAN_HASH_ */
+static QEPTran l_tranCache[QEP_TRAN_CACHE_SIZE];
+static uint16_t l_tranCacheHits;        /**< transitions found in the cache */
+static uint16_t l_tranCacheMisses;  /**< transitions not found in the cache */
+
+/** cache index of the transition from \a s_ to \a t_ in current state \a l_
+* (the leaf is often the source, so they are not simply XORed)
+*/
+#define QEP_TRAN_HASH_(l_, s_, t_) \
+    ((uint8_t)((uint8_t)(uintptr_t)(l_) \
+               ^ (uint8_t)((uint8_t)(uintptr_t)(s_) >> 2) \
+               ^ (uint8_t)((uint8_t)(uintptr_t)(t_) << 1)) \
+     & (uint8_t)(QEP_TRAN_CACHE_SIZE - 1))
+
+/** store the state \a state_ exited on the way in the exit path */
+#define QEP_TRAN_EXIT_(state_) do { \
+    Q_ASSERT(ie < (int8_t)(QEP_TRAN_PATH_ - 1)); \
+    path[ie] = (state_); \
+    ++ie; \
+} while (0)
+
+#else
+
+/** size of a transition path */
+#define QEP_TRAN_PATH_        QEP_MAX_NEST_DEPTH_
+
+/** without QEP_TRAN_CACHE, the states exited are not stored */
+#define QEP_TRAN_EXIT_(state_) ((void)0)
+
+#endif
+
 /*..........................................................................*/
 /*lint -e970 -e971 */      /* ignore MISRA rules 13 and 14 in this function */
 char const Q_ROM * Q_ROM_VAR QP_getVersion(void) {
@@ -64,6 +118,7 @@ void QFsm_init(QFsm *me) {
     (void)(*me->state)(me);      /* execute the top-most initial transition */
 
     Q_SIG(me) = (QSignal)Q_ENTRY_SIG;
+    QEP_TRACE_ENTRY(me->state);
     (void)(*me->state)(me);                             /* enter the target */
 }
 /*..........................................................................*/
@@ -75,10 +130,13 @@ void QFsm_dispatch(QFsm *me) Q_REENTRANT {
     QStateHandler s = me->state;
 
     if ((*s)(me) == Q_RET_TRAN) {                      /* transition taken? */
+        QEP_TRACE_TRAN(s, me->state);
         Q_SIG(me) = (QSignal)Q_EXIT_SIG;
+        QEP_TRACE_EXIT(s);
         (void)(*s)(me);                                  /* exit the source */
 
         Q_SIG(me) = (QSignal)Q_ENTRY_SIG;
+        QEP_TRACE_ENTRY(me->state);
         (void)(*me->state)(me);                         /* enter the target */
     }
 }
@@ -115,6 +173,7 @@ void QHsm_init(QHsm *me) {
 
         Q_SIG(me) = (QSignal)Q_ENTRY_SIG;
         do {        /* retrace the entry path in reverse (correct) order... */
+            QEP_TRACE_ENTRY(path[ip]);
             (void)(*path[ip])(me);                        /* enter path[ip] */
             --ip;
         } while (ip >= (int8_t)0);
@@ -124,154 +183,254 @@ void QHsm_init(QHsm *me) {
     } while ((*t)(me) == Q_RET_TRAN);        /* initial transition handled? */
     me->state = t;
 }
+#ifdef QEP_TRAN_CACHE
+/*..........................................................................*/
+void QHsm_getTranCacheStats(uint16_t *hits, uint16_t *misses) {
+    QF_INT_LOCK();
+    *hits = l_tranCacheHits;
+    *misses = l_tranCacheMisses;
+    QF_INT_UNLOCK();
+}
+#endif
 /*..........................................................................*/
+/* Find the way from the current state path[1] to the target path[0] of a
+* transition taken by the source state s, and exit the states on the way.
+* Returns the index of the last state to enter in path[]. With
+* QEP_TRAN_CACHE, the states exited are also stored from
+* path[QEP_MAX_NEST_DEPTH_] on, ending with a NULL.
+*/
 #ifndef QK_PREEMPTIVE
-void QHsm_dispatch(QHsm *me) {
+static int8_t QHsm_tran_(QHsm *me, QStateHandler path[], QStateHandler s) {
 #else
-void QHsm_dispatch(QHsm *me) Q_REENTRANT {
+static int8_t QHsm_tran_(QHsm *me, QStateHandler path[], QStateHandler s)
+    Q_REENTRANT {
 #endif
-    QStateHandler path[QEP_MAX_NEST_DEPTH_];
-    QStateHandler s;
-    QStateHandler t;
+    int8_t ip = (int8_t)(-1);                /* transition entry path index */
+    int8_t iq;                        /* helper transition entry path index */
+    QStateHandler t = path[1];
     QState r;
+#ifdef QEP_TRAN_CACHE
+    int8_t ie = (int8_t)QEP_MAX_NEST_DEPTH_;       /* exit path store index */
+#endif
 
-    t = me->state;                                /* save the current state */
-
-    do {                             /* process the event hierarchically... */
-        s = me->state;
-        r = (*s)(me);                             /* invoke state handler s */
-    } while (r == Q_RET_SUPER);
-
-    if (r == Q_RET_TRAN) {                             /* transition taken? */
-        int8_t ip = (int8_t)(-1);            /* transition entry path index */
-        int8_t iq;                    /* helper transition entry path index */
-
-        path[0] = me->state;           /* save the target of the transition */
-        path[1] = t;
-
-        while (t != s) {    /* exit current state to transition source s... */
-            Q_SIG(me) = (QSignal)Q_EXIT_SIG;        /* find superstate of t */
-            if ((*t)(me) == Q_RET_HANDLED) {        /* exit action handled? */
-                Q_SIG(me) = (QSignal)QEP_EMPTY_SIG_;
-                (void)(*t)(me);                     /* find superstate of t */
-            }
-            t = me->state;                /* me->state holds the superstate */
+    while (t != s) {        /* exit current state to transition source s... */
+        Q_SIG(me) = (QSignal)Q_EXIT_SIG;            /* find superstate of t */
+        QEP_TRACE_EXIT(t);
+        QEP_TRAN_EXIT_(t);
+        if ((*t)(me) == Q_RET_HANDLED) {            /* exit action handled? */
+            Q_SIG(me) = (QSignal)QEP_EMPTY_SIG_;
+            (void)(*t)(me);                         /* find superstate of t */
         }
+        t = me->state;                    /* me->state holds the superstate */
+    }
 
-        t = path[0];                            /* target of the transition */
+    t = path[0];                                /* target of the transition */
 
-        if (s == t) {      /* (a) check source==target (transition to self) */
-            Q_SIG(me) = (QSignal)Q_EXIT_SIG;
-            (void)(*s)(me);                              /* exit the source */
+    if (s == t) {          /* (a) check source==target (transition to self) */
+        Q_SIG(me) = (QSignal)Q_EXIT_SIG;
+        QEP_TRACE_EXIT(s);
+        QEP_TRAN_EXIT_(s);
+        (void)(*s)(me);                                  /* exit the source */
+        ip = (int8_t)0;                                 /* enter the target */
+    }
+    else {
+        Q_SIG(me) = (QSignal)QEP_EMPTY_SIG_;
+        (void)(*t)(me);                        /* find superstate of target */
+        t = me->state;
+        if (s == t) {                    /* (b) check source==target->super */
             ip = (int8_t)0;                             /* enter the target */
         }
         else {
             Q_SIG(me) = (QSignal)QEP_EMPTY_SIG_;
-            (void)(*t)(me);                    /* find superstate of target */
-            t = me->state;
-            if (s == t) {                /* (b) check source==target->super */
+            (void)(*s)(me);                    /* find superstate of source */
+
+                                  /* (c) check source->super==target->super */
+            if (me->state == t) {
+                Q_SIG(me) = (QSignal)Q_EXIT_SIG;
+                QEP_TRACE_EXIT(s);
+                QEP_TRAN_EXIT_(s);
+                (void)(*s)(me);                          /* exit the source */
                 ip = (int8_t)0;                         /* enter the target */
             }
             else {
-                Q_SIG(me) = (QSignal)QEP_EMPTY_SIG_;
-                (void)(*s)(me);                /* find superstate of source */
-
-                                  /* (c) check source->super==target->super */
-                if (me->state == t) {
+                                         /* (d) check source->super==target */
+                if (me->state == path[0]) {
                     Q_SIG(me) = (QSignal)Q_EXIT_SIG;
+                    QEP_TRACE_EXIT(s);
+                    QEP_TRAN_EXIT_(s);
                     (void)(*s)(me);                      /* exit the source */
-                    ip = (int8_t)0;                     /* enter the target */
                 }
-                else {
-                                         /* (d) check source->super==target */
-                    if (me->state == path[0]) {
-                        Q_SIG(me) = (QSignal)Q_EXIT_SIG;
-                        (void)(*s)(me);                  /* exit the source */
-                    }
-                    else { /* (e) check rest of source==target->super->super..
-                            * and store the entry path along the way
-                            */
-                        iq = (int8_t)0;      /* indicate that LCA not found */
-                        ip = (int8_t)1;  /* enter target and its superstate */
-                        path[1] = t;       /* save the superstate of target */
-                        t = me->state;                /* save source->super */
-
-                        Q_SIG(me) = (QSignal)QEP_EMPTY_SIG_;
-                        r = (*path[1])(me);    /* find target->super->super */
-                        while (r == Q_RET_SUPER) {
-                            path[++ip] = me->state; /* store the entry path */
-                            if (me->state == s) {      /* is it the source? */
-                                iq = (int8_t)1;  /* indicate that LCA found */
+                else { /* (e) check rest of source==target->super->super..
+                        * and store the entry path along the way
+                        */
+                    iq = (int8_t)0;          /* indicate that LCA not found */
+                    ip = (int8_t)1;      /* enter target and its superstate */
+                    path[1] = t;           /* save the superstate of target */
+                    t = me->state;                    /* save source->super */
+
+                    Q_SIG(me) = (QSignal)QEP_EMPTY_SIG_;
+                    r = (*path[1])(me);        /* find target->super->super */
+                    while (r == Q_RET_SUPER) {
+                        path[++ip] = me->state;     /* store the entry path */
+                        if (me->state == s) {          /* is it the source? */
+                            iq = (int8_t)1;      /* indicate that LCA found */
                                             /* entry path must not overflow */
-                                Q_ASSERT(ip < (int8_t)QEP_MAX_NEST_DEPTH_);
-                                --ip;            /* do not enter the source */
-                                r = Q_RET_HANDLED;    /* terminate the loop */
-                            }
-                            else {   /* it is not the source, keep going up */
-                                r = (*me->state)(me);    /* superstate of t */
-                            }
+                            Q_ASSERT(ip < (int8_t)QEP_MAX_NEST_DEPTH_);
+                            --ip;                /* do not enter the source */
+                            r = Q_RET_HANDLED;        /* terminate the loop */
+                        }
+                        else {       /* it is not the source, keep going up */
+                            r = (*me->state)(me);        /* superstate of t */
                         }
-                        if (iq == (int8_t)0) {    /* the LCA not found yet? */
+                    }
+                    if (iq == (int8_t)0) {        /* the LCA not found yet? */
 
                                             /* entry path must not overflow */
-                            Q_ASSERT(ip < (int8_t)QEP_MAX_NEST_DEPTH_);
+                        Q_ASSERT(ip < (int8_t)QEP_MAX_NEST_DEPTH_);
 
-                            Q_SIG(me) = (QSignal)Q_EXIT_SIG;
-                            (void)(*s)(me);              /* exit the source */
+                        Q_SIG(me) = (QSignal)Q_EXIT_SIG;
+                        QEP_TRACE_EXIT(s);
+                        QEP_TRAN_EXIT_(s);
+                        (void)(*s)(me);                  /* exit the source */
 
-                                /* (f) check the rest of source->super
-                                 *                  == target->super->super...
+                            /* (f) check the rest of source->super
+                             *                  == target->super->super...
+                             */
+                        iq = ip;
+                        r = Q_RET_IGNORED;        /* indicate LCA NOT found */
+                        do {
+                            s = path[iq];
+                            if (t == s) {               /* is this the LCA? */
+                                r = Q_RET_HANDLED;    /* indicate LCA found */
+                                ip = (int8_t)(iq - 1);    /*do not enter LCA*/
+                                iq = (int8_t)(-1);    /* terminate the loop */
+                            }
+                            else {
+                                --iq;     /* try lower superstate of target */
+                            }
+                        } while (iq >= (int8_t)0);
+
+                        if (r != Q_RET_HANDLED) {     /* LCA not found yet? */
+                                /* (g) check each source->super->...
+                                 * for each target->super...
                                  */
-                            iq = ip;
-                            r = Q_RET_IGNORED;    /* indicate LCA NOT found */
+                            r = Q_RET_IGNORED;              /* keep looping */
                             do {
-                                s = path[iq];
-                                if (t == s) {           /* is this the LCA? */
-                                    r = Q_RET_HANDLED;/* indicate LCA found */
-                                    ip = (int8_t)(iq - 1);/*do not enter LCA*/
-                                    iq = (int8_t)(-1);/* terminate the loop */
-                                }
-                                else {
-                                    --iq; /* try lower superstate of target */
+                                                       /* exit t unhandled? */
+                                Q_SIG(me) = (QSignal)Q_EXIT_SIG;
+                                QEP_TRACE_EXIT(t);
+                                QEP_TRAN_EXIT_(t);
+                                if ((*t)(me) == Q_RET_HANDLED) {
+                                    Q_SIG(me) = (QSignal)QEP_EMPTY_SIG_;
+                                    (void)(*t)(me);      /* find super of t */
                                 }
-                            } while (iq >= (int8_t)0);
-
-                            if (r != Q_RET_HANDLED) { /* LCA not found yet? */
-                                    /* (g) check each source->super->...
-                                     * for each target->super...
-                                     */
-                                r = Q_RET_IGNORED;          /* keep looping */
+                                t = me->state;        /*  set to super of t */
+                                iq = ip;
                                 do {
-                                                       /* exit t unhandled? */
-                                    Q_SIG(me) = (QSignal)Q_EXIT_SIG;
-                                    if ((*t)(me) == Q_RET_HANDLED) {
-                                        Q_SIG(me) = (QSignal)QEP_EMPTY_SIG_;
-                                        (void)(*t)(me);  /* find super of t */
-                                    }
-                                    t = me->state;    /*  set to super of t */
-                                    iq = ip;
-                                    do {
-                                        s = path[iq];
-                                        if (t == s) {       /* is this LCA? */
+                                    s = path[iq];
+                                    if (t == s) {           /* is this LCA? */
                                                         /* do not enter LCA */
-                                            ip = (int8_t)(iq - 1);
-                                            iq = (int8_t)(-1);/*break inner */
-                                            r = Q_RET_HANDLED;/*break outer */
-                                        }
-                                        else {
-                                            --iq;
-                                        }
-                                    } while (iq >= (int8_t)0);
-                                } while (r != Q_RET_HANDLED);
-                            }
+                                        ip = (int8_t)(iq - 1);
+                                        iq = (int8_t)(-1);    /*break inner */
+                                        r = Q_RET_HANDLED;    /*break outer */
+                                    }
+                                    else {
+                                        --iq;
+                                    }
+                                } while (iq >= (int8_t)0);
+                            } while (r != Q_RET_HANDLED);
                         }
                     }
                 }
             }
         }
+    }
+#ifdef QEP_TRAN_CACHE
+    path[ie] = (QStateHandler)0;                    /* end of the exit path */
+#endif
+    return ip;
+}
+/*..........................................................................*/
+#ifndef QK_PREEMPTIVE
+void QHsm_dispatch(QHsm *me) {
+#else
+void QHsm_dispatch(QHsm *me) Q_REENTRANT {
+#endif
+    QStateHandler path[QEP_TRAN_PATH_];
+    QStateHandler s;
+    QStateHandler t;
+    QState r;
+
+    t = me->state;                                /* save the current state */
+
+    do {                             /* process the event hierarchically... */
+        s = me->state;
+        r = (*s)(me);                             /* invoke state handler s */
+    } while (r == Q_RET_SUPER);
+
+    if (r == Q_RET_TRAN) {                             /* transition taken? */
+        int8_t ip;                           /* transition entry path index */
+#ifdef QEP_TRAN_CACHE
+        QEPTran *c;
+        uint8_t hit = (uint8_t)0;
+        uint8_t i;
+#endif
+
+        QEP_TRACE_TRAN(s, me->state);
+
+        path[0] = me->state;           /* save the target of the transition */
+        path[1] = t;
+
+#ifdef QEP_TRAN_CACHE
+        c = &l_tranCache[QEP_TRAN_HASH_(t, s, path[0])];
+        QF_INT_LOCK();           /* a preempting dispatch may use the cache */
+        if ((c->leaf == t) && (c->source == s) && (c->target == path[0])) {
+            for (i = (uint8_t)0; i < (uint8_t)QEP_TRAN_PATH_; ++i) {
+                path[i] = c->path[i];
+            }
+            ip = c->ip;
+            hit = (uint8_t)1;
+            ++l_tranCacheHits;
+        }
+        else {
+            ++l_tranCacheMisses;
+        }
+        QF_INT_UNLOCK();
+
+        if (hit != (uint8_t)0) {    /* replay the exits found the last time */
+            int8_t ie;
+
+            Q_SIG(me) = (QSignal)Q_EXIT_SIG;
+            for (ie = (int8_t)QEP_MAX_NEST_DEPTH_;
+                 path[ie] != (QStateHandler)0;
+                 ++ie)
+            {
+                QEP_TRACE_EXIT(path[ie]);
+                (void)(*path[ie])(me);                     /* exit path[ie] */
+            }
+        }
+        else {
+            me->dynSuper = (uint8_t)0;
+            ip = QHsm_tran_(me, path, s);
+            if (me->dynSuper == (uint8_t)0) {  /* the same path every time? */
+                QF_INT_LOCK();
+                c->leaf = t;
+                c->source = s;
+                c->target = path[0];
+                c->ip = ip;
+                for (i = (uint8_t)0; i < (uint8_t)QEP_TRAN_PATH_; ++i) {
+                    c->path[i] = path[i];
+                }
+                QF_INT_UNLOCK();
+            }
+        }
+#else
+        ip = QHsm_tran_(me, path, s);
+#endif
                     /* retrace the entry path in reverse (desired) order... */
         Q_SIG(me) = (QSignal)Q_ENTRY_SIG;
         for (; ip >= (int8_t)0; --ip) {
+            QEP_TRACE_ENTRY(path[ip]);
             (void)(*path[ip])(me);                        /* enter path[ip] */
         }
         t = path[0];                      /* stick the target into register */
@@ -296,6 +455,7 @@ void QHsm_dispatch(QHsm *me) Q_REENTRANT {
 
             Q_SIG(me) = (QSignal)Q_ENTRY_SIG;
             do {    /* retrace the entry path in reverse (correct) order... */
+                QEP_TRACE_ENTRY(path[ip]);
                 (void)(*path[ip])(me);                    /* enter path[ip] */
                 --ip;
             } while (ip >= (int8_t)0);
@@ -37,6 +37,9 @@ Q_DEFINE_THIS_MODULE(qfn)
 
 /* Global-scope objects ----------------------------------------------------*/
 uint8_t volatile QF_readySet_;                      /* ready-set of QF-nano */
+#if (QF_TIMEEVT_CTR_SIZE != 0)
+uint8_t volatile QF_timerSet_;        /* active objects with armed timers */
+#endif
 
 /* local objects -----------------------------------------------------------*/
 static uint8_t const Q_ROM Q_ROM_VAR l_pow2Lkup[] = {
@@ -56,6 +59,7 @@ void QActive_post(QActive *me, QSignal sig)
     Q_ASSERT(me->nUsed < Q_ROM_BYTE(ao->end));
 
     QF_INT_LOCK();
+    QF_TRACE_POST(me, sig);
                                 /* insert event into the ring buffer (FIFO) */
     ((QEvent *)Q_ROM_PTR(ao->queue))[me->head].sig = sig;
 #if (Q_PARAM_SIZE != 0)
@@ -101,6 +105,7 @@ void QActive_postISR(QActive *me, QSignal sig)
     QF_INT_LOCK();
 #endif
 #endif
+    QF_TRACE_POST_ISR(me, sig);
                                 /* insert event into the ring buffer (FIFO) */
     ((QEvent *)Q_ROM_PTR(ao->queue))[me->head].sig = sig;
 #if (Q_PARAM_SIZE != 0)
@@ -124,18 +129,81 @@ void QActive_postISR(QActive *me, QSignal sig)
 #endif
 }
 
+#if (Q_PARAM_SIZE > 1)
+/*..........................................................................*/
+/* Replace the first waiting event with signal 'sig' in the queue of 'me'.
+* Must be called with interrupts locked. Returns 1 if an event was replaced,
+* or 0 if there was no such event.
+*/
+static uint8_t l_coalesce(QActive *me, QSignal sig, QParam par) {
+    QActiveCB const Q_ROM *ao = &QF_active[me->prio];
+    QEvent *q = (QEvent *)Q_ROM_PTR(ao->queue);
+    uint8_t i = me->tail;            /* the next event to be dispatched */
+    uint8_t n = me->nUsed;
+    uint8_t skipped;
+
+    while (n != (uint8_t)0) {
+        if (q[i].sig == sig) {
+            skipped = QF_LATEST_SKIPPED(q[i].par);
+            if (skipped != (uint8_t)0xFF) {       /* saturate the count */
+                ++skipped;
+            }
+            q[i].par = QF_LATEST_VALUE(par)
+                       | ((QParam)skipped << QF_LATEST_SHIFT);
+            return (uint8_t)1;
+        }
+        if (i == (uint8_t)0) {
+            i = Q_ROM_BYTE(ao->end);                      /* wrap around */
+        }
+        --i;
+        --n;
+    }
+    return (uint8_t)0;
+}
+/*..........................................................................*/
+void QActive_postLatest(QActive *me, QSignal sig, QParam par) {
+    uint8_t replaced;
+
+    QF_INT_LOCK();
+    replaced = l_coalesce(me, sig, par);
+    if (replaced != (uint8_t)0) {
+        QF_TRACE_LATEST(me, sig);
+    }
+    QF_INT_UNLOCK();
+    /* If an ISR posts the same signal before we get to post ours, there will
+    * be two events in the queue. Each carries its own skipped count, so the
+    * receiver still sees every event. */
+    if (replaced == (uint8_t)0) {
+        QActive_post(me, sig, QF_LATEST_VALUE(par));
+    }
+}
+/*..........................................................................*/
+void QActive_postLatestISR(QActive *me, QSignal sig, QParam par) {
+    if (l_coalesce(me, sig, par) == (uint8_t)0) {
+        QActive_postISR(me, sig, QF_LATEST_VALUE(par));
+    }
+    else {
+        QF_TRACE_LATEST_ISR(me, sig);
+    }
+}
+#endif                                          /* #if (Q_PARAM_SIZE > 1) */
+
 /*--------------------------------------------------------------------------*/
 #if (QF_TIMEEVT_CTR_SIZE != 0)
 
 /*..........................................................................*/
 void QF_tickISR(void) {
-    uint8_t p = (uint8_t)QF_MAX_ACTIVE;
-    QActiveCB const Q_ROM *ao = &QF_active[(uint8_t)QF_MAX_ACTIVE];
-    do {
-        QActive *a = (QActive *)Q_ROM_PTR(ao->act);
-        if (a->tickCtr != (QTimeEvtCtr)0) {
+    uint8_t set = QF_timerSet_;
+    uint8_t bit = (uint8_t)1;
+    uint8_t p = (uint8_t)1;
+                   /* only look at the active objects with a timer armed... */
+    while (set != (uint8_t)0) {
+        if ((set & bit) != (uint8_t)0) {
+            QActive *a = (QActive *)Q_ROM_PTR(QF_active[p].act);
+            set &= (uint8_t)~bit;
             --a->tickCtr;
             if (a->tickCtr == (QTimeEvtCtr)0) {
+                QF_timerSet_ &= (uint8_t)~bit;             /* disarmed now */
 #if (Q_PARAM_SIZE != 0)
     QActiveCB const Q_ROM *ao = &QF_active[a->prio];
     Q_ASSERT(a->nUsed < Q_ROM_BYTE(ao->end));
@@ -145,32 +213,37 @@ void QF_tickISR(void) {
 #endif
             }
         }
-        --ao;
-        --p;
-    } while (p != (uint8_t)0);
+        bit <<= 1;
+        ++p;
+    }
 }
 
 #if (QF_TIMEEVT_CTR_SIZE > 1)
 /*..........................................................................*/
 void QActive_arm(QActive *me, QTimeEvtCtr tout) {
-    QF_INT_LOCK();
-    me->tickCtr = tout;
-    me->timerSig = Q_TIMEOUT_SIG;
-    QF_INT_UNLOCK();
+    QActive_arm_sig(me, tout, Q_TIMEOUT_SIG);
 }
 /*..........................................................................*/
 void QActive_arm_sig(QActive *me, QTimeEvtCtr tout, QSignal sig) {
+    Q_ASSERT(me->prio != (uint8_t)0);      /* must be started by QF_run() */
     QF_INT_LOCK();
     me->tickCtr = tout;
     if (sig) {
         me->timerSig = sig;
     }
+    if (tout != (QTimeEvtCtr)0) {
+        QF_timerSet_ |= Q_ROM_BYTE(l_pow2Lkup[me->prio]);
+    }
+    else {
+        QF_timerSet_ &= (uint8_t)~Q_ROM_BYTE(l_pow2Lkup[me->prio]);
+    }
     QF_INT_UNLOCK();
 }
 /*..........................................................................*/
 void QActive_disarm(QActive *me) {
     QF_INT_LOCK();
     me->tickCtr = (QTimeEvtCtr)0;
+    QF_timerSet_ &= (uint8_t)~Q_ROM_BYTE(l_pow2Lkup[me->prio]);
     QF_INT_UNLOCK();
 }
 #endif                                     /* #if (QF_TIMEEVT_CTR_SIZE > 1) */
@@ -200,11 +273,13 @@ void QF_run(void) {
          /* trigger initial transitions in all registered active objects... */
     for (p = (uint8_t)1; p <= (uint8_t)QF_MAX_ACTIVE; ++p) {
         a = (QActive *)Q_ROM_PTR(QF_active[p].act);
+        QF_TRACE_INIT(a);
 #ifndef QF_FSM_ACTIVE
         QHsm_init((QHsm *)a);         /* take the initial transition in HSM */
 #else
         QFsm_init((QFsm *)a);         /* take the initial transition in FSM */
 #endif
+        QF_TRACE_DONE(a);
     }
 
     QF_onStartup();                              /* invoke startup callback */
@@ -240,11 +315,13 @@ void QF_run(void) {
             --a->tail;
             QF_INT_UNLOCK();
 
+            QF_TRACE_DISPATCH(a);
 #ifndef QF_FSM_ACTIVE
             QHsm_dispatch((QHsm *)a);                    /* dispatch to HSM */
 #else
             QFsm_dispatch((QFsm *)a);                    /* dispatch to FSM */
 #endif
+            QF_TRACE_DONE(a);
         }
         else {
             QF_onIdle();                                      /* see NOTE01 */
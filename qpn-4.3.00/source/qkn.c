@@ -0,0 +1,159 @@
+/*****************************************************************************
+* Product: QK-nano implementation
+*
+* A small preemptive run-to-completion kernel for QF-nano, following the
+* interface of the QK-nano kernel from Quantum Leaps.  Only used when
+* QK_PREEMPTIVE is defined.
+*****************************************************************************/
+#include "qpn_port.h"                                       /* QP-nano port */
+
+Q_DEFINE_THIS_MODULE(qkn)
+
+/**
+* \file
+* \ingroup qkn
+* QK-nano implementation.
+*/
+
+#ifndef QK_PREEMPTIVE
+    #error "qkn.c must only be compiled with QK_PREEMPTIVE defined"
+#endif
+
+/* Global-scope objects ----------------------------------------------------*/
+                       /* no dispatching until QF_run() starts the kernel */
+uint8_t volatile QK_currPrio_ = (uint8_t)(QF_MAX_ACTIVE + 1);
+
+/* local objects -----------------------------------------------------------*/
+static uint8_t const Q_ROM Q_ROM_VAR l_log2Lkup[] = {
+    0U, 1U, 2U, 2U, 3U, 3U, 3U, 3U, 4U, 4U, 4U, 4U, 4U, 4U, 4U, 4U
+};
+static uint8_t const Q_ROM Q_ROM_VAR l_invPow2Lkup[] = {
+    0xFFU, 0xFEU, 0xFDU, 0xFBU, 0xF7U, 0xEFU, 0xDFU, 0xBFU, 0x7FU
+};
+
+/*..........................................................................*/
+void QF_run(void) {
+    uint8_t p;
+    QActive *a;
+
+                         /* set priorities all registered active objects... */
+    for (p = (uint8_t)1; p <= (uint8_t)QF_MAX_ACTIVE; ++p) {
+        a = (QActive *)Q_ROM_PTR(QF_active[p].act);
+        Q_ASSERT(a != (QActive *)0);    /* QF_active[p] must be initialized */
+        a->prio = p;               /* set the priority of the active object */
+    }
+         /* trigger initial transitions in all registered active objects... */
+    for (p = (uint8_t)1; p <= (uint8_t)QF_MAX_ACTIVE; ++p) {
+        a = (QActive *)Q_ROM_PTR(QF_active[p].act);
+        QF_TRACE_INIT(a);
+#ifndef QF_FSM_ACTIVE
+        QHsm_init((QHsm *)a);         /* take the initial transition in HSM */
+#else
+        QFsm_init((QFsm *)a);         /* take the initial transition in FSM */
+#endif
+        QF_TRACE_DONE(a);
+    }
+
+    QF_onStartup();           /* invoke startup callback, unlocks interrupts */
+
+    QF_INT_LOCK();
+    QK_currPrio_ = (uint8_t)0;                     /* start the kernel... */
+    p = QK_schedPrio_();          /* ...and run anything posted so far */
+    if (p != (uint8_t)0) {
+        QK_sched_(p);
+    }
+    QF_INT_UNLOCK();
+
+    for (;;) {                                      /* the QK-nano idle loop */
+        QK_onIdle();
+    }
+}
+/*..........................................................................*/
+uint8_t QK_schedPrio_(void) {
+    uint8_t p;
+
+    if (QF_readySet_ == (uint8_t)0) {
+        return (uint8_t)0;
+    }
+#if (QF_MAX_ACTIVE > 4)
+    if ((QF_readySet_ & 0xF0) != 0U) {                /* upper nibble used? */
+        p = (uint8_t)(Q_ROM_BYTE(l_log2Lkup[QF_readySet_ >> 4]) + 4);
+    }
+    else                            /* upper nibble of QF_readySet_ is zero */
+#endif
+    {
+        p = Q_ROM_BYTE(l_log2Lkup[QF_readySet_]);
+    }
+    if (p <= QK_currPrio_) {            /* not higher than the current one? */
+        p = (uint8_t)0;
+    }
+    return p;
+}
+/*..........................................................................*/
+void QK_sched_(uint8_t p) {
+    uint8_t pin = QK_currPrio_;                 /* save the initial priority */
+    QActive *a;
+    QActiveCB const Q_ROM *ao;
+
+    do {
+        ao = &QF_active[p];
+        a = (QActive *)Q_ROM_PTR(ao->act);
+        QK_currPrio_ = p;           /* this is now the current priority */
+
+        Q_ASSERT(a->nUsed > 0);            /* some events must be available */
+        --a->nUsed;
+        if (a->nUsed == (uint8_t)0) {              /* queue becoming empty? */
+            QF_readySet_ &= Q_ROM_BYTE(l_invPow2Lkup[p]);   /* clear the bit */
+        }
+        Q_SIG(a) = ((QEvent *)Q_ROM_PTR(ao->queue))[a->tail].sig;
+#if (Q_PARAM_SIZE != 0)
+        Q_PAR(a) = ((QEvent *)Q_ROM_PTR(ao->queue))[a->tail].par;
+#endif
+        if (a->tail == (uint8_t)0) {                        /* wrap around? */
+            a->tail = Q_ROM_BYTE(ao->end);
+        }
+        --a->tail;
+        QF_INT_UNLOCK();
+
+        QF_TRACE_DISPATCH(a);
+#ifndef QF_FSM_ACTIVE
+        QHsm_dispatch((QHsm *)a);                        /* dispatch to HSM */
+#else
+        QFsm_dispatch((QFsm *)a);                        /* dispatch to FSM */
+#endif
+        QF_TRACE_DONE(a);
+
+        QF_INT_LOCK();
+        QK_currPrio_ = pin;        /* look for anything above the initial */
+        p = QK_schedPrio_();
+    } while (p != (uint8_t)0);
+}
+
+#ifndef QK_NO_MUTEX
+/*..........................................................................*/
+QMutex QK_mutexLock(uint8_t prioCeiling) {
+    QMutex mutex;
+
+    QF_INT_LOCK();
+    mutex = QK_currPrio_;
+    if (QK_currPrio_ < prioCeiling) {
+        QK_currPrio_ = prioCeiling;
+    }
+    QF_INT_UNLOCK();
+    return mutex;
+}
+/*..........................................................................*/
+void QK_mutexUnlock(QMutex mutex) {
+    uint8_t p;
+
+    QF_INT_LOCK();
+    if (QK_currPrio_ > mutex) {
+        QK_currPrio_ = mutex;
+        p = QK_schedPrio_();
+        if (p != (uint8_t)0) {
+            QK_sched_(p);
+        }
+    }
+    QF_INT_UNLOCK();
+}
+#endif                                               /* #ifndef QK_NO_MUTEX */
@@ -39,9 +39,9 @@
 #define QF_TIMEEVT_CTR_SIZE     2 /* 16 bit time counter. */
 
 /* maximum # active objects--must match EXACTLY the QF_active[] definition  */
-#define QF_MAX_ACTIVE           6 /* The decimal clock has these active
-				     objects: buttons, alarm, twi, timekeeper,
-				     timedisplay, timesetter. */
+#define QF_MAX_ACTIVE           7 /* The decimal clock has these active
+				     objects: console, buttons, alarm, twi,
+				     timekeeper, timedisplay, timesetter. */
 
                                /* interrupt locking policy for IAR compiler */
 #define QF_INT_LOCK()           cli()
@@ -54,8 +54,54 @@
 #include <avr/interrupt.h>                                   /* cli()/sei() */
 #include <avr/pgmspace.h> /* accessing data in the program memory (PROGMEM) */
 
+#ifdef STATE_TRACE
+/* Record what the state machines do, for state-trace-render.  See
+   statetrace.h. */
+#define QEP_TRACE_TRAN(source_, target_)				\
+	state_trace_state(STATE_TRACE_TRAN, (source_), (target_))
+#define QEP_TRACE_ENTRY(state_)						\
+	state_trace_state(STATE_TRACE_ENTRY, (state_), 0)
+#define QEP_TRACE_EXIT(state_)						\
+	state_trace_state(STATE_TRACE_EXIT, (state_), 0)
+#define QF_TRACE_INIT(a_)						\
+	state_trace_ao(STATE_TRACE_INIT, (a_), 0)
+#define QF_TRACE_DISPATCH(a_)						\
+	state_trace_ao(STATE_TRACE_DISPATCH, (a_), Q_SIG(a_))
+#define QF_TRACE_DONE(a_)						\
+	state_trace_ao(STATE_TRACE_DONE, (a_), 0)
+#define QF_TRACE_POST(a_, sig_)						\
+	state_trace_ao(STATE_TRACE_POST, (a_), (sig_))
+#define QF_TRACE_POST_ISR(a_, sig_)					\
+	state_trace_ao(STATE_TRACE_POST_ISR, (a_), (sig_))
+#define QF_TRACE_LATEST(a_, sig_)					\
+	state_trace_ao(STATE_TRACE_LATEST, (a_), (sig_))
+#define QF_TRACE_LATEST_ISR(a_, sig_)					\
+	state_trace_ao(STATE_TRACE_LATEST_ISR, (a_), (sig_))
+#endif
+
 #include <stdint.h>    /* Exact-width integer types. WG14/N843 C99 Standard */
 #include "qepn.h"         /* QEP-nano platform-independent public interface */
 #include "qfn.h"           /* QF-nano platform-independent public interface */
 
+#ifdef STATE_TRACE
+#include "statetrace.h"
+#endif
+
+#ifdef QK_PREEMPTIVE
+#include "qkn.h"           /* QK-nano platform-independent public interface */
+
+/* Interrupts don't nest on the AVR, so an ISR only has to run any active
+   objects it made ready before it returns.  QK_sched_() unlocks interrupts
+   while it dispatches, so other interrupts can preempt those objects. */
+#define QK_ISR_EXIT()                           \
+	do {                                    \
+		uint8_t p_ = QK_schedPrio_();   \
+		if (p_ != (uint8_t)0) {         \
+			QK_sched_(p_);          \
+		}                               \
+	} while (0)
+#else
+#define QK_ISR_EXIT()           do { } while (0)
+#endif
+
 #endif                                                        /* qpn_port_h */
@@ -1,6 +1,9 @@
 #include "dclock.h"
 #include "serial.h"
+#include "console.h"
 #include "toggle-pin.h"
+#include "timesync.h"
+#include "time-sync.h"
 #include <util/delay.h>
 #include <avr/wdt.h>
 #include <stdint.h>
@@ -28,6 +31,34 @@ static char sendbuffer[SEND_BUFFER_SIZE];
 static volatile uint8_t sendhead = 0;
 static volatile uint8_t sendtail = 0;
 
+/** The number of times a '!' was sent because the send buffer was full. */
+static volatile uint16_t sendlost = 0;
+
+/** The active object waiting for the send buffer to empty, if any. */
+static QActive * volatile flushActive = 0;
+/** The signal to send to flushActive. */
+static volatile QSignal flushSignal;
+
+/**
+ * @brief The number of received bytes that can wait for the console.
+ *
+ * The console reads them as soon as it gets to run, so this only needs to
+ * cover a line or two sent while the other active objects are busy.
+ *
+ * @note As with the send buffer, one less than this can actually be stored.
+ */
+#define RECV_BUFFER_SIZE 64
+
+static char recvbuffer[RECV_BUFFER_SIZE];
+static volatile uint8_t recvhead = 0;
+static volatile uint8_t recvtail = 0;
+
+/** Bytes dropped because the receive buffer was full. */
+static volatile uint16_t recvlost = 0;
+
+/** Bytes dropped because of framing, overrun or parity errors. */
+static volatile uint16_t recverrors = 0;
+
 
 void
 serial_init(void)
@@ -49,7 +80,7 @@ serial_init(void)
 	UCSR1B =(1<<RXCIE1) |
 		(0<<TXCIE1) |
 		(0<<UDRIE1) |
-		(0<<RXEN1 ) |
+		(1<<RXEN1 ) |
 		(1<<TXEN1 ) |
 		(0<<UCSZ12) |
 		(0<<RXB81 ) |
@@ -64,11 +95,15 @@ serial_init(void)
 		(1<<UCSZ10 ) |
 		(0<<UCPOL1 );
 
-	/* Does the RX pin have to be made input? */
+	/* Does the RX pin have to be made input?  The pullup stops a
+	   disconnected RX line from looking like a stream of bytes. */
 	DDRD &= ~ ( 1 << 2 );
+	PORTD |= ( 1 << 2 );
 
 	sendhead = 0;
 	sendtail = 0;
+	recvhead = 0;
+	recvtail = 0;
 
 	SREG = sreg;
 }
@@ -150,6 +185,25 @@ sendbuffer_space(void)
 }
 
 
+/**
+ * @brief The number of characters that can be sent without losing any.
+ *
+ * This is one less than the space in the buffer, as serial_send_char() sends
+ * a '!' instead of the last character that fits.
+ */
+uint8_t serial_send_space(void)
+{
+	uint8_t space;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	space = sendbuffer_space();
+	SREG = sreg;
+	return space ? space - 1 : 0;
+}
+
+
 /**
  * @brief Put one character into the serial send buffer.
  *
@@ -197,6 +251,7 @@ int serial_send_char(char c)
 	if (available >= 1) {
 		if (available == 1) {
 			put_into_buffer('!');
+			sendlost++;
 			sent = 0;
 		} else {
 			put_into_buffer(c);
@@ -218,13 +273,114 @@ SIGNAL(USART1_UDRE_vect)
 
 	if (sendhead == sendtail) {
 		UCSR1B &= ~ (1 << UDRIE1);
+		if (flushActive) {
+			postISR(flushActive, flushSignal, 0);
+			flushActive = 0;
+			QK_ISR_EXIT();
+		}
 	} else {
 		c = sendbuffer[sendtail];
 		sendtail++;
 		if (sendtail >= SEND_BUFFER_SIZE)
 			sendtail = 0;
 		UDR1 = c;
+#ifdef TIME_SYNC
+		if (TIME_SYNC_START == (uint8_t)c) {
+			timesync_tx_start();
+		}
+#endif
+	}
+}
+
+
+/**
+ * @brief A byte has arrived.
+ *
+ * Time sync frames are handled here, so they can be stamped as they arrive.
+ * Anything else goes into the receive buffer for the console, which is told
+ * there is something to read.
+ */
+SIGNAL(USART1_RX_vect)
+{
+	uint8_t status;
+	uint8_t c;
+	uint8_t next;
+
+	TOGGLE_ON();
+
+	/* Read the status before the data, as reading UDR1 clears it. */
+	status = UCSR1A;
+	c = UDR1;
+	if (status & ((1 << FE1) | (1 << DOR1) | (1 << UPE1))) {
+		recverrors++;
+#ifdef TIME_SYNC
+		timesync_rx_error();
+#endif
+		return;
+	}
+#ifdef TIME_SYNC
+	if (timesync_rx_byte(c)) {
+		return;
+	}
+#endif
+	next = recvhead + 1;
+	if (next >= RECV_BUFFER_SIZE)
+		next = 0;
+	if (next == recvtail) {
+		recvlost++;
+	} else {
+		recvbuffer[recvhead] = c;
+		recvhead = next;
+	}
+	postISR_latest_r((&console), CONSOLE_RX_SIGNAL, 0);
+	QK_ISR_EXIT();
+}
+
+
+/**
+ * @brief Get the next received byte.
+ *
+ * @return 1 if there was a byte, which is put in *c, or 0 if there are none
+ * waiting.
+ */
+uint8_t serial_recv_char(char *c)
+{
+	uint8_t sreg;
+	uint8_t got;
+
+	sreg = SREG;
+	cli();
+	if (recvhead == recvtail) {
+		got = 0;
+	} else {
+		*c = recvbuffer[recvtail];
+		recvtail++;
+		if (recvtail >= RECV_BUFFER_SIZE)
+			recvtail = 0;
+		got = 1;
 	}
+	SREG = sreg;
+	return got;
+}
+
+
+/**
+ * @brief Get the counts of lost and bad bytes since reset.
+ *
+ * @param txlost the number of times the send buffer was nearly overrun
+ * @param rxlost received bytes dropped because the receive buffer was full
+ * @param rxerrors received bytes with framing, overrun or parity errors
+ */
+void serial_get_stats(uint16_t *txlost, uint16_t *rxlost, uint16_t *rxerrors)
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	*txlost = sendlost;
+	*rxlost = recvlost;
+	*rxerrors = recverrors;
+	SREG = sreg;
 }
 
 
@@ -316,11 +472,8 @@ int serial_send_int(unsigned int n)
 {
 	char buf[10];
 	char *bufp;
-	uint8_t sreg;
 	int sent;
 
-	sreg = SREG;
-	cli();
 	bufp = buf + 9;
 	*bufp = '\0';
 	if (0 == n) {
@@ -334,8 +487,10 @@ int serial_send_int(unsigned int n)
 			n /= 10;
 		}
 	}
+	/* Only the buffer needs interrupts off, and serial_send() does that
+	   itself.  There's no need to hold up interrupts, and with QK the
+	   active objects, while we work out the digits. */
 	sent = serial_send(bufp);
-	SREG = sreg;
 	return sent;
 }
 
@@ -344,13 +499,10 @@ int serial_send_hex_int(unsigned int x)
 {
 	char buf[10];
 	char *bufp;
-	uint8_t sreg;
 	int sent;
 
 	static const PROGMEM char hexchars[] = "0123456789ABCDEF";
 
-	sreg = SREG;
-	cli();
 	bufp = buf + 9;
 	*bufp = '\0';
 	if (0 == x) {
@@ -366,17 +518,51 @@ int serial_send_hex_int(unsigned int x)
 		}
 	}
 	sent = serial_send(bufp);
-	SREG = sreg;
 	return sent;
 }
 
 
 /**
- * Wait until all characters in the serial buffer have been sent.
+ * Ask for a signal when everything in the serial buffer has been sent.
+ *
+ * The signal is posted from the transmit interrupt when the buffer is empty,
+ * so the active object can carry on handling events while it waits.  If the
+ * buffer is already empty, the signal is posted straight away.  Anything sent
+ * after this call and before the buffer empties is waited for too.
+ *
+ * Only one active object can wait at a time.
+ */
+void serial_flush(QActive *ao, QSignal sig)
+{
+	uint8_t sreg;
+	uint8_t empty;
+
+	sreg = SREG;
+	cli();
+	Q_ASSERT( 0 == flushActive || ao == flushActive );
+	if (sendhead == sendtail) {
+		flushActive = 0;
+		empty = 73;
+	} else {
+		flushActive = ao;
+		flushSignal = sig;
+		empty = 0;
+	}
+	SREG = sreg;
+	if (empty) {
+		post(ao, sig, 0);
+	}
+}
+
+
+/**
+ * Send all characters in the serial buffer, and wait until they have gone.
  *
- * This can be called with interrupts on or off.  During startup (before
- * QF_onStartup() - actually before BSP_QF_onStartup()), interrupts will be off
- * to prevent events being sent to objects that aren't ready.
+ * This must only be called with interrupts off: during startup (before
+ * QF_onStartup() - actually before BSP_QF_onStartup()), when interrupts are
+ * off to prevent events being sent to objects that aren't ready, or when
+ * handling an assertion.  Once the active objects are running, use
+ * serial_flush() instead, which doesn't stop everything else while it waits.
  *
  * At 115kbaud, with a full buffer of 250 characters, the buffer should be
  * drained in 21.7ms.  So this is safe from the watchdog timer if the watchdog
@@ -384,32 +570,17 @@ int serial_send_hex_int(unsigned int x)
  */
 void serial_drain(void)
 {
-	if ( SREG & (1<<7) ) {
-		/* Interrupts are on, so wait for the interrupt code to send
-		   everything. */
-		uint8_t counter = 0;
-		while (sendhead != sendtail) {
-			/* A character takess ~87us at 115k, so delay slightly
-			   longer than that so we can count characters. */
-			_delay_us(90);
-			counter ++;
-			/* If we have sent more than a buffer's worth of
-			   characters, we've been her too long. */
-			Q_ASSERT( counter < SEND_BUFFER_SIZE );
+	char c;
 
-		}
-	} else {
-		/* Interrupts off, stuff characters in the transmit buffer. */
-		char c;
-
-		while (sendhead != sendtail) {
-			c = sendbuffer[sendtail];
-			sendtail++;
-			if (sendtail >= SEND_BUFFER_SIZE)
-				sendtail = 0;
-			while ( !( UCSR1A & (1<<UDRE1)) )
-				;	/* Wait for buffer ready. */
-			UDR1 = c;
-		}
+	Q_ASSERT( ! (SREG & (1<<7)) );
+
+	while (sendhead != sendtail) {
+		c = sendbuffer[sendtail];
+		sendtail++;
+		if (sendtail >= SEND_BUFFER_SIZE)
+			sendtail = 0;
+		while ( !( UCSR1A & (1<<UDRE1)) )
+			;	/* Wait for buffer ready. */
+		UDR1 = c;
 	}
 }
@@ -10,9 +10,13 @@ int  serial_send_rom(char const Q_ROM * const Q_ROM_VAR s);
 int  serial_send_int(unsigned int n);
 int  serial_send_hex_int(unsigned int x);
 int  serial_send_char(char c);
+uint8_t serial_send_space(void);
+uint8_t serial_recv_char(char *c);
+void serial_get_stats(uint16_t *txlost, uint16_t *rxlost, uint16_t *rxerrors);
 void serial_assert(char const Q_ROM * const Q_ROM_VAR file, int line);
 void serial_assert_nostop(char const Q_ROM * const Q_ROM_VAR file, int line);
 void serial_drain(void);
+void serial_flush(QActive *ao, QSignal sig);
 
 /**
  * Send a constant string (stored in ROM).
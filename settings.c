@@ -0,0 +1,279 @@
+/**
+ * @file
+ *
+ * Keep the user's settings in EEPROM.
+ *
+ * All the settings are written together as one record, into the next of
+ * SETTINGS_SLOTS slots each time, so each slot is only written once every
+ * SETTINGS_SLOTS saves.  At startup the newest good record is used.
+ *
+ * Changes are not written straight away.  We wait until there have been no
+ * changes for SETTINGS_DELAY seconds, so holding down a button only causes
+ * one write.  Then one byte is written each time settings_poll() is called,
+ * so we never wait for the EEPROM (3.3ms for each byte).
+ *
+ * Other records, such as the alarms, can be written the same way with
+ * settings_write_block().
+ */
+
+#include "settings.h"
+#include "time.h"
+#include "serial.h"
+
+#include <stddef.h>
+#include <avr/eeprom.h>
+#include <avr/interrupt.h>
+
+Q_DEFINE_THIS_FILE;
+
+
+/** The number of records we rotate through. */
+#define SETTINGS_SLOTS 32
+
+/** Seconds with no changes before we write the settings. */
+#define SETTINGS_DELAY 3
+
+
+/**
+ * The settings as they are kept in EEPROM.
+ *
+ * The check byte is written last, so if we're reset part way through a write
+ * the record is ignored and the one before is used.
+ */
+struct SettingsRecord {
+	/** One more than the previous record's. */
+	uint8_t seq;
+	uint8_t values[NSETTINGS];
+	uint8_t check;
+};
+
+static struct SettingsRecord EEMEM settingsSlots[SETTINGS_SLOTS];
+
+
+/** The lowest, highest and default value of each setting. */
+struct SettingRange {
+	uint8_t min;
+	uint8_t max;
+	uint8_t def;
+};
+
+static const Q_ROM struct SettingRange settingRanges[NSETTINGS] = {
+	[SETTING_BRIGHTNESS]          = { 0, 4, 2 },
+	[SETTING_TIME_MODE]           = { DECIMAL_MODE, NORMAL_MODE,
+					  NORMAL_MODE },
+	[SETTING_SNOOZE_MINUTES]      = { 1, 59, SNOOZE_MINUTES },
+	[SETTING_ALARM_SOUND_SECONDS] = { 1, 255, ALARM_SOUND_SECONDS },
+};
+
+
+/** The current settings. */
+static struct SettingsRecord current;
+
+/** The slot that the next record goes into. */
+static uint8_t nextSlot;
+
+/** Seconds to wait before writing.  Zero if there's nothing to write. */
+static uint8_t delay;
+
+/** True while a record is being written.  Changes are written afterwards,
+    in the next record. */
+static uint8_t writing;
+
+/** The next byte of the record to write. */
+static uint8_t writeIndex;
+
+/** The record being written. */
+static struct SettingsRecord pending;
+
+/** The RAM copy of the block from settings_write_block(), or 0 if there's no
+    block to write. */
+static const uint8_t *blockRAM;
+
+/** Where the block goes in EEPROM. */
+static uint8_t *blockEEPROM;
+
+/** The size of the block, and the next byte of it to write. */
+static uint8_t blockSize;
+static uint8_t blockIndex;
+
+
+static uint8_t record_check(struct SettingsRecord *r)
+{
+	uint8_t *p = (uint8_t *)r;
+	uint8_t sum = 0;
+
+	for (uint8_t i=0; i<offsetof(struct SettingsRecord, check); i++) {
+		sum += p[i];
+	}
+	return ~sum;
+}
+
+
+static uint8_t valid_value(uint8_t key, uint8_t value)
+{
+	if (key == SETTING_TIME_MODE) {
+		return value == NORMAL_MODE || value == DECIMAL_MODE;
+	}
+	return value >= Q_ROM_BYTE(settingRanges[key].min)
+		&& value <= Q_ROM_BYTE(settingRanges[key].max);
+}
+
+
+/**
+ * Find the newest good record in EEPROM, and use its values.  Any value that
+ * is missing or out of range gets its default.
+ */
+void settings_init(void)
+{
+	struct SettingsRecord r;
+	uint8_t newest = SETTINGS_SLOTS;
+	uint8_t newestSeq = 0;
+
+	for (uint8_t i=0; i<SETTINGS_SLOTS; i++) {
+		eeprom_read_block(&r, &settingsSlots[i], sizeof(r));
+		if (r.check != record_check(&r)) {
+			continue;
+		}
+		/* The sequence numbers wrap, so compare them by difference. */
+		if (newest == SETTINGS_SLOTS
+		    || (int8_t)(r.seq - newestSeq) > 0) {
+			newest = i;
+			newestSeq = r.seq;
+		}
+	}
+
+	if (newest == SETTINGS_SLOTS) {
+		SERIALSTR("settings not in EEPROM\r\n");
+		current.seq = 0;
+		nextSlot = 0;
+		for (uint8_t key=0; key<NSETTINGS; key++) {
+			current.values[key] =
+				Q_ROM_BYTE(settingRanges[key].def);
+		}
+	} else {
+		eeprom_read_block(&current, &settingsSlots[newest],
+				  sizeof(current));
+		nextSlot = newest + 1;
+		if (nextSlot == SETTINGS_SLOTS) {
+			nextSlot = 0;
+		}
+		for (uint8_t key=0; key<NSETTINGS; key++) {
+			if (! valid_value(key, current.values[key])) {
+				current.values[key] =
+					Q_ROM_BYTE(settingRanges[key].def);
+			}
+		}
+	}
+	delay = 0;
+	writing = 0;
+	blockRAM = 0;
+}
+
+
+uint8_t settings_get(uint8_t key)
+{
+	Q_ASSERT( key < NSETTINGS );
+	return current.values[key];
+}
+
+
+/**
+ * Change a setting.  It's written to EEPROM a few seconds later.
+ */
+void settings_set(uint8_t key, uint8_t value)
+{
+	Q_ASSERT( key < NSETTINGS );
+	Q_ASSERT( valid_value(key, value) );
+	if (current.values[key] != value) {
+		current.values[key] = value;
+		delay = SETTINGS_DELAY;
+	}
+}
+
+
+/**
+ * Write a block to EEPROM in the background, a byte at a time from
+ * settings_poll(), after any settings record being written.
+ *
+ * The RAM copy is read as it is written, so it must stay in place.  If it
+ * changes, call this again, and the block is written again from the start.
+ * Only one block can be waiting at a time.
+ *
+ * Put the block's check byte last, so that if we're reset part way through,
+ * the block is seen to be bad.
+ */
+void settings_write_block(void *eeprom, const void *ram, uint8_t size)
+{
+	uint8_t sreg;
+
+	Q_ASSERT( size );
+	sreg = SREG;
+	cli();
+	Q_ASSERT( ! blockRAM || blockEEPROM == (uint8_t *)eeprom );
+	blockRAM = (const uint8_t *)ram;
+	blockEEPROM = (uint8_t *)eeprom;
+	blockSize = size;
+	blockIndex = 0;
+	SREG = sreg;
+}
+
+
+/**
+ * Write the settings to EEPROM in the background.  Call this regularly.
+ *
+ * @param newsecond true once a second, to count down the delay before
+ * writing.
+ */
+void settings_poll(uint8_t newsecond)
+{
+	uint8_t *p;
+	uint8_t *ep;
+	uint8_t sreg;
+
+	if (! writing && delay && newsecond) {
+		delay --;
+		if (! delay) {
+			current.seq ++;
+			pending = current;
+			pending.check = record_check(&pending);
+			writing = 73;
+			writeIndex = 0;
+		}
+	}
+
+	if (! writing) {
+		/* Write the next byte of the block, if there is one. */
+		sreg = SREG;
+		cli();
+		if (blockRAM && eeprom_is_ready()) {
+			eeprom_update_byte(blockEEPROM + blockIndex,
+					   blockRAM[blockIndex]);
+			blockIndex ++;
+			if (blockIndex == blockSize) {
+				blockRAM = 0;
+			}
+		}
+		SREG = sreg;
+		return;
+	}
+
+	p = (uint8_t *)(&pending);
+	ep = (uint8_t *)(&settingsSlots[nextSlot]);
+	/* Only start a write if the last one has finished, and keep anyone
+	   else from using the EEPROM registers until it has started. */
+	sreg = SREG;
+	cli();
+	if (eeprom_is_ready()) {
+		eeprom_update_byte(ep + writeIndex, p[writeIndex]);
+		writeIndex ++;
+	}
+	SREG = sreg;
+
+	if (writeIndex == sizeof(pending)) {
+		writing = 0;
+		nextSlot ++;
+		if (nextSlot == SETTINGS_SLOTS) {
+			nextSlot = 0;
+		}
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef settings_h_INCLUDED
+#define settings_h_INCLUDED
+
+#include "qpn_port.h"
+
+#ifndef SNOOZE_MINUTES
+#define SNOOZE_MINUTES 5
+#endif
+#ifndef ALARM_SOUND_SECONDS
+#define ALARM_SOUND_SECONDS 30
+#endif
+
+#if SNOOZE_MINUTES < 1 || SNOOZE_MINUTES >= 60
+#error "SNOOZE_MINUTES must be from 1 to 59"
+#endif
+#if ALARM_SOUND_SECONDS < 1 || ALARM_SOUND_SECONDS > 255
+#error "ALARM_SOUND_SECONDS must be from 1 to 255"
+#endif
+
+/**
+ * The settings that are kept in EEPROM.  Each one is a byte.
+ */
+enum SettingKeys {
+	/** The LCD brightness, 0 to 4. */
+	SETTING_BRIGHTNESS = 0,
+	/** NORMAL_MODE or DECIMAL_MODE. */
+	SETTING_TIME_MODE,
+	/** Snooze time, in the current mode's minutes.  SNOOZE_MINUTES to
+	    start with. */
+	SETTING_SNOOZE_MINUTES,
+	/** How long the alarm sounds before it snoozes.
+	    ALARM_SOUND_SECONDS to start with. */
+	SETTING_ALARM_SOUND_SECONDS,
+
+	NSETTINGS,
+};
+
+void settings_init(void);
+uint8_t settings_get(uint8_t key);
+void settings_set(uint8_t key, uint8_t value);
+void settings_write_block(void *eeprom, const void *ram, uint8_t size);
+void settings_poll(uint8_t newsecond);
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef state_trace_format_h_INCLUDED
+#define state_trace_format_h_INCLUDED
+
+#include <stdint.h>
+
+/* The state machine trace format, shared by the firmware (statetrace.c) and
+   the host (state-trace-render.c).
+
+   Each record is a header byte, a time stamp, and zero to four bytes of data
+   that depend on the record type.  The top four bits of the header are the
+   type, and the bottom four are the priority of the active object, or zero if
+   it isn't known.  The time stamp counts in units of 16us (32 timer 1 counts)
+   and wraps after about a second.  Multi-byte values are little endian.
+
+   State handlers are recorded as their addresses, which are AVR word
+   addresses.  Active objects are recorded as their RAM addresses.  The host
+   turns these into names with the table that state-trace-ids makes from the
+   linker map.
+
+   The records go out on the serial port in text lines that start with
+   STATE_TRACE_LINE_START, followed by whole records in hex.  Anything else is
+   the clock's debug output. */
+
+#define STATE_TRACE_LINE_START '%'
+
+/** The most record bytes in one line. */
+#define STATE_TRACE_LINE_BYTES 16
+
+/** Units of 0.5us per time stamp unit. */
+#define STATE_TRACE_STAMP_COUNTS 32
+
+/** QF_run() starts the initial transition of an active object.  Data: the
+    active object's address. */
+#define STATE_TRACE_INIT 1
+/** An event is dispatched to an active object.  Data: the signal. */
+#define STATE_TRACE_DISPATCH 2
+/** The initial transition or the dispatch has finished. */
+#define STATE_TRACE_DONE 3
+/** A state handler took a transition.  Data: the state that took it, and
+    the target. */
+#define STATE_TRACE_TRAN 4
+/** A state was entered.  Data: the state. */
+#define STATE_TRACE_ENTRY 5
+/** A state was exited.  Data: the state. */
+#define STATE_TRACE_EXIT 6
+/** An active object posted an event.  The priority is the receiver's.  Data:
+    the signal. */
+#define STATE_TRACE_POST 7
+/** An interrupt posted an event.  Data: the signal. */
+#define STATE_TRACE_POST_ISR 8
+/** An active object posted an event that replaced the same signal in the
+    queue (QActive_postLatest()).  Data: the signal. */
+#define STATE_TRACE_LATEST 9
+/** An interrupt posted an event that replaced the same signal in the
+    queue.  Data: the signal. */
+#define STATE_TRACE_LATEST_ISR 10
+/** The ring was full, and records were dropped.  Data: the number dropped,
+    up to 255. */
+#define STATE_TRACE_LOST 15
+
+
+/**
+ * The length of a record, including the header and the time stamp, from its
+ * header byte.  Zero for an unknown type.
+ */
+static inline uint8_t state_trace_length(uint8_t header)
+{
+	switch (header >> 4) {
+	case STATE_TRACE_DONE:
+		return 3;
+	case STATE_TRACE_DISPATCH:
+	case STATE_TRACE_POST:
+	case STATE_TRACE_POST_ISR:
+	case STATE_TRACE_LATEST:
+	case STATE_TRACE_LATEST_ISR:
+	case STATE_TRACE_LOST:
+		return 4;
+	case STATE_TRACE_INIT:
+	case STATE_TRACE_ENTRY:
+	case STATE_TRACE_EXIT:
+		return 5;
+	case STATE_TRACE_TRAN:
+		return 7;
+	default:
+		return 0;
+	}
+}
+
+#endif
@@ -0,0 +1,693 @@
+/* Show the state trace from a clock built with STATE_TRACE=1 as a sequence
+   diagram, and optionally write a timing diagram for a waveform viewer.  See
+   state-trace-format.h for the format. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <termios.h>
+
+#include "state-trace-format.h"
+
+static char *myname;
+
+/** The most priorities there can be, from the four bits in the header. */
+#define NPRIOS 16
+
+/** The width of each column in the sequence diagram.  Column 0 is for the
+    interrupts, and the others are for the active objects, by priority. */
+#define COLUMN_WIDTH 12
+
+/** Print the column names again after this many lines. */
+#define HEADER_LINES 40
+
+
+struct Name {
+	char kind;
+	unsigned value;
+	char *name;
+};
+
+static struct Name *names;
+static int nnames;
+
+/** The active objects' names, by priority, once their INIT records have been
+    seen. */
+static char *aoNames[NPRIOS];
+static int ncolumns = 8;
+static int namesChanged = 1;
+static int linesSinceHeader;
+
+/** Signal names given with -x.  Posts and dispatches of these aren't shown
+    in the sequence diagram. */
+static char **hidden;
+static int nhidden;
+
+/** Don't show state entries and exits, only transitions. */
+static int noEntryExit;
+
+/** The priorities of the active objects being run, innermost last.  With
+    QK, one can preempt another. */
+static int running[NPRIOS];
+static int nrunning;
+
+/** The time of the last record, in stamp units since the first. */
+static uint64_t now;
+static uint16_t lastStamp;
+static int haveStamp;
+
+static volatile sig_atomic_t stopping;
+
+
+/* The timing diagram is written when the input ends, as the VCD header has
+   to name everything first. */
+struct Change {
+	uint64_t time;
+	int prio;
+	int running;
+	int queued;
+	unsigned state;
+};
+
+static FILE *vcd;
+static struct Change *changes;
+static size_t nchanges;
+static size_t changesSize;
+static int queued[NPRIOS];
+static unsigned current[NPRIOS];
+static int seen[NPRIOS];
+
+
+static void usage(int retcode)
+{
+	fprintf(stderr, "Usage: %s [-i ids] [-v vcd] [-x signal]... [-q] "
+		"[file|device]\n"
+		"  Show the state trace from the clock as a sequence diagram.\n"
+		"  The trace is read from the file or serial device, or from\n"
+		"  stdin.  The clock's other output is shown after '#'.\n"
+		"  -i  The table from state-trace-ids (default dclock.ids).\n"
+		"  -v  Write a timing diagram to this VCD file.\n"
+		"  -x  Don't show the posts and dispatches of this signal.\n"
+		"  -q  Don't show state entries and exits.\n",
+		myname);
+	exit(retcode);
+}
+
+
+static void *xrealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (! p) {
+		fprintf(stderr, "%s: out of memory\n", myname);
+		exit(4);
+	}
+	return p;
+}
+
+
+static void readNames(const char *file)
+{
+	FILE *f;
+	char line[256];
+	char kind;
+	unsigned value;
+	char name[200];
+	int size = 0;
+
+	f = fopen(file, "r");
+	if (! f) {
+		perror(file);
+		exit(3);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%c %i %199s", &kind, &value, name) != 3)
+			continue;
+		if (nnames == size) {
+			size = size ? size * 2 : 256;
+			names = xrealloc(names, size * sizeof(*names));
+		}
+		names[nnames].kind = kind;
+		names[nnames].value = value;
+		names[nnames].name = strdup(name);
+		nnames++;
+	}
+	fclose(f);
+}
+
+
+/**
+ * The name of an address or signal, or the number if it's not in the table.
+ * The string is only good until the next call.
+ */
+static const char *lookup(char kind, unsigned value)
+{
+	static char buf[4][16];
+	static int b;
+	int i;
+
+	for (i = 0; i < nnames; i++) {
+		if (names[i].kind == kind && names[i].value == value)
+			return names[i].name;
+	}
+	b = (b + 1) % 4;
+	if ('s' == kind)
+		snprintf(buf[b], sizeof(buf[b]), "sig%u", value);
+	else
+		snprintf(buf[b], sizeof(buf[b]), "0x%04x", value);
+	return buf[b];
+}
+
+
+/**
+ * A signal name without the _SIGNAL on the end, to save space.
+ */
+static const char *signalName(unsigned sig)
+{
+	static char buf[64];
+	const char *name = lookup('s', sig);
+	size_t len = strlen(name);
+
+	if (len > 7 && len < sizeof(buf) && ! strcmp(name + len - 7, "_SIGNAL")) {
+		memcpy(buf, name, len - 7);
+		buf[len - 7] = '\0';
+		return buf;
+	}
+	return name;
+}
+
+
+static int isHidden(unsigned sig)
+{
+	const char *name = lookup('s', sig);
+	const char *shortName = signalName(sig);
+	int i;
+
+	for (i = 0; i < nhidden; i++) {
+		if (! strcmp(hidden[i], name) || ! strcmp(hidden[i], shortName))
+			return 1;
+	}
+	return 0;
+}
+
+
+static const char *aoName(int prio)
+{
+	static char buf[16];
+
+	if (0 == prio)
+		return "isr";
+	if (aoNames[prio])
+		return aoNames[prio];
+	snprintf(buf, sizeof(buf), "ao%d", prio);
+	return buf;
+}
+
+
+/* A line of the sequence diagram is built up in here.  Each column has a
+   lifeline, and text can run over the columns to its right. */
+static char row[NPRIOS * COLUMN_WIDTH + 1];
+
+static void startRow(void)
+{
+	int c;
+
+	memset(row, ' ', sizeof(row));
+	for (c = 0; c < ncolumns; c++)
+		row[c * COLUMN_WIDTH + COLUMN_WIDTH / 2] = '|';
+	row[ncolumns * COLUMN_WIDTH] = '\0';
+}
+
+
+static void putText(int pos, const char *s)
+{
+	int len = strlen(s);
+
+	if (pos + len > NPRIOS * COLUMN_WIDTH)
+		len = NPRIOS * COLUMN_WIDTH - pos;
+	if (len <= 0)
+		return;
+	if (pos + len > (int)strlen(row))
+		row[pos + len] = '\0';
+	memcpy(row + pos, s, len);
+}
+
+
+static int centre(int column)
+{
+	return column * COLUMN_WIDTH + COLUMN_WIDTH / 2;
+}
+
+
+static void printHeader(void)
+{
+	int c;
+	int pos;
+
+	startRow();
+	memset(row, ' ', strlen(row));
+	for (c = 0; c < ncolumns; c++) {
+		pos = centre(c) - (int)strlen(aoName(c)) / 2;
+		putText(pos < 0 ? 0 : pos, aoName(c));
+	}
+	printf("\n%10s %s\n", "ms", row);
+	namesChanged = 0;
+	linesSinceHeader = 0;
+}
+
+
+static void printRow(void)
+{
+	char saved[sizeof(row)];
+	int end = strlen(row);
+
+	while (end > 0 && ' ' == row[end - 1])
+		end--;
+	row[end] = '\0';
+	if (namesChanged || linesSinceHeader >= HEADER_LINES) {
+		/* The header is built in the row too. */
+		memcpy(saved, row, sizeof(row));
+		printHeader();
+		memcpy(row, saved, sizeof(row));
+	}
+	printf("%10.3f %s\n", now * STATE_TRACE_STAMP_COUNTS / 2000.0, row);
+	linesSinceHeader++;
+}
+
+
+static void useColumn(int prio)
+{
+	if (prio >= ncolumns) {
+		ncolumns = prio + 1;
+		namesChanged = 1;
+	}
+}
+
+
+/**
+ * An arrow from one column to another, with the signal name on it, or after
+ * it if it doesn't fit.
+ */
+static void arrow(int from, int to, char shaft, const char *label)
+{
+	int a = centre(from);
+	int b = centre(to);
+	int lo = a < b ? a : b;
+	int hi = a < b ? b : a;
+	int len = strlen(label);
+	int i;
+
+	startRow();
+	if (from == to) {
+		row[a] = 'o';
+		putText(a + 2, label);
+		return;
+	}
+	for (i = lo + 1; i < hi; i++)
+		row[i] = shaft;
+	row[b] = b > a ? '>' : '<';
+	if (len + 2 <= hi - lo - 1)
+		memcpy(row + lo + 1 + (hi - lo - 1 - len) / 2, label, len);
+	else
+		putText(hi + 2, label);
+}
+
+
+static void addChange(int prio)
+{
+	struct Change *c;
+
+	if (! vcd)
+		return;
+	if (nchanges == changesSize) {
+		changesSize = changesSize ? changesSize * 2 : 1024;
+		changes = xrealloc(changes, changesSize * sizeof(*changes));
+	}
+	c = &changes[nchanges++];
+	c->time = now;
+	c->prio = prio;
+	c->running = 0;
+	for (int i = 0; i < nrunning; i++) {
+		if (running[i] == prio)
+			c->running = 1;
+	}
+	c->queued = queued[prio];
+	c->state = current[prio];
+	seen[prio] = 1;
+}
+
+
+/** The active object that a QEP record belongs to. */
+static int currentPrio(void)
+{
+	return nrunning ? running[nrunning - 1] : 0;
+}
+
+
+static void handleRecord(const uint8_t *r)
+{
+	int type = r[0] >> 4;
+	int prio = r[0] & 0xf;
+	uint16_t stamp = r[1] | (r[2] << 8);
+	uint16_t delta;
+	unsigned a = r[3] | (r[4] << 8);
+	unsigned b = r[5] | (r[6] << 8);
+	char buf[200];
+	int p;
+
+	/* The stamps wrap every second or so, and the records always come
+	   more often than that.  The two ways of counting a tick that
+	   hasn't been handled yet can differ by one unit. */
+	if (haveStamp) {
+		delta = stamp - lastStamp;
+		if (delta < 0xff00)
+			now += delta;
+	}
+	lastStamp = stamp;
+	haveStamp = 1;
+
+	switch (type) {
+	case STATE_TRACE_INIT:
+		if (nrunning < NPRIOS)
+			running[nrunning++] = prio;
+		free(aoNames[prio]);
+		aoNames[prio] = strdup(lookup('d', a));
+		useColumn(prio);
+		namesChanged = 1;
+		startRow();
+		row[centre(prio)] = '*';
+		putText(centre(prio) + 2, "init");
+		printRow();
+		addChange(prio);
+		break;
+	case STATE_TRACE_DISPATCH:
+		if (nrunning < NPRIOS)
+			running[nrunning++] = prio;
+		if (queued[prio] > 0)
+			queued[prio]--;
+		useColumn(prio);
+		addChange(prio);
+		if (isHidden(a))
+			break;
+		startRow();
+		row[centre(prio)] = '*';
+		putText(centre(prio) + 2, signalName(a));
+		printRow();
+		break;
+	case STATE_TRACE_DONE:
+		if (nrunning && running[nrunning - 1] == prio)
+			nrunning--;
+		addChange(prio);
+		break;
+	case STATE_TRACE_TRAN:
+		p = currentPrio();
+		current[p] = b;
+		snprintf(buf, sizeof(buf), "%s -> %s",
+			 lookup('f', a), lookup('f', b));
+		startRow();
+		putText(centre(p) + 2, buf);
+		printRow();
+		addChange(p);
+		break;
+	case STATE_TRACE_ENTRY:
+	case STATE_TRACE_EXIT:
+		p = currentPrio();
+		if (STATE_TRACE_ENTRY == type) {
+			current[p] = a;
+			addChange(p);
+		}
+		if (noEntryExit)
+			break;
+		snprintf(buf, sizeof(buf), "%c%s",
+			 STATE_TRACE_ENTRY == type ? '+' : '-',
+			 lookup('f', a));
+		startRow();
+		putText(centre(p) + 2, buf);
+		printRow();
+		break;
+	case STATE_TRACE_POST:
+	case STATE_TRACE_POST_ISR:
+	case STATE_TRACE_LATEST:
+	case STATE_TRACE_LATEST_ISR:
+		useColumn(prio);
+		if (STATE_TRACE_POST == type
+		    || STATE_TRACE_POST_ISR == type) {
+			queued[prio]++;
+			addChange(prio);
+		}
+		if (isHidden(a))
+			break;
+		p = (STATE_TRACE_POST == type || STATE_TRACE_LATEST == type)
+			? currentPrio() : 0;
+		/* A replaced event is drawn with '=', as it didn't add to the
+		   queue. */
+		arrow(p, prio, STATE_TRACE_POST == type
+		      || STATE_TRACE_POST_ISR == type ? '-' : '=',
+		      signalName(a & 0xff));
+		printRow();
+		break;
+	case STATE_TRACE_LOST:
+		printf("%10.3f --- %u records lost ---\n",
+		       now * STATE_TRACE_STAMP_COUNTS / 2000.0, r[3]);
+		break;
+	}
+}
+
+
+static int hexValue(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+
+/**
+ * Decode a trace line.  Anything that isn't a whole number of records is
+ * skipped, as it must have been garbled.
+ */
+static void handleTraceLine(const char *line)
+{
+	uint8_t bytes[STATE_TRACE_LINE_BYTES + 4];
+	uint8_t record[8];
+	int n = 0;
+	int hi;
+	int lo;
+	int i;
+	int len;
+
+	while (line[0] && line[1] && n < STATE_TRACE_LINE_BYTES) {
+		hi = hexValue(line[0]);
+		lo = hexValue(line[1]);
+		if (hi < 0 || lo < 0)
+			break;
+		bytes[n++] = (hi << 4) | lo;
+		line += 2;
+	}
+	if (*line && '\r' != *line && '\n' != *line) {
+		fprintf(stderr, "%s: bad trace line\n", myname);
+		return;
+	}
+	for (i = 0; i < n; i += len) {
+		len = state_trace_length(bytes[i]);
+		if (! len || i + len > n) {
+			fprintf(stderr, "%s: bad trace record\n", myname);
+			return;
+		}
+	}
+	for (i = 0; i < n; i += len) {
+		len = state_trace_length(bytes[i]);
+		memset(record, 0, sizeof(record));
+		memcpy(record, bytes + i, len);
+		handleRecord(record);
+	}
+}
+
+
+static int openInput(const char *file)
+{
+	int fd;
+	struct termios t;
+
+	if (! file)
+		return 0;
+	fd = open(file, O_RDONLY | O_NOCTTY);
+	if (fd < 0) {
+		perror(file);
+		exit(3);
+	}
+	if (isatty(fd) && tcgetattr(fd, &t) == 0) {
+		/* The clock runs at 115200 N81. */
+		cfmakeraw(&t);
+		cfsetispeed(&t, B115200);
+		cfsetospeed(&t, B115200);
+		t.c_cflag |= CLOCAL | CREAD;
+		t.c_cc[VMIN] = 1;
+		t.c_cc[VTIME] = 0;
+		tcsetattr(fd, TCSANOW, &t);
+	}
+	return fd;
+}
+
+
+/**
+ * A short identifier for each VCD variable, made of printable characters.
+ */
+static const char *vcdId(int prio, int what)
+{
+	static char buf[4];
+
+	buf[0] = '!' + prio;
+	buf[1] = 'a' + what;
+	buf[2] = '\0';
+	return buf;
+}
+
+
+static void vcdBinary(int value, int bits, const char *id)
+{
+	char buf[40];
+	int i;
+
+	for (i = 0; i < bits; i++)
+		buf[i] = (value >> (bits - 1 - i)) & 1 ? '1' : '0';
+	buf[bits] = '\0';
+	fprintf(vcd, "b%s %s\n", buf, id);
+}
+
+
+/**
+ * Write the timing diagram: for each active object, whether it's running,
+ * the number of events in its queue, and its state.  Times are in us.
+ */
+static void writeVcd(void)
+{
+	size_t i;
+	int p;
+	uint64_t last = ~(uint64_t)0;
+	struct Change *c;
+
+	fprintf(vcd, "$timescale 1us $end\n$scope module dclock $end\n");
+	for (p = 1; p < NPRIOS; p++) {
+		if (! seen[p])
+			continue;
+		fprintf(vcd, "$var wire 1 %s %s_running $end\n",
+			vcdId(p, 0), aoName(p));
+		fprintf(vcd, "$var integer 8 %s %s_queued $end\n",
+			vcdId(p, 1), aoName(p));
+		fprintf(vcd, "$var string 1 %s %s_state $end\n",
+			vcdId(p, 2), aoName(p));
+	}
+	fprintf(vcd, "$upscope $end\n$enddefinitions $end\n");
+	for (i = 0; i < nchanges; i++) {
+		c = &changes[i];
+		if (0 == c->prio)
+			continue;
+		if (c->time != last) {
+			last = c->time;
+			fprintf(vcd, "#%llu\n", (unsigned long long)
+				(last * STATE_TRACE_STAMP_COUNTS / 2));
+		}
+		fprintf(vcd, "%d%s\n", c->running, vcdId(c->prio, 0));
+		vcdBinary(c->queued, 8, vcdId(c->prio, 1));
+		fprintf(vcd, "s%s %s\n", c->state ? lookup('f', c->state) : "?",
+			vcdId(c->prio, 2));
+	}
+}
+
+
+static void stop(int sig)
+{
+	(void)sig;
+	stopping = 1;
+}
+
+
+int main(int argc, char **argv)
+{
+	int opt;
+	const char *idsFile = "dclock.ids";
+	const char *vcdFile = 0;
+	int fd;
+	char buf[256];
+	char line[512];
+	size_t used = 0;
+	ssize_t got;
+	ssize_t i;
+	struct sigaction sa;
+
+	myname = argv[0];
+	while ((opt = getopt(argc, argv, "i:v:x:qh")) != -1) {
+		switch (opt) {
+		case 'i':
+			idsFile = optarg;
+			break;
+		case 'v':
+			vcdFile = optarg;
+			break;
+		case 'x':
+			hidden = xrealloc(hidden, (nhidden + 1) * sizeof(*hidden));
+			hidden[nhidden++] = optarg;
+			break;
+		case 'q':
+			noEntryExit = 1;
+			break;
+		case 'h':
+			usage(0);
+			break;
+		default:
+			usage(2);
+		}
+	}
+	if (argc - optind > 1)
+		usage(2);
+
+	readNames(idsFile);
+	fd = openInput(optind < argc ? argv[optind] : 0);
+	if (vcdFile) {
+		vcd = fopen(vcdFile, "w");
+		if (! vcd) {
+			perror(vcdFile);
+			exit(3);
+		}
+	}
+
+	/* ^C stops reading a serial device, and the timing diagram is still
+	   written. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = stop;
+	sigaction(SIGINT, &sa, 0);
+	sigaction(SIGTERM, &sa, 0);
+
+	while (! stopping && (got = read(fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < got; i++) {
+			if ('\n' != buf[i]) {
+				if (used < sizeof(line) - 1)
+					line[used++] = buf[i];
+				continue;
+			}
+			while (used && '\r' == line[used - 1])
+				used--;
+			line[used] = '\0';
+			used = 0;
+			if (STATE_TRACE_LINE_START == line[0])
+				handleTraceLine(line + 1);
+			else if (line[0])
+				printf("%10s # %s\n", "", line);
+		}
+		fflush(stdout);
+	}
+
+	if (vcd) {
+		writeVcd();
+		fclose(vcd);
+	}
+	return 0;
+}
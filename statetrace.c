@@ -0,0 +1,188 @@
+/**
+ * @file
+ *
+ * The firmware end of the state machine trace.  The records are written
+ * straight into a RAM ring by whatever is running, active object or
+ * interrupt, with interrupts off for only a few bytes.  Nothing is sent until
+ * the event loop is idle, so the trace changes the timing it records as
+ * little as we can manage.
+ *
+ * The record format is in state-trace-format.h.
+ */
+
+#include "statetrace.h"
+#include "bsp.h"
+#include "serial.h"
+
+
+Q_DEFINE_THIS_FILE;
+
+
+#ifndef STATE_TRACE
+#error "statetrace.c must only be compiled with STATE_TRACE defined"
+#endif
+
+
+/**
+ * The ring holds 256 bytes, so the indexes wrap by themselves.  One byte is
+ * always left empty so a full ring can be told from an empty one.
+ */
+static uint8_t ring[256];
+static uint8_t ringhead;
+static uint8_t ringtail;
+
+/** Records dropped because the ring was full, since the last LOST record. */
+static uint8_t lost;
+
+/**
+ * Leave this much space in the serial send buffer for the debug output and
+ * the console, so the trace never causes a '!'.
+ */
+#define SERIAL_SPARE 80
+
+
+static inline void put(uint8_t byte)
+{
+	ring[ringhead] = byte;
+	ringhead ++;
+}
+
+
+/**
+ * Add a record to the ring, or count it as lost if there's no room.
+ *
+ * @param len the number of data bytes, taken from a and then b
+ */
+static void record(uint8_t header, uint8_t len, uint16_t a, uint16_t b)
+{
+	uint16_t stamp;
+	uint8_t space;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	stamp = BSP_trace_stamp();
+	space = 255 - (uint8_t)(ringhead - ringtail);
+	if (lost) {
+		/* Say how many were lost before anything else goes in, so the
+		   host knows where the gap is. */
+		if (space < 4 + 3 + len) {
+			if (lost != 255) {
+				lost ++;
+			}
+			SREG = sreg;
+			return;
+		}
+		put(STATE_TRACE_LOST << 4);
+		put(stamp);
+		put(stamp >> 8);
+		put(lost);
+		lost = 0;
+	} else if (space < 3 + len) {
+		lost = 1;
+		SREG = sreg;
+		return;
+	}
+	put(header);
+	put(stamp);
+	put(stamp >> 8);
+	if (len > 0) {
+		put(a);
+	}
+	if (len > 1) {
+		put(a >> 8);
+	}
+	if (len > 2) {
+		put(b);
+	}
+	if (len > 3) {
+		put(b >> 8);
+	}
+	SREG = sreg;
+}
+
+
+/**
+ * Record something that happened to an active object.
+ *
+ * @param type one of the STATE_TRACE_ types that carry a signal, or
+ * STATE_TRACE_INIT, which records the active object's address instead.
+ */
+void state_trace_ao(uint8_t type, QActive *a, QSignal sig)
+{
+	uint8_t header = (type << 4) | a->prio;
+
+	if (STATE_TRACE_INIT == type) {
+		record(header, 2, (uint16_t)(uintptr_t)a, 0);
+	} else {
+		record(header, state_trace_length(header) - 3, sig, 0);
+	}
+}
+
+
+/**
+ * Record a state being entered or exited, or a transition from s to t.
+ *
+ * QEP-nano doesn't know which active object it's working for, so the host
+ * works that out from the last DISPATCH or INIT record.
+ */
+void state_trace_state(uint8_t type, QStateHandler s, QStateHandler t)
+{
+	uint8_t header = type << 4;
+
+	record(header, state_trace_length(header) - 3,
+	       (uint16_t)(uintptr_t)s, (uint16_t)(uintptr_t)t);
+}
+
+
+static char hex_digit(uint8_t n)
+{
+	return n < 10 ? '0' + n : 'a' + n - 10;
+}
+
+
+/**
+ * Send one line of whole records, if there are any and the serial port has
+ * room.
+ *
+ * Call this from the idle loop.  Interrupts are off while the line goes into
+ * the send buffer, so nothing else can print in the middle of it, but a line
+ * is short enough not to delay the next event by much.  The idle loop comes
+ * round again for the next one.
+ *
+ * @return true if a line was sent
+ */
+uint8_t state_trace_flush(void)
+{
+	uint8_t n = 0;
+	uint8_t len;
+	uint8_t byte;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	if (ringtail == ringhead
+	    || serial_send_space() < 1 + 2 * STATE_TRACE_LINE_BYTES + 2
+	    + SERIAL_SPARE) {
+		SREG = sreg;
+		return 0;
+	}
+	serial_send_char(STATE_TRACE_LINE_START);
+	while (ringtail != ringhead) {
+		len = state_trace_length(ring[ringtail]);
+		Q_ASSERT( len );
+		if (n + len > STATE_TRACE_LINE_BYTES) {
+			break;
+		}
+		n += len;
+		while (len--) {
+			byte = ring[ringtail++];
+			serial_send_char(hex_digit(byte >> 4));
+			serial_send_char(hex_digit(byte & 0xf));
+		}
+	}
+	serial_send_char('\r');
+	serial_send_char('\n');
+	SREG = sreg;
+	return 73;
+}
@@ -0,0 +1,26 @@
+#ifndef statetrace_h_INCLUDED
+#define statetrace_h_INCLUDED
+
+#include "qpn_port.h"
+#include "state-trace-format.h"
+
+/**
+ * @file
+ *
+ * Record every dispatch, transition, state entry and exit, and post, and send
+ * them out the serial port when there's nothing else to do.
+ *
+ * Build with STATE_TRACE=1.  QP-nano calls these through the QEP_TRACE_ and
+ * QF_TRACE_ hooks defined in qpn_port.h.  The format is described in
+ * state-trace-format.h, and the host end is state-trace-render.
+ */
+
+#ifdef STATE_TRACE
+
+void state_trace_ao(uint8_t type, QActive *a, QSignal sig);
+void state_trace_state(uint8_t type, QStateHandler s, QStateHandler t);
+uint8_t state_trace_flush(void);
+
+#endif
+
+#endif
@@ -0,0 +1,197 @@
+#include "time-conversion-bulk.h"
+#include "time-conversion.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BULK_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @file
+ *
+ * Array versions of the conversions in time-conversion.h.
+ *
+ * Dividing by 108 or 125 is done by multiplying by a 32 bit reciprocal and
+ * keeping the high 32 bits of the product.  For every time of day that gives
+ * the same answer as the division.
+ *
+ * - decimal = normal * 125 / 108 = normal + normal * 17 / 108, and
+ *   normal * 17 / 108 is the high half of normal * BULK_N2D_RECIP.
+ *
+ * - normal = decimal * 108 / 125, which is the high half of
+ *   decimal * BULK_D2N_RECIP.
+ *
+ * SSE2 and AVX2 only multiply the even numbered 32 bit lanes into 64 bits, so
+ * the even and odd lanes are done separately and put back together.
+ */
+
+/** ceil(17 * 2^32 / 108) */
+#define BULK_N2D_RECIP 0x284bda13U
+
+/** ceil(108 * 2^32 / 125) */
+#define BULK_D2N_RECIP 0xdd2f1aa0U
+
+
+static void scalar_n2d(const uint32_t *in, uint32_t *out, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		out[i] = normal_seconds_to_decimal(in[i]);
+	}
+}
+
+
+static void scalar_d2n(const uint32_t *in, uint32_t *out, size_t n)
+{
+	size_t i;
+
+	for (i=0; i<n; i++) {
+		out[i] = decimal_seconds_to_normal(in[i]);
+	}
+}
+
+
+static int scalar_available(void)
+{
+	return 1;
+}
+
+
+#ifdef BULK_X86
+
+/** The high 32 bits of each 32 bit lane of x times m. */
+static inline __m128i mulhi_epu32_sse2(__m128i x, __m128i m)
+{
+	__m128i even = _mm_srli_epi64(_mm_mul_epu32(x, m), 32);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), m);
+
+	odd = _mm_and_si128(odd, _mm_set_epi32(-1, 0, -1, 0));
+	return _mm_or_si128(even, odd);
+}
+
+
+__attribute__ ((target ("sse2")))
+static void sse2_n2d(const uint32_t *in, uint32_t *out, size_t n)
+{
+	const __m128i m = _mm_set1_epi32((int)BULK_N2D_RECIP);
+	size_t i;
+
+	for (i=0; i+4<=n; i+=4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		x = _mm_add_epi32(x, mulhi_epu32_sse2(x, m));
+		_mm_storeu_si128((__m128i *)(out + i), x);
+	}
+	scalar_n2d(in + i, out + i, n - i);
+}
+
+
+__attribute__ ((target ("sse2")))
+static void sse2_d2n(const uint32_t *in, uint32_t *out, size_t n)
+{
+	const __m128i m = _mm_set1_epi32((int)BULK_D2N_RECIP);
+	size_t i;
+
+	for (i=0; i+4<=n; i+=4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+		_mm_storeu_si128((__m128i *)(out + i), mulhi_epu32_sse2(x, m));
+	}
+	scalar_d2n(in + i, out + i, n - i);
+}
+
+
+static int sse2_available(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+
+__attribute__ ((target ("avx2")))
+static inline __m256i mulhi_epu32_avx2(__m256i x, __m256i m)
+{
+	__m256i even = _mm256_srli_epi64(_mm256_mul_epu32(x, m), 32);
+	__m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), m);
+
+	return _mm256_blend_epi32(even, odd, 0xaa);
+}
+
+
+__attribute__ ((target ("avx2")))
+static void avx2_n2d(const uint32_t *in, uint32_t *out, size_t n)
+{
+	const __m256i m = _mm256_set1_epi32((int)BULK_N2D_RECIP);
+	size_t i;
+
+	for (i=0; i+8<=n; i+=8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+		x = _mm256_add_epi32(x, mulhi_epu32_avx2(x, m));
+		_mm256_storeu_si256((__m256i *)(out + i), x);
+	}
+	scalar_n2d(in + i, out + i, n - i);
+}
+
+
+__attribute__ ((target ("avx2")))
+static void avx2_d2n(const uint32_t *in, uint32_t *out, size_t n)
+{
+	const __m256i m = _mm256_set1_epi32((int)BULK_D2N_RECIP);
+	size_t i;
+
+	for (i=0; i+8<=n; i+=8) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+		_mm256_storeu_si256((__m256i *)(out + i),
+				    mulhi_epu32_avx2(x, m));
+	}
+	scalar_d2n(in + i, out + i, n - i);
+}
+
+
+static int avx2_available(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif /* BULK_X86 */
+
+
+const struct BulkConversion bulk_conversions[] = {
+#ifdef BULK_X86
+	{ "avx2",   avx2_available,   avx2_n2d,   avx2_d2n   },
+	{ "sse2",   sse2_available,   sse2_n2d,   sse2_d2n   },
+#endif
+	{ "scalar", scalar_available, scalar_n2d, scalar_d2n },
+	{ 0, 0, 0, 0 },
+};
+
+
+/** The fastest way this CPU can do it, found on the first call. */
+static const struct BulkConversion *best;
+
+static const struct BulkConversion *best_conversion(void)
+{
+	const struct BulkConversion *bc;
+
+	if (! best) {
+		for (bc=bulk_conversions; bc->name; bc++) {
+			if (bc->available()) {
+				break;
+			}
+		}
+		best = bc;
+	}
+	return best;
+}
+
+
+void normal_seconds_to_decimal_array(const uint32_t *in, uint32_t *out,
+				     size_t n)
+{
+	best_conversion()->normalToDecimal(in, out, n);
+}
+
+
+void decimal_seconds_to_normal_array(const uint32_t *in, uint32_t *out,
+				     size_t n)
+{
+	best_conversion()->decimalToNormal(in, out, n);
+}
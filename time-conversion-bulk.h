@@ -0,0 +1,38 @@
+#ifndef time_conversion_bulk_h_INCLUDED
+#define time_conversion_bulk_h_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Convert arrays of seconds since midnight between normal and decimal, for
+   the host tools.  The answers are exactly the same as the functions in
+   time-conversion.h, but the arrays are done several at a time with SIMD
+   instructions where the CPU has them.
+
+   The input values must be times of day: normal seconds below 86400, and
+   decimal seconds below 100000.  in and out may be the same array. */
+
+void normal_seconds_to_decimal_array(const uint32_t *in, uint32_t *out,
+				     size_t n);
+void decimal_seconds_to_normal_array(const uint32_t *in, uint32_t *out,
+				     size_t n);
+
+
+/**
+ * One way of doing the array conversions.
+ *
+ * These are only needed to check and time each way separately.
+ */
+struct BulkConversion {
+	const char *name;
+	/** True if this CPU can do it this way. */
+	int (*available)(void);
+	void (*normalToDecimal)(const uint32_t *in, uint32_t *out, size_t n);
+	void (*decimalToNormal)(const uint32_t *in, uint32_t *out, size_t n);
+};
+
+/** All the ways, fastest first, ending with one that has a null name.  The
+    last one (scalar) is always available. */
+extern const struct BulkConversion bulk_conversions[];
+
+#endif
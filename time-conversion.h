@@ -0,0 +1,32 @@
+#ifndef time_conversion_h_INCLUDED
+#define time_conversion_h_INCLUDED
+
+#include <stdint.h>
+
+/* The conversions between normal and decimal seconds since midnight.  These
+   are shared by the firmware and decimal-time-conversion, so that both give
+   exactly the same answers.  There is no checking here, and nothing that
+   needs QP-nano.
+
+   A normal day has 86400 seconds and a decimal day has 100000, so the ratio
+   is 125/108.  The results are rounded down. */
+
+/**
+ * Convert normal seconds since midnight (0 to 86399) to decimal seconds since
+ * midnight (0 to 99999).
+ */
+inline static uint32_t normal_seconds_to_decimal(uint32_t seconds)
+{
+	return (seconds * 125L) / 108L;
+}
+
+/**
+ * Convert decimal seconds since midnight (0 to 99999) to normal seconds since
+ * midnight (0 to 86399).
+ */
+inline static uint32_t decimal_seconds_to_normal(uint32_t dseconds)
+{
+	return (dseconds * 108L) / 125L;
+}
+
+#endif
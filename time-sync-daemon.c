@@ -0,0 +1,289 @@
+/* Keep a clock built with TIME_SYNC=1 in step with this host's clock.
+   See time-sync.h for the protocol. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#include "time-sync.h"
+
+static char *myname;
+
+/** The clock's debug output is copied to stdout if this is true. */
+static int passText;
+
+static void usage(int retcode)
+{
+	fprintf(stderr, "Usage: %s [-i seconds] [-n count] [-t] device\n"
+		"  Keep the decimal clock on the serial device in step with\n"
+		"  this host's time.\n"
+		"  -i  Seconds between syncs (default 10).\n"
+		"  -n  Stop after this many syncs.\n"
+		"  -t  Copy the clock's debug output to stdout.\n",
+		myname);
+	exit(retcode);
+}
+
+
+/**
+ * The local time of day, in time sync units.
+ */
+static uint32_t hostTime(void)
+{
+	struct timespec ts;
+	struct tm tm;
+	int64_t dayNs;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&ts.tv_sec, &tm);
+	dayNs = (tm.tm_hour * 3600LL + tm.tm_min * 60
+		 + (tm.tm_sec > 59 ? 59 : tm.tm_sec)) * 1000000000LL
+		+ ts.tv_nsec;
+	/* A decimal second is 864000000ns.  This fits, since dayNs is less
+	   than 2^47. */
+	return (uint32_t)(dayNs * TIME_SYNC_UNITS / 864000000LL);
+}
+
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16)
+		| ((uint32_t)p[3] << 24);
+}
+
+
+static int openDevice(const char *device)
+{
+	int fd;
+	struct termios t;
+
+	fd = open(device, O_RDWR | O_NOCTTY);
+	if (fd < 0) {
+		perror(device);
+		exit(3);
+	}
+	if (tcgetattr(fd, &t) == 0) {
+		/* The clock runs at 115200 N81.  A pty doesn't care. */
+		cfmakeraw(&t);
+		cfsetispeed(&t, B115200);
+		cfsetospeed(&t, B115200);
+		t.c_cflag |= CLOCAL | CREAD;
+		t.c_cc[VMIN] = 1;
+		t.c_cc[VTIME] = 0;
+		tcsetattr(fd, TCSANOW, &t);
+	}
+	return fd;
+}
+
+
+/**
+ * Send a frame with one time in it.
+ *
+ * @return the host time just before it was sent.
+ */
+static uint32_t sendTimeFrame(int fd, uint8_t type, uint8_t seq,
+			      uint32_t t, int stampNow)
+{
+	uint8_t f[TIME_SYNC_TIME_FRAME_LEN];
+
+	f[0] = TIME_SYNC_START;
+	f[1] = type;
+	f[2] = seq;
+	if (stampNow)
+		t = hostTime();
+	put32(f + 3, t);
+	f[7] = time_sync_check(f, sizeof(f));
+	if (write(fd, f, sizeof(f)) != sizeof(f)) {
+		perror(myname);
+		exit(6);
+	}
+	return t;
+}
+
+
+/**
+ * Read until a frame of the given type and sequence number arrives, or the
+ * timeout.  Anything that isn't a frame is the clock's debug output.
+ *
+ * @param stamp set to the host time when the frame's first byte arrived.
+ * @return 0 for success, -1 for a timeout.
+ */
+static int readFrame(int fd, uint8_t type, uint8_t seq, uint8_t *f,
+		     uint8_t len, uint32_t *stamp, double timeout)
+{
+	static uint8_t buf[256];
+	static size_t have;
+	static size_t used;
+	struct timeval tv;
+	fd_set fds;
+	ssize_t got;
+	uint8_t n = 0;
+	uint32_t startStamp = 0;
+	uint32_t readStamp = 0;
+
+	for (;;) {
+		while (used < have) {
+			uint8_t c = buf[used++];
+
+			if (0 == n) {
+				if (c == TIME_SYNC_START) {
+					startStamp = readStamp;
+					f[n++] = c;
+				} else if (passText) {
+					putchar(c);
+				}
+				continue;
+			}
+			f[n++] = c;
+			if (2 == n && c != type) {
+				/* Some other frame, or a stray byte. */
+				n = 0;
+				continue;
+			}
+			if (n < len)
+				continue;
+			n = 0;
+			if (f[len-1] != time_sync_check(f, len) || f[2] != seq)
+				continue;
+			*stamp = startStamp;
+			return 0;
+		}
+		if (passText)
+			fflush(stdout);
+
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		tv.tv_sec = (long)timeout;
+		tv.tv_usec = (long)((timeout - tv.tv_sec) * 1e6);
+		if (select(fd + 1, &fds, 0, 0, &tv) <= 0)
+			return -1;
+		got = read(fd, buf, sizeof(buf));
+		readStamp = hostTime();
+		if (got <= 0) {
+			if (got < 0 && errno == EINTR)
+				continue;
+			fprintf(stderr, "%s: the device has gone\n", myname);
+			exit(3);
+		}
+		have = got;
+		used = 0;
+	}
+}
+
+
+static const char *statusName(uint8_t status)
+{
+	switch (status) {
+	case TIME_SYNC_SLEWING: return "slewing";
+	case TIME_SYNC_TOO_FAR: return "too far, set the time";
+	case TIME_SYNC_BAD_RTT: return "round trip too long";
+	case TIME_SYNC_BUSY: return "still slewing";
+	default: return "unknown";
+	}
+}
+
+
+/** Convert time sync units to ms. */
+static double unitsToMs(int32_t units)
+{
+	return units * 864.0 / TIME_SYNC_UNITS;
+}
+
+
+static void syncOnce(int fd, uint8_t seq)
+{
+	uint8_t f[TIME_SYNC_RESULT_FRAME_LEN];
+	uint32_t t1;
+	uint32_t t2;
+	uint32_t t4;
+	uint32_t unused;
+	int32_t offset;
+	int32_t rtt;
+
+	t1 = sendTimeFrame(fd, TIME_SYNC_POLL, seq, 0, 1);
+	if (readFrame(fd, TIME_SYNC_REPLY, seq, f, TIME_SYNC_TIME_FRAME_LEN,
+		      &t4, 1.0)) {
+		printf("sync %3u: no reply\n", seq);
+		return;
+	}
+	t2 = get32(f + 3);
+	sendTimeFrame(fd, TIME_SYNC_FOLLOWUP, seq, t4, 0);
+	if (readFrame(fd, TIME_SYNC_RESULT, seq, f,
+		      TIME_SYNC_RESULT_FRAME_LEN, &unused, 1.0)) {
+		/* Our rough idea, taking T3 as T2. */
+		offset = ((int32_t)(t2 - t1) + (int32_t)(t2 - t4)) / 2;
+		printf("sync %3u: no result, offset about %.2f ms\n",
+		       seq, unitsToMs(offset));
+		return;
+	}
+	offset = (int32_t)get32(f + 4);
+	rtt = (int32_t)get32(f + 8);
+	printf("sync %3u: offset %8.2f ms  rtt %6.2f ms  %s\n", seq,
+	       unitsToMs(offset), unitsToMs(rtt), statusName(f[3]));
+	fflush(stdout);
+}
+
+
+int main(int argc, char **argv)
+{
+	int opt;
+	double interval = 10;
+	long count = 0;
+	long n;
+	char *endp;
+	int fd;
+	uint8_t seq = 0;
+	uint32_t unused;
+	uint8_t f[TIME_SYNC_RESULT_FRAME_LEN];
+
+	myname = argv[0];
+	while ((opt = getopt(argc, argv, "i:n:t")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval = strtod(optarg, &endp);
+			if (*endp || interval <= 0)
+				usage(1);
+			break;
+		case 'n':
+			count = strtol(optarg, &endp, 10);
+			if (*endp || count <= 0)
+				usage(1);
+			break;
+		case 't':
+			passText = 1;
+			break;
+		default:
+			usage(1);
+		}
+	}
+	if (argc - optind != 1)
+		usage(1);
+	fd = openDevice(argv[optind]);
+
+	for (n=0; count <= 0 || n < count; n++) {
+		syncOnce(fd, ++seq);
+		if (count > 0 && n + 1 >= count)
+			break;
+		/* Pass on the debug output while we wait.  There are no
+		   frames with sequence zero, so this always times out. */
+		readFrame(fd, TIME_SYNC_RESULT, 0, f,
+			  TIME_SYNC_RESULT_FRAME_LEN, &unused, interval);
+	}
+	return 0;
+}
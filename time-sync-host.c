@@ -0,0 +1,676 @@
+/* Run the clock's time sync code on the host, on a pty, so time-sync-daemon
+   can be tested against it without a clock.
+
+   serial.c and timesync.c are the firmware's own.  The rest of the clock is
+   simulated here: timer 1 with its slewing and the normal seconds made from
+   it (copied from bsp-avr.c), the RTC's 1Hz output, and the parts of
+   timekeeper that align the decimal and normal seconds.  The timer and the
+   RTC can run fast or slow, and the RTC can start off the host's time.
+
+   Once every 125 decimal seconds we print how far the clock is from the
+   host, and the biggest step the clock has taken since the last report.
+   See TESTING. */
+
+/* For posix_openpt() and cfmakeraw(). */
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#include "dclock.h"
+#include "console.h"
+#include "serial.h"
+#include "timesync.h"
+#include "bsp.h"
+
+
+Q_DEFINE_THIS_FILE;
+
+
+volatile uint8_t SREG;
+volatile uint8_t UDR1;
+volatile uint8_t UCSR1A;
+volatile uint8_t UCSR1B;
+volatile uint8_t UCSR1C;
+volatile uint8_t UBRR1H;
+volatile uint8_t UBRR1L;
+volatile uint8_t DDRD;
+volatile uint8_t PORTD;
+
+void USART1_RX_vect(void);
+void USART1_UDRE_vect(void);
+
+/* serial.c posts to the console, which isn't here.  It's never ready, so
+   nothing is posted. */
+struct Console console;
+QActiveCB const Q_ROM Q_ROM_VAR QF_active[] = {
+	{ (QActive *)0, (QEvent *)0, 0 },
+};
+
+static char *myname;
+
+
+void Q_onAssert(char const Q_ROM * const Q_ROM_VAR file, int line)
+{
+	fprintf(stderr, "%s: assertion failed at %s:%d\n", myname, file, line);
+	exit(2);
+}
+
+void QActive_post(QActive *me, QSignal sig, QParam par)
+{
+	Q_onAssert(__FILE__, __LINE__);
+}
+
+void QActive_postISR(QActive *me, QSignal sig, QParam par)
+{
+	Q_onAssert(__FILE__, __LINE__);
+}
+
+void QActive_postLatestISR(QActive *me, QSignal sig, QParam par)
+{
+	Q_onAssert(__FILE__, __LINE__);
+}
+
+
+static void usage(int retcode)
+{
+	fprintf(stderr, "Usage: %s [-l link] [-p ppm] [-r ms] [-d ppm] "
+		"[-s seconds] [-u]\n"
+		"  Pretend to be a clock built with TIME_SYNC=1, on a pty.\n"
+		"  -l  Make a symlink to the pty.\n"
+		"  -p  How fast the CPU crystal runs, in ppm (default 30).\n"
+		"  -r  How far the RTC is ahead of this host, in ms "
+		"(default 100).\n"
+		"  -d  How fast the RTC runs, in ppm (default 2).\n"
+		"  -s  Stop after this many seconds.\n"
+		"  -u  Never take the normal seconds from the timer, so the\n"
+		"      decimal seconds are aligned to the RTC every 108 "
+		"seconds.\n",
+		myname);
+	exit(retcode);
+}
+
+
+/* The simulation runs in real time, as the daemon uses the real time of day.
+   Times here are seconds since startTime. */
+
+#define TIMER1_TOP 54000
+#define TIMER1_HZ 2000000.0
+
+static double startTime;
+/** The host's local time of day at startTime, in seconds. */
+static double startDay;
+
+/** Timer 1 counts per second, with the crystal's error. */
+static double timerHz;
+/** The timer 1 count when the current tick started, counting from
+    startTime. */
+static double tickStart;
+/** The length of the current tick, latched from OCR1A when it started. */
+static uint16_t tickTop;
+static uint16_t OCR1A;
+
+/** When timer 3 will fire, in timer 1 counts, or negative if it's
+    stopped. */
+static double timer3Due = -1;
+
+/** The RTC's time of day at startTime, and how fast it runs. */
+static double rtcStartDay;
+static double rtcRate;
+/** The RTC's next 1Hz edge. */
+static double rtcNextEdge;
+
+static int noLock;
+
+
+static double realNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9 - startTime;
+}
+
+
+static double countsToReal(double counts)
+{
+	return counts / timerHz;
+}
+
+
+/** The host's time of day, in seconds. */
+static double hostDay(double t)
+{
+	return startDay + t;
+}
+
+
+/** The difference of two times of day, in ms, allowing for midnight. */
+static double dayDiffMs(double a, double b)
+{
+	double d = fmod(a - b, 86400.0);
+
+	if (d > 43200.0) {
+		d -= 86400.0;
+	} else if (d < -43200.0) {
+		d += 86400.0;
+	}
+	return d * 1000.0;
+}
+
+
+/* From here to "end of bsp-avr.c" is the TIME_SYNC code in bsp-avr.c, with
+   the timer 1 and timer 3 registers replaced by the simulation.  Keep them
+   in step. */
+
+static uint8_t decimal_32_counter;
+static uint32_t sync_ticks;
+static int32_t slew_counts;
+#define SLEW_STEP 54
+static uint8_t normal_from_timer;
+static uint16_t block_ticks;
+static uint8_t normal_index;
+
+static uint16_t TCNT1(void)
+{
+	return (uint16_t)(timerHz * realNow() - tickStart);
+}
+
+uint32_t BSP_sync_stamp(void)
+{
+	/* The main loop runs the ticks as they're due, so none are ever
+	   pending here. */
+	return (sync_ticks << 11) + ((uint32_t)TCNT1() * 128 / 3375);
+}
+
+uint32_t BSP_sync_second_stamp(void)
+{
+	return (sync_ticks - (decimal_32_counter % 32)) << 11;
+}
+
+void BSP_slew(int32_t counts)
+{
+	slew_counts = counts;
+}
+
+uint8_t BSP_slewing(void)
+{
+	return slew_counts != 0;
+}
+
+static void slew_tick(void)
+{
+	uint8_t step;
+
+	if (slew_counts > 0) {
+		step = slew_counts > SLEW_STEP ? SLEW_STEP : slew_counts;
+		OCR1A = TIMER1_TOP - step;
+		slew_counts -= step;
+	} else if (slew_counts < 0) {
+		step = slew_counts < -SLEW_STEP ? SLEW_STEP : - slew_counts;
+		OCR1A = TIMER1_TOP + step;
+		slew_counts += step;
+	} else {
+		OCR1A = TIMER1_TOP;
+	}
+}
+
+static uint16_t normal_start_tick(uint8_t i)
+{
+	return (uint16_t)i * 1000 / 27;
+}
+
+static uint16_t normal_start_counts(uint8_t i)
+{
+	return ((uint16_t)i * 1000 % 27) * 2000;
+}
+
+uint8_t BSP_normal_from_timer(uint8_t decimal125)
+{
+	uint8_t i;
+
+	Q_ASSERT( decimal125 < 125 );
+	block_ticks = decimal125 * 32 + decimal_32_counter % 32;
+	i = 0;
+	while (i < 108 && normal_start_tick(i) <= block_ticks) {
+		i ++;
+	}
+	normal_index = (i == 108) ? 0 : i;
+	normal_from_timer = 73;
+	return i - 1;
+}
+
+void BSP_normal_from_rtc(void)
+{
+	normal_from_timer = 0;
+	timer3Due = -1;
+}
+
+static void timekeeper_normal_second(uint8_t source, double when);
+
+static void normal_tick(void)
+{
+	uint16_t counts;
+
+	if (! normal_from_timer) {
+		return;
+	}
+	block_ticks ++;
+	if (block_ticks >= 4000) {
+		block_ticks = 0;
+	}
+	if (block_ticks != normal_start_tick(normal_index)) {
+		return;
+	}
+	counts = normal_start_counts(normal_index);
+	normal_index ++;
+	if (normal_index >= 108) {
+		normal_index = 0;
+	}
+	if (0 == counts) {
+		timekeeper_normal_second(BSP_NORMAL_FROM_TIMER,
+					 countsToReal(tickStart));
+		return;
+	}
+	timer3Due = tickStart + counts;
+}
+
+/* end of bsp-avr.c */
+
+
+/* The parts of timekeeper that keep the decimal and normal seconds in
+   step. */
+
+static uint32_t decimaltime;
+/** The normal time of day, in seconds. */
+static uint32_t normaltime;
+static uint8_t decimal125Count;
+static uint8_t normal108Count;
+static uint8_t timebaseLocked;
+
+/* What we tell the user. */
+static double lastError;
+static uint8_t haveLastError;
+static double biggestStep;
+static double normalError;
+static unsigned realigns;
+static unsigned seconds;
+
+static void report(double when)
+{
+	printf("%7.0f s  offset %+8.2f ms  biggest step %6.2f ms  "
+	       "normal %+8.2f ms  %s  realigns %u\n",
+	       when, lastError, biggestStep, normalError,
+	       timebaseLocked ? "following host" : "following RTC ",
+	       realigns);
+	fflush(stdout);
+	biggestStep = 0;
+}
+
+
+static void setup_108_125(void)
+{
+	normal108Count = normaltime % 108;
+	decimal125Count = decimaltime % 125;
+	if (timebaseLocked) {
+		BSP_normal_from_rtc();
+		timebaseLocked = 0;
+	}
+}
+
+
+static void follow_host(double when)
+{
+	uint8_t decimal125;
+	uint8_t normal108;
+
+	if (timesync_in_step()) {
+		if (timebaseLocked || noLock) {
+			return;
+		}
+		printf("%7.0f s  following the host\n", when);
+		decimal125 = decimaltime % 125;
+		normal108 = BSP_normal_from_timer(decimal125);
+		normaltime = (decimaltime - decimal125) * 108 / 125
+			+ normal108;
+		setup_108_125();
+		timebaseLocked = 73;
+	} else if (timebaseLocked) {
+		printf("%7.0f s  lost the host\n", when);
+		BSP_normal_from_rtc();
+		timebaseLocked = 0;
+		/* verifyRTCState only takes the normal time.  The decimal
+		   time is aligned to it at the next 108 second boundary. */
+		normaltime = (uint32_t)floor(rtcStartDay + when * rtcRate)
+			% 86400;
+		normal108Count = normaltime % 108;
+	}
+}
+
+
+/** The start of a decimal second, from decimal_32_tick(). */
+static void timekeeper_decimal_second(double when)
+{
+	double error;
+
+	if (99999 == decimaltime) {
+		decimaltime = 0;
+	} else {
+		decimaltime ++;
+	}
+	if (decimal125Count < 124) {
+		decimal125Count ++;
+	} else if (timebaseLocked) {
+		decimal125Count = 0;
+	}
+	timesync_second(decimaltime);
+	follow_host(when);
+
+	error = dayDiffMs(decimaltime * 0.864, hostDay(when));
+	if (haveLastError && fabs(error - lastError) > biggestStep) {
+		biggestStep = fabs(error - lastError);
+	}
+	lastError = error;
+	haveLastError = 1;
+	seconds ++;
+	if (0 == seconds % 125) {
+		report(when);
+	}
+}
+
+
+static void timekeeper_normal_second(uint8_t source, double when)
+{
+	if ((BSP_NORMAL_FROM_TIMER == source) != !!timebaseLocked) {
+		return;
+	}
+	normaltime = (normaltime + 1) % 86400;
+	normalError = dayDiffMs(normaltime, hostDay(when));
+	normal108Count ++;
+	if (108 == normal108Count) {
+		normal108Count = 0;
+		if (timebaseLocked) {
+			return;
+		}
+		/* synchronise_108_125(), which starts a new decimal second at
+		   the last tick. */
+		decimal_32_counter = 0;
+		decimal125Count = 0;
+		decimaltime = normaltime * 125 / 108;
+		realigns ++;
+	}
+}
+
+
+static void decimal_32_tick(double when)
+{
+	if (decimal_32_counter >= 32) {
+		decimal_32_counter = 0;
+	}
+	decimal_32_counter ++;
+	sync_ticks ++;
+	if (32 == decimal_32_counter) {
+		timekeeper_decimal_second(when);
+	}
+}
+
+
+/** Run everything that's due by now, in order. */
+static void run_due(double now)
+{
+	double nowCounts = now * timerHz;
+	double tickEnd;
+	double rtcEdgeCounts;
+
+	for (;;) {
+		tickEnd = tickStart + tickTop + 1;
+		rtcEdgeCounts = rtcNextEdge * timerHz;
+		if (timer3Due >= 0 && timer3Due <= tickEnd
+		    && timer3Due <= rtcEdgeCounts && timer3Due <= nowCounts) {
+			/* TIMER3_COMPA_vect */
+			double when = countsToReal(timer3Due);
+
+			timer3Due = -1;
+			timekeeper_normal_second(BSP_NORMAL_FROM_TIMER, when);
+		} else if (rtcEdgeCounts <= tickEnd
+			   && rtcEdgeCounts <= nowCounts) {
+			/* INT6_vect */
+			timekeeper_normal_second(BSP_NORMAL_FROM_RTC,
+						 rtcNextEdge);
+			rtcNextEdge += 1.0 / rtcRate;
+		} else if (tickEnd <= nowCounts) {
+			/* TIMER1_COMPA_vect, at the start of the next tick.
+			   OCR1A is double buffered, so the new tick is the
+			   length set in the last one. */
+			tickStart = tickEnd;
+			tickTop = OCR1A;
+			slew_tick();
+			normal_tick();
+			decimal_32_tick(countsToReal(tickStart));
+		} else {
+			break;
+		}
+	}
+}
+
+
+/** When the next thing is due. */
+static double next_due(void)
+{
+	double next = countsToReal(tickStart + tickTop + 1);
+
+	if (rtcNextEdge < next) {
+		next = rtcNextEdge;
+	}
+	if (timer3Due >= 0 && countsToReal(timer3Due) < next) {
+		next = countsToReal(timer3Due);
+	}
+	return next;
+}
+
+
+/** Send whatever serial.c has queued. */
+static void send_all(int fd)
+{
+	uint8_t buf[256];
+	size_t n = 0;
+
+	while (UCSR1B & (1 << UDRIE1)) {
+		USART1_UDRE_vect();
+		if (UCSR1B & (1 << UDRIE1)) {
+			buf[n++] = UDR1;
+			if (n == sizeof(buf)) {
+				break;
+			}
+		}
+	}
+	if (n && write(fd, buf, n) != (ssize_t)n) {
+		perror(myname);
+		exit(3);
+	}
+}
+
+
+static int open_pty(const char *link)
+{
+	int fd;
+	char *name;
+	struct termios t;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) || unlockpt(fd)
+	    || ! (name = ptsname(fd))) {
+		perror(myname);
+		exit(3);
+	}
+	if (tcgetattr(fd, &t) == 0) {
+		cfmakeraw(&t);
+		tcsetattr(fd, TCSANOW, &t);
+	}
+	if (link) {
+		unlink(link);
+		if (symlink(name, link)) {
+			perror(link);
+			exit(3);
+		}
+		name = (char *)link;
+	}
+	printf("The clock is on %s\n", name);
+	fflush(stdout);
+	return fd;
+}
+
+
+static void start(double timerPpm, double rtcAheadMs, double rtcPpm)
+{
+	struct timespec ts;
+	struct tm tm;
+	double clockDay;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	startTime = ts.tv_sec + ts.tv_nsec / 1e9;
+	localtime_r(&ts.tv_sec, &tm);
+	startDay = tm.tm_hour * 3600 + tm.tm_min * 60
+		+ (tm.tm_sec > 59 ? 59 : tm.tm_sec) + ts.tv_nsec / 1e9;
+
+	timerHz = TIMER1_HZ * (1 + timerPpm / 1e6);
+	rtcRate = 1 + rtcPpm / 1e6;
+	rtcStartDay = startDay + rtcAheadMs / 1000.0;
+	rtcNextEdge = (ceil(rtcStartDay) - rtcStartDay) / rtcRate;
+
+	/* The clock was started from the RTC, and its decimal seconds were
+	   aligned to the RTC's seconds the last time round. */
+	normaltime = (uint32_t)floor(rtcStartDay) % 86400;
+	clockDay = rtcStartDay;
+	decimaltime = (uint32_t)floor(clockDay / 0.864);
+	/* Start the decimal second we're in, going back from now. */
+	decimal_32_counter = 0;
+	tickTop = TIMER1_TOP;
+	OCR1A = TIMER1_TOP;
+	tickStart = - (clockDay / 0.864 - decimaltime) * 0.864 * timerHz;
+	decimaltime %= 100000;
+	setup_108_125();
+	timesync_time_set(decimaltime);
+}
+
+
+static volatile sig_atomic_t stopping;
+
+static void stop(int sig)
+{
+	stopping = 1;
+}
+
+
+int main(int argc, char **argv)
+{
+	int opt;
+	char *endp;
+	const char *link = 0;
+	double timerPpm = 30;
+	double rtcAheadMs = 100;
+	double rtcPpm = 2;
+	double stopAfter = 0;
+	int fd;
+	uint8_t buf[64];
+	ssize_t got;
+	ssize_t i;
+	fd_set fds;
+	struct timeval tv;
+	double wait;
+
+	myname = argv[0];
+	while ((opt = getopt(argc, argv, "l:p:r:d:s:u")) != -1) {
+		switch (opt) {
+		case 'l':
+			link = optarg;
+			break;
+		case 'p':
+			timerPpm = strtod(optarg, &endp);
+			if (*endp)
+				usage(1);
+			break;
+		case 'r':
+			rtcAheadMs = strtod(optarg, &endp);
+			if (*endp)
+				usage(1);
+			break;
+		case 'd':
+			rtcPpm = strtod(optarg, &endp);
+			if (*endp)
+				usage(1);
+			break;
+		case 's':
+			stopAfter = strtod(optarg, &endp);
+			if (*endp || stopAfter <= 0)
+				usage(1);
+			break;
+		case 'u':
+			noLock = 1;
+			break;
+		default:
+			usage(1);
+		}
+	}
+	if (argc != optind)
+		usage(1);
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	fd = open_pty(link);
+	serial_init();
+	start(timerPpm, rtcAheadMs, rtcPpm);
+
+	while (! stopping && (stopAfter <= 0 || realNow() < stopAfter)) {
+		run_due(realNow());
+		send_all(fd);
+
+		wait = next_due() - realNow();
+		if (wait < 0) {
+			wait = 0;
+		}
+		FD_ZERO(&fds);
+		FD_SET(fd, &fds);
+		tv.tv_sec = (long)wait;
+		tv.tv_usec = (long)((wait - tv.tv_sec) * 1e6);
+		if (select(fd + 1, &fds, 0, 0, &tv) <= 0) {
+			continue;
+		}
+		got = read(fd, buf, sizeof(buf));
+		if (got < 0 && errno != EINTR && errno != EIO) {
+			perror(myname);
+			exit(3);
+		}
+		if (got <= 0) {
+			/* Nothing has the pty open yet. */
+			usleep(10000);
+			continue;
+		}
+		for (i=0; i<got; i++) {
+			run_due(realNow());
+			UCSR1A = 0;
+			UDR1 = buf[i];
+			USART1_RX_vect();
+			send_all(fd);
+		}
+	}
+
+	if (haveLastError) {
+		report(realNow());
+	}
+	if (link) {
+		unlink(link);
+	}
+	return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef time_sync_h_INCLUDED
+#define time_sync_h_INCLUDED
+
+#include <stdint.h>
+
+/* The serial time sync protocol, shared by the firmware (timesync.c) and the
+   host (time-sync-daemon.c).
+
+   Times are the local decimal time of day in 1/65536ths of a decimal second
+   (about 13us), modulo 2^32.  So the top 16 bits are the decimal seconds
+   since midnight, modulo 65536.  Multi-byte values are little endian.
+
+   Every frame is TIME_SYNC_START, a type, a sequence number, the data, and a
+   check byte, which is the complement of the sum of the type, sequence and
+   data bytes.  The clock's debug output is text, and never contains
+   TIME_SYNC_START, so the frames can be picked out of it.
+
+   An exchange goes like this, like NTP:
+
+	host                                    clock
+	T1 = now
+	POLL(seq, T1)           ------->
+	                                        T2 = when POLL started arriving
+	                        <-------        REPLY(seq, T2)
+	                                        T3 = when REPLY started going
+	T4 = when REPLY arrived
+	FOLLOWUP(seq, T4)       ------->
+	                                        offset = ((T2-T1) + (T3-T4)) / 2
+	                                        rtt = (T4-T1) - (T3-T2)
+	                        <-------        RESULT(seq, status, offset, rtt)
+
+   A positive offset means the clock is ahead.  The clock slews towards the
+   host's time, rather than jumping. */
+
+/** ASCII SYN. */
+#define TIME_SYNC_START 0x16
+
+#define TIME_SYNC_POLL 'P'
+#define TIME_SYNC_REPLY 'R'
+#define TIME_SYNC_FOLLOWUP 'F'
+#define TIME_SYNC_RESULT 'A'
+
+/** The length of POLL, REPLY and FOLLOWUP, which carry one time. */
+#define TIME_SYNC_TIME_FRAME_LEN 8
+/** The length of RESULT: status, offset and rtt. */
+#define TIME_SYNC_RESULT_FRAME_LEN 13
+
+/** Units of time per decimal second. */
+#define TIME_SYNC_UNITS 65536L
+
+/** The offset is being slewed out. */
+#define TIME_SYNC_SLEWING 0
+/** The offset is too big to slew.  The time must be set instead. */
+#define TIME_SYNC_TOO_FAR 1
+/** The round trip took too long to be sure of the offset. */
+#define TIME_SYNC_BAD_RTT 2
+/** The last offset is still being slewed out. */
+#define TIME_SYNC_BUSY 3
+
+/** The biggest offset the clock will slew out, 1 decimal second. */
+#define TIME_SYNC_MAX_OFFSET TIME_SYNC_UNITS
+/** The longest round trip the clock will use, 0.05 decimal seconds. */
+#define TIME_SYNC_MAX_RTT (TIME_SYNC_UNITS / 20)
+
+
+/**
+ * The check byte for a frame.
+ *
+ * @param frame the whole frame, starting with TIME_SYNC_START.
+ * @param len the length of the frame, including the check byte.
+ */
+static inline uint8_t time_sync_check(const uint8_t *frame, uint8_t len)
+{
+	uint8_t sum = 0;
+	uint8_t i;
+
+	for (i=1; i<len-1; i++) {
+		sum += frame[i];
+	}
+	return ~sum;
+}
+
+#endif
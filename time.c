@@ -1,4 +1,5 @@
 #include "time.h"
+#include "time-conversion.h"
 #include "qpn_port.h"
 #include "dclock.h"
 #include "timekeeper.h"
@@ -46,7 +47,7 @@ struct NormalTime decimal_to_normal(uint32_t dtime)
 
 	Q_ASSERT( dtime <= 99999 );
 
-	dtime = (dtime * 108L) / 125L;
+	dtime = decimal_seconds_to_normal(dtime);
 	normaltime.s = dtime % 60;
 	dtime /= 60L;
 	normaltime.m = dtime % 60;
@@ -66,7 +67,7 @@ uint32_t normal_to_decimal(struct NormalTime ntime)
 	Q_ASSERT( ntime.h < 24 );
 
 	seconds = ntime.s + (ntime.m * 60L) + (ntime.h * 3600L);
-	return (seconds * 125L) / 108L;
+	return normal_seconds_to_decimal(seconds);
 }
 
 
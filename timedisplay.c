@@ -6,8 +6,10 @@
 #include "dclock.h"
 #include "serial.h"
 #include "bsp.h"
+#include "boot-trace.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 Q_DEFINE_THIS_FILE;
@@ -15,6 +17,9 @@ Q_DEFINE_THIS_FILE;
 
 static QState initial              (struct TimeDisplay *me);
 static QState top                  (struct TimeDisplay *me);
+static QState starting             (struct TimeDisplay *me);
+static QState lcdStarting          (struct TimeDisplay *me);
+static QState splash               (struct TimeDisplay *me);
 static QState normal               (struct TimeDisplay *me);
 static QState decimal              (struct TimeDisplay *me);
 static QState setting              (struct TimeDisplay *me);
@@ -30,22 +35,30 @@ static void lights_off(void);
 struct TimeDisplay timedisplay;
 
 
-void timedisplay_ctor(void)
+/**
+ * Convert a delay in ms to QF ticks.  The first tick can come straight away,
+ * so add one, and one more to round up.
+ */
+#define MS_TO_TICKS(ms) ((uint16_t)(ms) * BSP_TICKS_PER_SECOND / 864 + 2)
+
+
+void timedisplay_ctor(uint8_t resetFlags)
 {
 	QActive_ctor((QActive*)(&timedisplay), (QStateHandler)initial);
 	timedisplay.ready = 0;
 	timedisplay.statuses = 0;
+	timedisplay.resetFlags = resetFlags;
 }
 
 
 static QState initial(struct TimeDisplay *me)
 {
-	lcd_clear();
-	LCD_LINE1_ROM("    A clock!");
-	LCD_LINE2_ROM(V);
-	return Q_TRAN(decimal);	/* FIXME wait for a signal in top() before
-				   doing the transition to the correct
-				   state. */
+	/* After a watchdog reset, the LCD may be ready already. */
+	if (lcd_ready()) {
+		return Q_TRAN(splash);
+	} else {
+		return Q_TRAN(lcdStarting);
+	}
 }
 
 
@@ -236,6 +249,98 @@ static QState top(struct TimeDisplay *me)
 }
 
 
+/**
+ * We don't know the time yet.  Remember the alarm status until we can show
+ * it.
+ */
+static QState starting(struct TimeDisplay *me)
+{
+	switch (Q_SIG(me)) {
+	case ALARM_ON_SIGNAL:
+		me->statuses |= DSTAT_ALARM;
+		return Q_HANDLED();
+	case ALARM_OFF_SIGNAL:
+		me->statuses &= ~DSTAT_ALARM;
+		return Q_HANDLED();
+	case SETTING_TIME_SIGNAL:
+	case TICK_DECIMAL_SIGNAL:
+	case TICK_NORMAL_SIGNAL:
+		return Q_HANDLED();
+	}
+	return Q_SUPER(top);
+}
+
+
+/**
+ * Wait for the LCD to get through its power on sequence.
+ *
+ * We wait with a timer instead of in lcd_init(), so the RTC is read and the
+ * other objects start at the same time.  Remember the mode until we can show
+ * the time.
+ */
+static QState lcdStarting(struct TimeDisplay *me)
+{
+	uint8_t ms;
+
+	switch (Q_SIG(me)) {
+	case Q_ENTRY_SIG:
+		QActive_arm((QActive*)me, MS_TO_TICKS(55));
+		return Q_HANDLED();
+	case Q_TIMEOUT_SIG:
+		ms = lcd_init_next();
+		if (ms) {
+			QActive_arm((QActive*)me, MS_TO_TICKS(ms));
+			return Q_HANDLED();
+		}
+		BOOT_TRACE_MARK("lcd ready");
+		if (me->mode) {
+			/* We already know the time, so show it instead of
+			   the startup message. */
+			return Q_TRAN(getModeState(me));
+		} else {
+			return Q_TRAN(splash);
+		}
+	case NORMAL_MODE_SIGNAL:
+		me->mode = NORMAL_MODE;
+		return Q_HANDLED();
+	case DECIMAL_MODE_SIGNAL:
+		me->mode = DECIMAL_MODE;
+		return Q_HANDLED();
+	case ALARM_RUNNING_SIGNAL:
+		/* Unlikely this early, but don't wait to show the alarm. */
+		QActive_disarm((QActive*)me);
+		lcd_init_finish();
+		return Q_TRAN(alarming1);
+	}
+	return Q_SUPER(starting);
+}
+
+
+/**
+ * Show the reason for the reset and the version until timekeeper tells us
+ * the mode, which it does once it knows the time.
+ */
+static QState splash(struct TimeDisplay *me)
+{
+	char line[17];
+
+	switch (Q_SIG(me)) {
+	case Q_ENTRY_SIG:
+		strcpy(line, "Startup: ----");
+		if (me->resetFlags & (1<<3)) line[9] = 'W';
+		if (me->resetFlags & (1<<2)) line[10] = 'B';
+		if (me->resetFlags & (1<<1)) line[11] = 'X';
+		if (me->resetFlags & (1<<0)) line[12] = 'P';
+		lcd_clear();
+		lcd_line1(line);
+		LCD_LINE2_ROM(V);
+		BOOT_TRACE_MARK("splash shown");
+		return Q_HANDLED();
+	}
+	return Q_SUPER(starting);
+}
+
+
 static QState normal(struct TimeDisplay *me)
 {
 	switch (Q_SIG(me)) {
@@ -243,12 +348,13 @@ static QState normal(struct TimeDisplay *me)
 		me->mode = NORMAL_MODE;
 		displayNormalTime(me, get_normal_time());
 		displayStatus(me);
+		BOOT_TRACE_DONE("time shown");
 		return Q_HANDLED();
 	case TICK_DECIMAL_SIGNAL:
 		/* In normal mode, ignore decimal seconds. */
 		return Q_HANDLED();
 	case TICK_NORMAL_SIGNAL:
-		displayNormalTime(me, it2nt(Q_PAR(me)));
+		displayNormalTime(me, it2nt(QF_LATEST_VALUE(Q_PAR(me))));
 		displayStatus(me);
 		return Q_HANDLED();
 	}
@@ -265,9 +371,10 @@ static QState decimal(struct TimeDisplay *me)
 		   having to wait for the next second. */
 		displayDecimalTime(me, get_decimal_time());
 		displayStatus(me);
+		BOOT_TRACE_DONE("time shown");
 		return Q_HANDLED();
 	case TICK_DECIMAL_SIGNAL:
-		displayDecimalTime(me, Q_PAR(me));
+		displayDecimalTime(me, QF_LATEST_VALUE(Q_PAR(me)));
 		displayStatus(me);
 		return Q_HANDLED();
 	case TICK_NORMAL_SIGNAL:
@@ -291,6 +398,11 @@ static QState setting(struct TimeDisplay *me)
 }
 
 
+/**
+ * The alarm shows over whichever of the normal or decimal displays is in use,
+ * so the parent state depends on the mode, and is given with
+ * Q_SUPER_DYNAMIC().
+ */
 static QState alarming(struct TimeDisplay *me)
 {
 	switch (Q_SIG(me)) {
@@ -323,7 +435,7 @@ static QState alarming(struct TimeDisplay *me)
 		BSP_buzzer_off();
 		return Q_HANDLED();
 	}
-	return Q_SUPER(getModeState(me));
+	return Q_SUPER_DYNAMIC(getModeState(me));
 }
 
 
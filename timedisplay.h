@@ -9,6 +9,9 @@ struct TimeDisplay {
 	uint8_t statuses;
 	uint8_t ready;
 
+	/** The MCUSR reset flags, for the startup message. */
+	uint8_t resetFlags;
+
 	/** The alarm sound volume */
 	uint8_t volume;
 	/** The LCD brightness when the alarm started running. */
@@ -35,7 +38,7 @@ enum DisplayStatus {
 	DSTAT_ALARM_RUNNING = 0x04,
 };
 
-void timedisplay_ctor(void);
+void timedisplay_ctor(uint8_t resetFlags);
 
 void display_status_on(enum DisplayStatus ds);
 void display_status_off(enum DisplayStatus ds);
@@ -17,7 +17,11 @@
 #include "alarm.h"
 #include "bsp.h"
 #include "timedisplay.h"
+#include "boot-trace.h"
+#include "settings.h"
+#include "timesync.h"
 #include <stdio.h>
+#include <stddef.h>
 
 
 Q_DEFINE_THIS_FILE;
@@ -26,16 +30,44 @@ Q_DEFINE_THIS_FILE;
 struct Timekeeper timekeeper;
 
 
+/**
+ * The time and mode, kept where the C runtime doesn't clear them at reset.
+ *
+ * After a watchdog reset we carry on from here straight away, instead of
+ * waiting for the LCD to be initialised and the RTC to be read.  If we're
+ * reset while this is being written, the check byte will be wrong and we do
+ * a normal start.
+ */
+struct WarmState {
+	uint8_t magic;
+	uint32_t decimaltime;
+	struct NormalTime normaltime;
+	uint8_t dayofweek;
+	uint8_t mode;
+	/** Where we were in the decimal second. */
+	uint8_t decimal32;
+	uint8_t check;
+};
+
+#define WARM_STATE_MAGIC 0x3d
+
+static struct WarmState warmState __attribute__ ((section (".noinit")));
+
+
 static QState tkInitial                (struct Timekeeper *me);
 static QState topState                 (struct Timekeeper *me);
 static QState startupState             (struct Timekeeper *me);
 static QState readRTCState             (struct Timekeeper *me);
+static QState rtcBusyState             (struct Timekeeper *me);
+static QState verifyRTCState           (struct Timekeeper *me);
 static QState setupRTCState            (struct Timekeeper *me);
 static QState runningState             (struct Timekeeper *me);
 static QState tkSetTimeState           (struct Timekeeper *me);
 static QState tkSetAlarmState          (struct Timekeeper *me);
+static QState tkSetDayState            (struct Timekeeper *me);
 
 static void inc_decimaltime(struct Timekeeper *me);
+static void decimal_second(struct Timekeeper *me);
 static void inc_normaltime(struct Timekeeper *me);
 static void rtc_to_normal(uint8_t *bytes, struct NormalTime *normaltime);
 static void normal_to_rtc(struct NormalTime *normaltime, uint8_t *bytes);
@@ -45,10 +77,33 @@ static void setupRTCdata(uint8_t *bytes);
 static void start_rtc_twi_read(struct Timekeeper *me,
 			       uint8_t reg, uint8_t nbytes);
 static void default_times(struct Timekeeper *me);
-static void set_alarm_alarm_times(uint8_t *bytes);
+static void set_alarm_alarm_times(uint8_t *bytes, uint8_t on);
+static uint8_t rtc_to_day(uint8_t byte);
+static QState rtc_busy_done(struct Timekeeper *me);
+static void new_time(struct Timekeeper *me);
+static void rtc_alarm_settings(struct Timekeeper *me);
+static uint8_t warm_state_check(void);
+static void save_warm_state(struct Timekeeper *me, uint8_t decimal32);
+
+#ifdef RTC_ALARM_INTERRUPT
+static void rtc_alarm(struct Timekeeper *me);
+#endif
 
 static void setup_108_125(struct Timekeeper *me);
 static void synchronise_108_125(struct Timekeeper *me);
+#ifdef TIME_SYNC
+static void follow_host(struct Timekeeper *me);
+#endif
+#ifdef POWER_STATS
+static void report_power_stats(void);
+#endif
+#ifdef TICK_LATENCY
+static void record_tick_latency(void);
+static void report_tick_latency(void);
+#endif
+#ifdef STACK_STATS
+static void report_stack_stats(void);
+#endif
 
 void timekeeper_ctor(void)
 {
@@ -59,6 +114,74 @@ void timekeeper_ctor(void)
 	/* We need to start in normal mode since we do things with normal time
 	   and the alarm very early on. */
 	timekeeper.mode = NORMAL_MODE;
+	timekeeper.startMode = settings_get(SETTING_TIME_MODE);
+	timekeeper.dayofweek = 0;
+	timekeeper.warm = 0;
+}
+
+
+static uint8_t warm_state_check(void)
+{
+	uint8_t *p = (uint8_t *)(&warmState);
+	uint8_t sum = 0;
+
+	for (uint8_t i=0; i<offsetof(struct WarmState, check); i++) {
+		sum += p[i];
+	}
+	return ~sum;
+}
+
+
+/**
+ * Remember the time and mode in case the watchdog resets us.
+ *
+ * @param decimal32 how far we are through the current decimal second, in
+ * 32nds.
+ */
+static void save_warm_state(struct Timekeeper *me, uint8_t decimal32)
+{
+	warmState.magic = WARM_STATE_MAGIC;
+	warmState.decimaltime = me->decimaltime;
+	warmState.normaltime = me->normaltime;
+	warmState.dayofweek = me->dayofweek;
+	warmState.mode = me->mode;
+	warmState.decimal32 = decimal32;
+	warmState.check = warm_state_check();
+}
+
+
+/**
+ * After a watchdog reset, carry on with the time from before the reset if it
+ * looks right.  Call this after timekeeper_ctor().
+ *
+ * The time is checked against the RTC once we're running (see
+ * verifyRTCState()), so it doesn't matter that the clock stopped for a moment
+ * during the reset.
+ *
+ * @return true if the time was restored.
+ */
+uint8_t timekeeper_warm_start(void)
+{
+	struct WarmState *w = &warmState;
+
+	if (w->magic != WARM_STATE_MAGIC
+	    || w->check != warm_state_check()
+	    || w->decimaltime > 99999L
+	    || w->normaltime.h > 23 || w->normaltime.m > 59
+	    || w->normaltime.s > 59
+	    || w->dayofweek > 6
+	    || (w->mode != NORMAL_MODE && w->mode != DECIMAL_MODE)
+	    || w->decimal32 > 32) {
+		SERIALSTR("no warm state\r\n");
+		return 0;
+	}
+	timekeeper.decimaltime = w->decimaltime;
+	timekeeper.normaltime = w->normaltime;
+	timekeeper.dayofweek = w->dayofweek;
+	timekeeper.startMode = w->mode;
+	timekeeper.warm = 73;
+	BSP_set_decimal_32_counter(w->decimal32);
+	return 73;
 }
 
 
@@ -76,9 +199,11 @@ static QState topState(struct Timekeeper *me)
 		return Q_HANDLED();
 	case NORMAL_MODE_SIGNAL:
 		me->mode = NORMAL_MODE;
+		settings_set(SETTING_TIME_MODE, NORMAL_MODE);
 		return Q_HANDLED();
 	case DECIMAL_MODE_SIGNAL:
 		me->mode = DECIMAL_MODE;
+		settings_set(SETTING_TIME_MODE, DECIMAL_MODE);
 		return Q_HANDLED();
 	}
 	return Q_SUPER(QHsm_top);
@@ -90,10 +215,14 @@ static QState startupState(struct Timekeeper *me)
 	switch (Q_SIG(me)) {
 	case Q_ENTRY_SIG:
 		//QActive_arm((QActive*)me, 1);
-		QActive_postISR((QActive*)me, Q_TIMEOUT_SIG, 0);
+		post(me, Q_TIMEOUT_SIG, 0);
 		return Q_HANDLED();
 	case Q_TIMEOUT_SIG:
-		return Q_TRAN(readRTCState);
+		if (me->warm) {
+			return Q_TRAN(verifyRTCState);
+		} else {
+			return Q_TRAN(readRTCState);
+		}
 	}
 	return Q_SUPER(topState);
 }
@@ -140,7 +269,12 @@ static QState readRTCState(struct Timekeeper *me)
 		SERIALSTR(",");
 		serial_send_hex_int(me->twiBuffer1[2]);
 		SERIALSTR("\r\n");
-		serial_drain();
+		/* Let that go out before setupRTCState or runningState add
+		   theirs, but don't hold everything else up while it does. */
+		serial_flush((QActive*)me, SERIAL_FLUSHED_SIGNAL);
+		return Q_HANDLED();
+
+	case SERIAL_FLUSHED_SIGNAL:
 		if (0xf8 != me->twiRequest1.status) {
 			return Q_TRAN(setupRTCState);
 		}
@@ -149,20 +283,202 @@ static QState readRTCState(struct Timekeeper *me)
 		}
 		rtc_to_normal(me->twiBuffer1, &me->normaltime);
 		me->decimaltime = normal_to_decimal(me->normaltime);
-		if (0 == checkRTCalarm(me->twiRequest1.bytes)) {
-			set_alarm_alarm_times(me->twiBuffer1 + 7);
-			if (me->twiBuffer1[14] & 0b1) {
-				post((&alarm), ALARM_ON_SIGNAL, 0);
-			} else {
-				post((&alarm), ALARM_OFF_SIGNAL, 0);
-			}
-		}
+		me->dayofweek = rtc_to_day(me->twiBuffer1[3]);
+		rtc_alarm_settings(me);
 		return Q_TRAN(runningState);
 	}
 	return Q_SUPER(topState);
 }
 
 
+/**
+ * The parent of the states that wait for a TWI transfer to or from the RTC.
+ *
+ * Nothing else can be written to the RTC until the transfer has finished, and
+ * starting another one would overwrite twiRequest0 while it is still in use.
+ * Time, day and alarm changes that arrive in the meantime take effect here
+ * straight away, and are written to the RTC by rtc_busy_done().
+ */
+static QState rtcBusyState(struct Timekeeper *me)
+{
+	switch (Q_SIG(me)) {
+	case SET_DECIMAL_TIME_SIGNAL:
+	case SET_NORMAL_TIME_SIGNAL:
+		new_time(me);
+		me->timeWritePending = 73;
+		return Q_HANDLED();
+
+	case SET_DAY_SIGNAL:
+		me->dayofweek = (uint8_t) Q_PAR(me);
+		me->dayWritePending = 73;
+		return Q_HANDLED();
+
+	case SET_NORMAL_ALARM_SIGNAL:
+		me->normalalarmtime = it2nt(Q_PAR(me));
+#ifdef RTC_ALARM_INTERRUPT
+		me->snoozing = 0;
+#endif
+		me->alarmWritePending = 73;
+		return Q_HANDLED();
+
+#ifdef TIME_SYNC
+	case READ_RTC_SIGNAL:
+		me->rtcReadPending = 73;
+		return Q_HANDLED();
+#endif
+
+#ifdef RTC_ALARM_INTERRUPT
+	case SET_SNOOZE_ALARM_SIGNAL:
+		me->normalsnoozetime = it2nt(Q_PAR(me));
+		me->snoozing = 73;
+		me->alarmWritePending = 73;
+		return Q_HANDLED();
+
+	case RTC_ALARM_SIGNAL:
+		rtc_alarm(me);
+		me->alarmWritePending = 73;
+		return Q_HANDLED();
+#endif
+	}
+	return Q_SUPER(runningState);
+}
+
+
+/**
+ * Leave a child of rtcBusyState when its TWI transfer has finished, starting
+ * the next write if a change arrived while we waited.
+ */
+static QState rtc_busy_done(struct Timekeeper *me)
+{
+	if (me->timeWritePending) {
+		return Q_TRAN(tkSetTimeState);
+	}
+	if (me->dayWritePending) {
+		return Q_TRAN(tkSetDayState);
+	}
+	if (me->alarmWritePending) {
+		return Q_TRAN(tkSetAlarmState);
+	}
+#ifdef TIME_SYNC
+	if (me->rtcReadPending) {
+		return Q_TRAN(verifyRTCState);
+	}
+#endif
+	return Q_TRAN(runningState);
+}
+
+
+/**
+ * Take the time from SET_DECIMAL_TIME_SIGNAL or SET_NORMAL_TIME_SIGNAL.  The
+ * caller writes it to the RTC.
+ */
+static void new_time(struct Timekeeper *me)
+{
+	if (SET_DECIMAL_TIME_SIGNAL == Q_SIG(me)) {
+		me->decimaltime = (uint32_t)(Q_PAR(me));
+		me->normaltime = decimal_to_normal(me->decimaltime);
+	} else {
+		me->normaltime = it2nt(Q_PAR(me));
+		me->decimaltime = normal_to_decimal(me->normaltime);
+	}
+	setup_108_125(me);
+#ifdef TIME_SYNC
+	timesync_time_set(me->decimaltime);
+#endif
+#ifndef RTC_ALARM_INTERRUPT
+	post((&alarm), ALARM_RESYNC_SIGNAL, 0);
+#endif
+}
+
+
+/**
+ * We've been restarted by the watchdog and are already running with the time
+ * from before the reset.  Read the RTC in the background, and use its time if
+ * it's good.
+ *
+ * Like readRTCState, we can't write to the RTC until the read has finished.
+ * Time, day and alarm changes are remembered by rtcBusyState and written
+ * afterwards, and a time or day set in the meantime wins over the RTC's.
+ *
+ * With TIME_SYNC we come here too when the host stops keeping us in step, so
+ * we carry on from the RTC's time.
+ */
+static QState verifyRTCState(struct Timekeeper *me)
+{
+	struct NormalTime nt;
+
+	switch (Q_SIG(me)) {
+
+	case Q_ENTRY_SIG:
+		SERIALSTR("verifyRTCState\r\n");
+		start_rtc_twi_read(me, 0, 19);
+		return Q_HANDLED();
+
+	case TWI_REPLY_0_SIGNAL:
+		if (0xf8 == me->twiRequest0.status) {
+			return Q_HANDLED();
+		}
+		SERIALSTR("verifyRTCState: ");
+		serial_send_rom(twi_status_string(me->twiRequest0.status));
+		SERIALSTR("\r\n");
+		goto done;
+
+	case TWI_REPLY_1_SIGNAL:
+		if (0xf8 != me->twiRequest1.status
+		    || 0 != checkRTCdata(me->twiRequest1.bytes)) {
+			/* Keep our own time.  The RTC gets it the next time
+			   the time is set. */
+			SERIALSTR("verifyRTCState: bad RTC\r\n");
+			goto done;
+		}
+		rtc_to_normal(me->twiBuffer1, &nt);
+		if (! me->timeWritePending
+		    && (nt.h != me->normaltime.h || nt.m != me->normaltime.m
+			|| nt.s != me->normaltime.s)) {
+			SERIALSTR("verifyRTCState: ");
+			print_normal_time(me->normaltime);
+			SERIALSTR(" > ");
+			print_normal_time(nt);
+			SERIALSTR("\r\n");
+			me->normaltime = nt;
+#ifdef TIME_SYNC
+			if (me->rtcReadPending) {
+				/* We've stopped following the host.  Leave the
+				   decimal time alone until the next 108 second
+				   boundary, where it's aligned to the RTC's in
+				   one step. */
+				me->normal108Count =
+					normal_day_seconds(&nt) % 108;
+			} else
+#endif
+			{
+				me->decimaltime =
+					normal_to_decimal(me->normaltime);
+				setup_108_125(me);
+#ifdef TIME_SYNC
+				timesync_time_set(me->decimaltime);
+#endif
+			}
+#ifndef RTC_ALARM_INTERRUPT
+			post((&alarm), ALARM_RESYNC_SIGNAL, 0);
+#endif
+		}
+		if (! me->dayWritePending) {
+			me->dayofweek = rtc_to_day(me->twiBuffer1[3]);
+		}
+		goto done;
+	}
+	return Q_SUPER(rtcBusyState);
+
+ done:
+#ifdef TIME_SYNC
+	me->rtcReadPending = 0;
+#endif
+	rtc_alarm_settings(me);
+	return rtc_busy_done(me);
+}
+
+
 static QState setupRTCState(struct Timekeeper *me)
 {
 	switch (Q_SIG(me)) {
@@ -206,68 +522,126 @@ static QState setupRTCState(struct Timekeeper *me)
 static QState runningState(struct Timekeeper *me)
 {
 	uint8_t d32counter;
+	uint8_t nsecs;
 
 	switch (Q_SIG(me)) {
 
 	case Q_ENTRY_SIG:
 		SERIALSTR("runningState\r\n");
+		BOOT_TRACE_MARK("time known");
 		setup_108_125(me);
-		set_time_mode(NORMAL_MODE);
+		set_time_mode(me->startMode);
 		BSP_enable_rtc_interrupt();
 		return Q_HANDLED();
 
 	case TICK_DECIMAL_32_SIGNAL:
+#ifdef TICK_LATENCY
+		record_tick_latency();
+#endif
 		d32counter = (uint8_t) Q_PAR(me);
 		Q_ASSERT( d32counter != 0 );
 		Q_ASSERT( d32counter <= 32 );
+		/* The BSP starts the counter again after 32, so if some of
+		   these signals were coalesced while we were busy, work out
+		   how many times it went past 32 since the last one we saw. */
+		nsecs = (QF_LATEST_SKIPPED(Q_PAR(me)) + 32 - d32counter) / 32;
 		if (d32counter == 32) {
-			/* We set the decimal 1/32 second counter early, to
-			   avoid the possibility that the second calculations
-			   and display take much longer than the time before
-			   the next timer interrupt, and therefore before the
-			   next signal arrives. */
-			BSP_set_decimal_32_counter(0);
-			/* We've counted 32 parts of a decimal second, so tick
-			   over to the next second. */
-			post(me, TICK_DECIMAL_SIGNAL, 0);
+			nsecs ++;
+		}
+		/* Write any changed settings, a byte at a time. */
+		settings_poll(nsecs != 0);
+		/* We've counted 32 parts of a decimal second, so tick over to
+		   the next second. */
+		if (! nsecs) {
+			save_warm_state(me, d32counter);
+		}
+		/* Otherwise the warm state is saved when the decimal time has
+		   been counted. */
+		while (nsecs) {
+			post_latest(me, TICK_DECIMAL_SIGNAL, 0);
+			nsecs --;
 		}
 		return Q_HANDLED();
 
 	case TICK_DECIMAL_SIGNAL:
-		inc_decimaltime(me);
-		if (me->decimal125Count < 124) {
-			/* Only count to 124 decimal seconds.  Each 125th
-			   decimal second is counted by the code that
-			   synchronises the decimal and normal seconds at
-			   125/108 second boundaries. */
-			me->decimal125Count ++;
-			post_r((&alarm), TICK_DECIMAL_SIGNAL, me->decimaltime);
-			post_r((&timedisplay), TICK_DECIMAL_SIGNAL, me->decimaltime);
+		nsecs = 1 + QF_LATEST_SKIPPED(Q_PAR(me));
+		while (nsecs) {
+			decimal_second(me);
+			nsecs --;
 		}
+		save_warm_state(me, 0);
+#ifdef TIME_SYNC
+		timesync_second(me->decimaltime);
+		follow_host(me);
+#endif
 		return Q_HANDLED();
 
 	case TICK_NORMAL_SIGNAL:
+#ifdef TIME_SYNC
+		/* Drop any that were queued before the normal seconds changed
+		   source. */
+		if ((BSP_NORMAL_FROM_TIMER == Q_PAR(me)) != !!me->timebaseLocked) {
+			return Q_HANDLED();
+		}
+#endif
 		inc_normaltime(me);
-		post((&alarm), TICK_NORMAL_SIGNAL, nt2it(me->normaltime));
-		post((&timedisplay), TICK_NORMAL_SIGNAL, nt2it(me->normaltime));
+#ifndef RTC_ALARM_INTERRUPT
+		post_latest((&alarm), TICK_NORMAL_SIGNAL,
+			    nt2it(me->normaltime));
+#endif
+		post_latest((&timedisplay), TICK_NORMAL_SIGNAL,
+			    nt2it(me->normaltime));
 		synchronise_108_125(me);
+#ifdef POWER_STATS
+		if (0 == me->normal108Count) {
+			report_power_stats();
+		}
+#endif
+#ifdef TICK_LATENCY
+		if (0 == me->normal108Count) {
+			report_tick_latency();
+		}
+#endif
+#ifdef STACK_STATS
+		if (0 == me->normal108Count) {
+			report_stack_stats();
+		}
+#endif
 		return Q_HANDLED();
 
 	case SET_DECIMAL_TIME_SIGNAL:
-		me->decimaltime = (uint32_t)(Q_PAR(me));
-		me->normaltime = decimal_to_normal(me->decimaltime);
-		setup_108_125(me);
-		return Q_TRAN(tkSetTimeState);
-
 	case SET_NORMAL_TIME_SIGNAL:
-		me->normaltime = it2nt(Q_PAR(me));
-		me->decimaltime = normal_to_decimal(me->normaltime);
-		setup_108_125(me);
+		new_time(me);
 		return Q_TRAN(tkSetTimeState);
 
+	case SET_DAY_SIGNAL:
+		me->dayofweek = (uint8_t) Q_PAR(me);
+		return Q_TRAN(tkSetDayState);
+
+#ifdef TIME_SYNC
+	case READ_RTC_SIGNAL:
+		return Q_TRAN(verifyRTCState);
+#endif
+
 	case SET_NORMAL_ALARM_SIGNAL:
 		me->normalalarmtime = it2nt(Q_PAR(me));
+#ifdef RTC_ALARM_INTERRUPT
+		me->snoozing = 0;
+#endif
 		return Q_TRAN(tkSetAlarmState);
+
+#ifdef RTC_ALARM_INTERRUPT
+	case SET_SNOOZE_ALARM_SIGNAL:
+		me->normalsnoozetime = it2nt(Q_PAR(me));
+		me->snoozing = 73;
+		return Q_TRAN(tkSetAlarmState);
+
+	case RTC_ALARM_SIGNAL:
+		rtc_alarm(me);
+		/* Writing the alarm registers clears the RTC's alarm flags,
+		   which releases the interrupt line. */
+		return Q_TRAN(tkSetAlarmState);
+#endif
 	}
 	return Q_SUPER(topState);
 }
@@ -282,11 +656,12 @@ tkSetTimeState(struct Timekeeper *me)
 	case Q_ENTRY_SIG:
 		SERIALSTR("tkSetTimeState\r\n");
 		BSP_set_decimal_32_counter(0);
+		me->timeWritePending = 0;
 
 		/* Set up a TWI buffer to write the time. */
 		me->twiBuffer0[0] = 0x00; /* Register address. */
 		normal_to_rtc(&(me->normaltime), me->twiBuffer0 + 1);
-		me->twiBuffer0[4] = 0x01; /* Day */
+		me->twiBuffer0[4] = me->dayofweek + 1; /* Day */
 		me->twiBuffer0[5] = 0x01; /* Date */
 		me->twiBuffer0[6] = 0x01; /* Month/Century */
 		me->twiBuffer0[7] = 0x99; /* Year */
@@ -323,27 +698,55 @@ tkSetTimeState(struct Timekeeper *me)
 			SERIALSTR("\r\n");
 			break;
 		}
-		return Q_TRAN(runningState);
+		return rtc_busy_done(me);
 
 	case Q_EXIT_SIG:
 		SERIALSTR("tkSetTimeState exits\r\n");
 		return Q_HANDLED();
 	}
-	return Q_SUPER(runningState);
+	return Q_SUPER(rtcBusyState);
 }
 
 
 static QState tkSetAlarmState(struct Timekeeper *me)
 {
 	uint8_t status;
+	uint8_t nbytes;
 
 	switch (Q_SIG(me)) {
 	case Q_ENTRY_SIG:
 		SERIALSTR("tkSetAlarmState\r\n");
-		BSP_set_decimal_32_counter(0);
 
 		/* Set up a TWI buffer to write the time. */
 		me->twiBuffer0[0] = 0x07; /* Register address. */
+		me->alarmWritePending = 0;
+#ifdef RTC_ALARM_INTERRUPT
+		/* Alarm 1 goes off at the alarm or snooze time.  A1M4=1 makes
+		   it match on hours, minutes and seconds. */
+		if (me->snoozing) {
+			normal_to_rtc(&(me->normalsnoozetime),
+				      me->twiBuffer0 + 1);
+		} else {
+			normal_to_rtc(&(me->normalalarmtime),
+				      me->twiBuffer0 + 1);
+		}
+		/* Alarm 2 is never enabled.  It keeps a copy of the alarm time
+		   that survives a reset while snoozing. */
+		normal_to_rtc(&(me->normalalarmtime), me->twiBuffer0 + 4);
+		me->twiBuffer0[4] = 0x80; /* Alarm 1 day, A1M4=1 */
+		me->twiBuffer0[7] = 0x80; /* Alarm 2 day, A2M4=1 */
+		if (get_alarm_state(&alarm)) {
+			SERIALSTR("   alarm is on\r\n");
+			me->twiBuffer0[8] = 0x05; /* /EOSC=0 INTCN=1 A1IE=1 */
+		} else {
+			SERIALSTR("   alarm is off\r\n");
+			me->twiBuffer0[8] = 0x04; /* /EOSC=0 INTCN=1 */
+		}
+		/* Clear A1F and A2F, which lets the interrupt line go high
+		   again.  OSF, BB32kHz and EN32kHz stay set. */
+		me->twiBuffer0[9] = 0xc8;
+		nbytes = 10;
+#else
 		normal_to_rtc(&(me->normalalarmtime), me->twiBuffer0 + 1);
 		me->twiBuffer0[4] = 0x00; /* Alarm 1 day */
 		me->twiBuffer0[5] = 0x00; /* Alarm 2 minute */
@@ -356,10 +759,12 @@ static QState tkSetAlarmState(struct Timekeeper *me)
 			SERIALSTR("   alarm is off\r\n");
 			me->twiBuffer0[8] = 0x00;
 		}
+		nbytes = 9;
+#endif
 		me->twiRequest0.qactive = (QActive*)me;
 		me->twiRequest0.signal = TWI_REPLY_0_SIGNAL;
 		me->twiRequest0.bytes = me->twiBuffer0;
-		me->twiRequest0.nbytes = 9;
+		me->twiRequest0.nbytes = nbytes;
 		me->twiRequest0.address = RTC_ADDR << 1; /* |0 for write. */
 		me->twiRequest0.count = 0;
 		me->twiRequest0.status = 0;
@@ -367,7 +772,7 @@ static QState tkSetAlarmState(struct Timekeeper *me)
 		me->twiRequestAddresses[1] = 0;
 
 		SERIALSTR("    bytes=");
-		for (uint8_t i=0; i<9; i++) {
+		for (uint8_t i=0; i<nbytes; i++) {
 			SERIALSTR(" ");
 			serial_send_hex_int(me->twiBuffer0[i]);
 		}
@@ -389,13 +794,65 @@ static QState tkSetAlarmState(struct Timekeeper *me)
 			SERIALSTR("\r\n");
 			break;
 		}
-		return Q_TRAN(runningState);
+		return rtc_busy_done(me);
 
 	case Q_EXIT_SIG:
 		SERIALSTR("tkSetAlarmState exits\r\n");
 		return Q_HANDLED();
 	}
-	return Q_SUPER(runningState);
+	return Q_SUPER(rtcBusyState);
+}
+
+
+/**
+ * Write the day of the week to the RTC.  The alarm is told when that's done,
+ * so the days of the week alarms can pick the next one again.
+ */
+static QState tkSetDayState(struct Timekeeper *me)
+{
+	uint8_t status;
+
+	switch (Q_SIG(me)) {
+	case Q_ENTRY_SIG:
+		SERIALSTR("tkSetDayState\r\n");
+		me->dayWritePending = 0;
+		me->twiBuffer0[0] = 0x03; /* Register address. */
+		me->twiBuffer0[1] = me->dayofweek + 1; /* Day */
+		me->twiRequest0.qactive = (QActive*)me;
+		me->twiRequest0.signal = TWI_REPLY_0_SIGNAL;
+		me->twiRequest0.bytes = me->twiBuffer0;
+		me->twiRequest0.nbytes = 2;
+		me->twiRequest0.address = RTC_ADDR << 1; /* |0 for write. */
+		me->twiRequest0.count = 0;
+		me->twiRequest0.status = 0;
+		me->twiRequestAddresses[0] = &(me->twiRequest0);
+		me->twiRequestAddresses[1] = 0;
+		post(&twi, TWI_REQUEST_SIGNAL,
+		     (QParam)((uint16_t)(&(me->twiRequestAddresses))));
+		return Q_HANDLED();
+
+	case TWI_REPLY_0_SIGNAL:
+		status = me->twiRequest0.status;
+		switch (status) {
+		case 0xf8:
+			SERIALSTR("tkSetDayState: success\r\n");
+			break;
+		default:
+			SERIALSTR("tkSetDayState: TWI_REPLY_0_SIGNAL: ");
+			serial_send_rom(twi_status_string(status));
+			SERIALSTR("\r\n");
+			break;
+		}
+		/* Tell the alarm now that the RTC is free, so any new alarm
+		   time it sends back can be written straight away. */
+		post((&alarm), ALARM_ON_SIGNAL, 0);
+		return rtc_busy_done(me);
+
+	case Q_EXIT_SIG:
+		SERIALSTR("tkSetDayState exits\r\n");
+		return Q_HANDLED();
+	}
+	return Q_SUPER(rtcBusyState);
 }
 
 
@@ -418,12 +875,21 @@ static uint8_t checkRTCdata(uint8_t *bytes)
 	if ((bytes[2] & 0x30) > 0x20) goto ret; else e++;
 
 	// A1IE is used for our own alarm purposes.
+#ifdef RTC_ALARM_INTERRUPT
+	// /EOSC /BBSQW /CONF /RS2 /RS1 ?INTCN /A2IE ?A1IE
+	if ((bytes[14]& 0xfa) !=0x00) goto ret; else e++;
+#else
 	// /EOSC /BBSQW /CONF /RS2 /RS1 /INTCN /A2IE ?A1IE
 	if ((bytes[14]& 0xfe) !=0x00) goto ret; else e++;
+#endif
 
 	/* @todo work out why we always get 0xC9 out of this register. */
 	// /OSF /BB32kHz /CRATE1 /CRATE0 /EN32kHz BSY? A2F? A1F?
 	if ((bytes[15] & 0x80) != 0x80) goto ret; else e++;
+#ifdef RTC_32KHZ_TIMEBASE
+	// Without the 32kHz output we get no decimal ticks at all.
+	if ((bytes[15] & 0x08) != 0x08) goto ret; else e++;
+#endif
 
 	return 0;
  ret:
@@ -491,7 +957,47 @@ static void setupRTCdata(uint8_t *bytes)
 
 	bytes[14] = 0;		/* /EOSC etc.  /EOSC must be 0 to enable the
 				   oscillator on backup power. */
+#ifdef RTC_32KHZ_TIMEBASE
+	bytes[15] = 0x08;	/* EN32kHz, we use it for the decimal time */
+#else
 	bytes[15] = 0;		/* OSF, BB32kHz etc */
+#endif
+}
+
+
+/**
+ * Count one decimal second, and pass it on to the alarm and the display.
+ *
+ * The ticks to the alarm and display are coalesced, so if they're slow to
+ * handle them they'll see one tick with a count of the seconds they missed.
+ */
+static void decimal_second(struct Timekeeper *me)
+{
+	inc_decimaltime(me);
+	if (me->decimal125Count < 124) {
+		/* Only count to 124 decimal seconds.  Each 125th decimal
+		   second is counted by the code that synchronises the decimal
+		   and normal seconds at 125/108 second boundaries. */
+		me->decimal125Count ++;
+#ifndef RTC_ALARM_INTERRUPT
+		post_latest_r((&alarm), TICK_DECIMAL_SIGNAL, me->decimaltime);
+#endif
+		post_latest_r((&timedisplay), TICK_DECIMAL_SIGNAL,
+			      me->decimaltime);
+	}
+#if defined(RTC_32KHZ_TIMEBASE) || defined(TIME_SYNC)
+	else if (me->timebaseLocked) {
+		/* Once the decimal and normal seconds come from the same
+		   oscillator, the 125th decimal second comes from the timer
+		   like all the others. */
+		me->decimal125Count = 0;
+#ifndef RTC_ALARM_INTERRUPT
+		post_latest_r((&alarm), TICK_DECIMAL_SIGNAL, me->decimaltime);
+#endif
+		post_latest_r((&timedisplay), TICK_DECIMAL_SIGNAL,
+			      me->decimaltime);
+	}
+#endif
 }
 
 
@@ -532,6 +1038,10 @@ static void inc_normaltime(struct Timekeeper *me)
 			me->normaltime.h ++;
 			if (me->normaltime.h == 24) {
 				me->normaltime.h = 0;
+				me->dayofweek ++;
+				if (me->dayofweek == 7) {
+					me->dayofweek = 0;
+				}
 			}
 		}
 	}
@@ -570,7 +1080,7 @@ get_decimal_time(void)
 }
 
 
-static void
+void
 set_decimal_time(uint32_t ds)
 {
 	post_r((&timekeeper), SET_DECIMAL_TIME_SIGNAL, (QParam)ds);
@@ -584,7 +1094,7 @@ get_normal_time(void)
 }
 
 
-static void
+void
 set_normal_time(struct NormalTime nt)
 {
 	post_r((&timekeeper), SET_NORMAL_TIME_SIGNAL, nt2it(nt));
@@ -684,7 +1194,46 @@ void set_times(uint8_t *times)
 }
 
 
-static void set_alarm_alarm_times(uint8_t *bytes)
+/**
+ * Tell the alarm to start, once we've read the RTC.
+ *
+ * If the alarm settings weren't in EEPROM, use the alarm time in the RTC.
+ */
+static void rtc_alarm_settings(struct Timekeeper *me)
+{
+	if (alarm_settings_loaded(&alarm)) {
+		/* The alarms were kept in EEPROM, and the ones in the RTC are
+		   only there for the RTC to use. */
+		post((&alarm), ALARM_ON_SIGNAL, 0);
+	} else if (0xf8 == me->twiRequest1.status
+		   && 0 == checkRTCalarm(me->twiRequest1.bytes)) {
+		uint8_t on = me->twiBuffer1[14] & 0b1;
+#ifdef RTC_ALARM_INTERRUPT
+		/* Alarm 1 may hold a snooze time if we were reset while
+		   snoozing.  The alarm time itself is kept in alarm 2, and the
+		   A2M4 bit says we put it there. */
+		if (me->twiBuffer1[13] & 0x80) {
+			uint8_t a2[3];
+			a2[0] = 0;
+			a2[1] = me->twiBuffer1[11];
+			a2[2] = me->twiBuffer1[12];
+			set_alarm_alarm_times(a2, on);
+		} else {
+			set_alarm_alarm_times(me->twiBuffer1 + 7, on);
+		}
+#else
+		set_alarm_alarm_times(me->twiBuffer1 + 7, on);
+#endif
+		post((&alarm), ALARM_ON_SIGNAL, 0);
+	}
+}
+
+
+/**
+ * Use the alarm time in the RTC as the first alarm.  This is only done if the
+ * alarms weren't in EEPROM.
+ */
+static void set_alarm_alarm_times(uint8_t *bytes, uint8_t on)
 {
 	struct NormalTime nat;
 	uint32_t dat;
@@ -692,12 +1241,56 @@ static void set_alarm_alarm_times(uint8_t *bytes)
 	rtc_to_normal(bytes, &nat);
 	nat.s = 0;
 	dat = normal_to_decimal(nat);
-	set_normal_alarm_time(&alarm, nat);
-	set_decimal_alarm_time(&alarm, dat);
+	set_alarm_time_on(&alarm, 0, dat, nat, on);
+}
+
+
+/**
+ * The RTC counts days of the week from 1 to 7, and we count from 0 (Sunday)
+ * to 6.
+ */
+static uint8_t rtc_to_day(uint8_t byte)
+{
+	byte &= 0x07;
+	if (byte) {
+		return byte - 1;
+	} else {
+		return 0;
+	}
 }
 
 
-void set_alarm_times(struct Timekeeper *me, uint8_t *times, uint8_t on)
+uint8_t get_day_of_week(void)
+{
+	return timekeeper.dayofweek;
+}
+
+
+/**
+ * Change the day of the week.  Timekeeper writes the new day to the RTC and
+ * then tells the alarm.
+ */
+void set_day_of_week(uint8_t day)
+{
+	Q_ASSERT( day < 7 );
+	post_r((&timekeeper), SET_DAY_SIGNAL, day);
+}
+
+
+/**
+ * Change the day of the week and the time together.  The day goes to the RTC
+ * with the time, so there's only one RTC write.
+ */
+void set_day_and_times(uint8_t day, uint8_t *times)
+{
+	Q_ASSERT( day < 7 );
+	timekeeper.dayofweek = day;
+	set_times(times);
+}
+
+
+void set_alarm_times(struct Timekeeper *me, uint8_t n,
+		     uint8_t *times, uint8_t on)
 {
 	uint32_t dat;
 	struct NormalTime nat;
@@ -736,15 +1329,28 @@ void set_alarm_times(struct Timekeeper *me, uint8_t *times, uint8_t on)
 		SERIALSTR(")\r\n");
 		break;
 	}
-	set_normal_alarm_time(&alarm, nat);
-	set_decimal_alarm_time(&alarm, dat);
-	if (on) {
-		post((&alarm), ALARM_ON_SIGNAL, 0);
-	} else {
-		post((&alarm), ALARM_OFF_SIGNAL, 0);
-	}
-	post(me, SET_NORMAL_ALARM_SIGNAL, nt2it(nat));
+	set_alarm_time_on(&alarm, n, dat, nat, on);
+	/* The alarm works out which alarm is next, and tells us to write that
+	   one to the RTC. */
+	post((&alarm), ALARM_ON_SIGNAL, 0);
+}
+
+
+#ifdef RTC_ALARM_INTERRUPT
+/**
+ * The RTC alarm has gone off, either at the alarm time or at the snooze time.
+ * Tell the alarm, and put RTC alarm 1 back to the alarm time for tomorrow.
+ * The caller arranges for the alarm registers to be written, which also
+ * clears the RTC's alarm flags.
+ */
+static void rtc_alarm(struct Timekeeper *me)
+{
+	SERIALSTR("RTC alarm\r\n");
+	post((&alarm), RTC_ALARM_SIGNAL, 0);
+	me->normalalarmtime = get_normal_alarm_time(&alarm);
+	me->snoozing = 0;
 }
+#endif
 
 
 static void default_times(struct Timekeeper *me)
@@ -763,6 +1369,19 @@ static void setup_108_125(struct Timekeeper *me)
 	ntd = normal_day_seconds(&(me->normaltime));
 	me->normal108Count = ntd % 108;
 	me->decimal125Count = me->decimaltime % 125;
+#ifdef RTC_32KHZ_TIMEBASE
+	/* The time has changed, so lock again at the next 108 second
+	   boundary. */
+	me->timebaseLocked = 0;
+#endif
+#ifdef TIME_SYNC
+	/* The time has changed, so go back to the RTC's seconds until
+	   follow_host() finds we're in step again. */
+	if (me->timebaseLocked) {
+		BSP_normal_from_rtc();
+		me->timebaseLocked = 0;
+	}
+#endif
 }
 
 
@@ -771,13 +1390,185 @@ static void synchronise_108_125(struct Timekeeper *me)
 	me->normal108Count ++;
 	if (108 == me->normal108Count) {
 		me->normal108Count = 0;
+#ifdef RTC_32KHZ_TIMEBASE
+		/* The decimal and normal seconds come from the same
+		   oscillator, so they only need aligning once. */
+		if (me->timebaseLocked) {
+			return;
+		}
+		me->timebaseLocked = 73;
+#endif
+#ifdef TIME_SYNC
+		/* While the host keeps us in step, the normal seconds are made
+		   from the decimal ticks, so they're already aligned, and
+		   aligning them to the RTC would undo the slewing. */
+		if (me->timebaseLocked) {
+			return;
+		}
+#endif
 		me->decimal125Count = 0;
-		BSP_set_decimal_32_counter(0);
+		BSP_align_decimal_32_counter();
 		me->decimaltime = normal_to_decimal(me->normaltime);
 		/* We only count up to 124 seconds using the CPU timer and
 		   TICK_DECIMAL_32_SIGNALs, and the 125th second is counted
-		   here. */
-		post_r((&alarm), TICK_DECIMAL_SIGNAL, me->decimaltime);
-		post_r((&timedisplay), TICK_DECIMAL_SIGNAL, me->decimaltime);
+		   here.  The decimal time may have moved, so the alarm
+		   has to count down again from the new time. */
+#ifndef RTC_ALARM_INTERRUPT
+		post_r((&alarm), ALARM_RESYNC_SIGNAL, 73);
+#endif
+		post_latest_r((&timedisplay), TICK_DECIMAL_SIGNAL,
+			      me->decimaltime);
+	}
+}
+
+
+#ifdef TIME_SYNC
+/**
+ * Start or stop following the host, at the start of a decimal second.
+ *
+ * While the host keeps us in step, the normal seconds are made from timer 1
+ * along with the decimal seconds, so the slewing moves both.  The RTC's 1Hz
+ * output keeps its own time, and isn't used to align the decimal seconds.
+ *
+ * When the host stops answering, we go back to the RTC's seconds and read
+ * its time.  At the next 108 second boundary the decimal seconds are aligned
+ * to the RTC's again, which steps the time by however far the RTC has drifted
+ * from the host in the meantime.
+ */
+static void follow_host(struct Timekeeper *me)
+{
+	uint8_t decimal125;
+	uint8_t normal108;
+	uint32_t ntd;
+
+	if (timesync_in_step()) {
+		if (me->timebaseLocked) {
+			return;
+		}
+		SERIALSTR("time sync: following the host\r\n");
+		/* Take the normal time from the decimal time, so the two
+		   agree exactly. */
+		decimal125 = me->decimaltime % 125;
+		normal108 = BSP_normal_from_timer(decimal125);
+		me->normaltime = decimal_to_normal(me->decimaltime
+						   - decimal125);
+		ntd = normal_day_seconds(&(me->normaltime)) + normal108;
+		me->normaltime.h = ntd / 3600;
+		me->normaltime.m = (ntd / 60) % 60;
+		me->normaltime.s = ntd % 60;
+		setup_108_125(me);
+		me->timebaseLocked = 73;
+#ifndef RTC_ALARM_INTERRUPT
+		post((&alarm), ALARM_RESYNC_SIGNAL, 0);
+#endif
+	} else if (me->timebaseLocked) {
+		SERIALSTR("time sync: lost the host\r\n");
+		BSP_normal_from_rtc();
+		me->timebaseLocked = 0;
+		post(me, READ_RTC_SIGNAL, 0);
+	}
+}
+#endif
+
+
+#ifdef POWER_STATS
+/**
+ * Print the number of wakeups and the percentage of time spent awake, over
+ * the last 108 seconds.
+ */
+static void report_power_stats(void)
+{
+	uint16_t wakeups;
+	uint32_t active;
+
+	BSP_get_power_stats(&wakeups, &active);
+	SERIALSTR("power: wakeups=");
+	serial_send_int(wakeups);
+	SERIALSTR(" active=");
+	/* 108 seconds is 216000000 counts of 0.5us, so this is in units of
+	   0.1%. */
+	active /= 216000L;
+	serial_send_int(active / 10);
+	SERIALSTR(".");
+	serial_send_int(active % 10);
+	SERIALSTR("%\r\n");
+}
+#endif
+
+
+#ifdef TICK_LATENCY
+/** The longest tick latency in the last 108 seconds, in 0.5us units. */
+static uint16_t latency_max;
+/** The sum of the tick latencies in the last 108 seconds. */
+static uint32_t latency_total;
+/** The number of ticks in the last 108 seconds. */
+static uint16_t latency_count;
+
+
+/**
+ * Record how long the current TICK_DECIMAL_32_SIGNAL waited between the timer
+ * interrupt and being handled here.
+ */
+static void record_tick_latency(void)
+{
+	uint16_t latency;
+
+	latency = BSP_tick_latency();
+	if (latency > latency_max) {
+		latency_max = latency;
+	}
+	latency_total += latency;
+	latency_count ++;
+}
+
+
+/**
+ * Print the maximum and mean tick latency, in microseconds, over the last 108
+ * seconds.  With timer 1 as the time base, also print how long its interrupt
+ * took.
+ */
+static void report_tick_latency(void)
+{
+#ifndef RTC_32KHZ_TIMEBASE
+	uint16_t isr_max;
+	uint16_t isr_mean;
+
+#endif
+	SERIALSTR("latency: ticks=");
+	serial_send_int(latency_count);
+	SERIALSTR(" max=");
+	serial_send_int(latency_max / 2);
+	SERIALSTR("us mean=");
+	if (latency_count) {
+		serial_send_int((latency_total / latency_count) / 2);
+	} else {
+		serial_send_int(0);
 	}
+	SERIALSTR("us");
+#ifndef RTC_32KHZ_TIMEBASE
+	BSP_get_tick_isr_cycles(&isr_max, &isr_mean);
+	SERIALSTR(" isr max=");
+	serial_send_int(isr_max);
+	SERIALSTR(" mean=");
+	serial_send_int(isr_mean);
+	SERIALSTR(" cycles");
+#endif
+	SERIALSTR("\r\n");
+	latency_max = 0;
+	latency_total = 0;
+	latency_count = 0;
+}
+#endif
+
+
+#ifdef STACK_STATS
+/**
+ * Print the number of bytes of stack that have never been used since reset.
+ */
+static void report_stack_stats(void)
+{
+	SERIALSTR("stack: unused=");
+	serial_send_int(BSP_stack_unused());
+	SERIALSTR("\r\n");
 }
+#endif
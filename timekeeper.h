@@ -19,15 +19,62 @@ struct Timekeeper {
 	/** The alarm time, only used when we set the alarm time. */
 	struct NormalTime normalalarmtime;
 
+#ifdef RTC_ALARM_INTERRUPT
+	/** The snooze time, written to RTC alarm 1 while we are snoozing. */
+	struct NormalTime normalsnoozetime;
+
+	/** True while RTC alarm 1 holds the snooze time instead of the alarm
+	    time. */
+	uint8_t snoozing;
+#endif
+
+	/** True if the time registers need writing once the current TWI
+	    transfer has finished. */
+	uint8_t timeWritePending;
+
+	/** True if the day register needs writing once the current TWI
+	    transfer has finished. */
+	uint8_t dayWritePending;
+
+	/** True if the RTC alarm registers need writing again once the
+	    current TWI transfer has finished. */
+	uint8_t alarmWritePending;
+
 	/** Set to zero every 108 normal seconds, for synchronisation. */
 	uint8_t normal108Count;
 
 	/** Used for synchronising the decimal and normal seconds. */
 	uint8_t decimal125Count;
 
+#if defined(RTC_32KHZ_TIMEBASE) || defined(TIME_SYNC)
+	/** Set true once the decimal and normal seconds come from the same
+	    oscillator, and don't need synchronising any more.  With
+	    RTC_32KHZ_TIMEBASE that's once the decimal ticks have been aligned
+	    with the RTC seconds.  With TIME_SYNC it's while the host keeps us
+	    in step, and both come from timer 1. */
+	uint8_t timebaseLocked;
+#endif
+
+#ifdef TIME_SYNC
+	/** True if the RTC needs reading once the current TWI transfer has
+	    finished, because we've stopped following the host. */
+	uint8_t rtcReadPending;
+#endif
+
+	/** The day of the week, 0 for Sunday to 6 for Saturday. */
+	uint8_t dayofweek;
+
 	/** Decimal or normal mode. */
 	uint8_t mode;
 
+	/** The mode to change to when we start running.  Normal, unless we've
+	    been restarted by the watchdog in decimal mode. */
+	uint8_t startMode;
+
+	/** True if we were restarted by the watchdog and carried on with the
+	    time from before the reset. */
+	uint8_t warm;
+
 	/** Holder for the first TWI request. */
 	struct TWIRequest twiRequest0;
 	uint8_t twiBuffer0[12];
@@ -51,12 +98,20 @@ extern struct Timekeeper timekeeper;
 
 
 void timekeeper_ctor(void);
+uint8_t timekeeper_warm_start(void);
 
 uint32_t get_decimal_time(void);
+void set_decimal_time(uint32_t ds);
 struct NormalTime get_normal_time(void);
+void set_normal_time(struct NormalTime nt);
 void get_times(uint8_t *dtimes);
 void set_times(uint8_t *dtimes);
 
-void set_alarm_times(struct Timekeeper *me, uint8_t *dtimes, uint8_t on);
+uint8_t get_day_of_week(void);
+void set_day_of_week(uint8_t day);
+void set_day_and_times(uint8_t day, uint8_t *times);
+
+void set_alarm_times(struct Timekeeper *me, uint8_t n,
+		     uint8_t *dtimes, uint8_t on);
 
 #endif
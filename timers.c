@@ -0,0 +1,143 @@
+/**
+ * @file
+ *
+ * The running timers are kept in a delta list: sorted by when they run out,
+ * with each one holding the ticks after the one before.  So each tick only
+ * has to count down the first timer, however many are running, and arming a
+ * timer walks the list to find its place, outside the interrupt.
+ */
+
+#include "timers.h"
+#include "dclock.h"
+
+
+Q_DEFINE_THIS_FILE;
+
+
+/** The running timers, soonest first. */
+static struct Timer *timers = 0;
+
+
+/**
+ * Set up a timer.  It starts disarmed.
+ *
+ * @param act the active object that gets the signal
+ * @param sig the signal posted when the timer runs out
+ */
+void timer_ctor(struct Timer *t, QActive *act, QSignal sig)
+{
+	t->next = 0;
+	t->delta = 0;
+	t->act = act;
+	t->sig = sig;
+	t->armed = 0;
+}
+
+
+/**
+ * Take a running timer out of the list.  Interrupts must be off.
+ */
+static void unlink_timer(struct Timer *t)
+{
+	struct Timer **tp;
+
+	for (tp = &timers; *tp; tp = &((*tp)->next)) {
+		if (*tp == t) {
+			*tp = t->next;
+			if (t->next) {
+				t->next->delta += t->delta;
+			}
+			break;
+		}
+	}
+	t->next = 0;
+	t->armed = 0;
+}
+
+
+/**
+ * Start a timer, or start it again if it's already running.
+ *
+ * @param ticks the number of ticks before the signal is posted, at least 1
+ */
+void timer_arm(struct Timer *t, uint16_t ticks)
+{
+	struct Timer **tp;
+	uint8_t sreg;
+
+	Q_ASSERT( ticks );
+	sreg = SREG;
+	cli();
+	if (t->armed) {
+		unlink_timer(t);
+	}
+	tp = &timers;
+	while (*tp && (*tp)->delta <= ticks) {
+		ticks -= (*tp)->delta;
+		tp = &((*tp)->next);
+	}
+	t->delta = ticks;
+	t->next = *tp;
+	if (t->next) {
+		t->next->delta -= ticks;
+	}
+	*tp = t;
+	t->armed = 73;
+	SREG = sreg;
+}
+
+
+/**
+ * Stop a timer.  It doesn't matter if it's not running.
+ */
+void timer_disarm(struct Timer *t)
+{
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	if (t->armed) {
+		unlink_timer(t);
+	}
+	SREG = sreg;
+}
+
+
+uint8_t timer_armed(struct Timer *t)
+{
+	return t->armed;
+}
+
+
+/**
+ * True if any timer is running.
+ *
+ * The tick interrupt uses this to see if it can tick less often.
+ */
+uint8_t timers_running(void)
+{
+	return 0 != timers;
+}
+
+
+/**
+ * Count one tick, and post the signals for the timers that have run out.
+ *
+ * Called from the tick interrupt, alongside QF_tick().
+ */
+void timers_tick(void)
+{
+	struct Timer *t = timers;
+
+	if (! t) {
+		return;
+	}
+	t->delta --;
+	while (t && 0 == t->delta) {
+		timers = t->next;
+		t->next = 0;
+		t->armed = 0;
+		postISR(t->act, t->sig, 0);
+		t = timers;
+	}
+}
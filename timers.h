@@ -0,0 +1,46 @@
+#ifndef timers_h_INCLUDED
+#define timers_h_INCLUDED
+
+#include "qpn_port.h"
+
+/**
+ * @file
+ *
+ * Timers for active objects that need more than the one that QP-nano gives
+ * them with QActive_arm().
+ *
+ * Each timer belongs to one active object and posts one signal to it when it
+ * runs out.  An active object can have as many as it likes, usually as
+ * members of its own struct, and any number can be running at once.  The
+ * timers count the same ticks as QActive_arm(), 32 per decimal second.
+ *
+ * As with QActive_arm(), a timer's signal can already be in the queue when
+ * the timer is disarmed or armed again, so be ready to get one late.
+ */
+
+/**
+ * One timer.  Only use the members through the functions below.
+ */
+struct Timer {
+	/** The next running timer, which runs out delta ticks after this
+	    one. */
+	struct Timer *next;
+	/** Ticks after the previous running timer runs out, or after the
+	    next tick for the first one. */
+	uint16_t delta;
+	QActive *act;
+	QSignal sig;
+	/** True while this timer is running. */
+	uint8_t armed;
+};
+
+
+void timer_ctor(struct Timer *t, QActive *act, QSignal sig);
+void timer_arm(struct Timer *t, uint16_t ticks);
+void timer_disarm(struct Timer *t);
+uint8_t timer_armed(struct Timer *t);
+uint8_t timers_running(void);
+void timers_tick(void);
+
+
+#endif
@@ -6,6 +6,7 @@
 #include "dclock.h"
 #include "alarm.h"
 #include "serial.h"
+#include "settings.h"
 #include <stdio.h>
 
 
@@ -20,6 +21,12 @@ static QState setSecondsState      (struct TimeSetter *me);
 static QState setAlarmState        (struct TimeSetter *me);
 static QState setAlarmPauseState   (struct TimeSetter *me);
 static QState setAlarmOnOffState   (struct TimeSetter *me);
+#if NALARMS > 1
+static QState setAlarmNumberState  (struct TimeSetter *me);
+#endif
+static QState setAlarmDaysState    (struct TimeSetter *me);
+static QState setAlarmSnoozesState (struct TimeSetter *me);
+static QState setDayState          (struct TimeSetter *me);
 
 
 struct TimeSetter timesetter;
@@ -33,6 +40,8 @@ void timesetter_ctor(void)
 	QActive_ctor((QActive*)(&timesetter), (QStateHandler)initial);
 	timesetter.ready = 0;
 	timesetter.settingWhich = 0;
+	timesetter.alarmIndex = 0;
+	timesetter.showing = SHOWING_TIME;
 }
 
 
@@ -64,6 +73,7 @@ static QState top(struct TimeSetter *me)
 		   short press, otherwise we would have transitioned out of
 		   this state via a long press. */
 		me->settingWhich = SETTING_ALARM;
+		me->alarmIndex = 0;
 		return Q_TRAN(setAlarmPauseState);
 	case BUTTON_SELECT_LONG_PRESS_SIGNAL:
 		me->settingWhich = SETTING_TIME;
@@ -71,10 +81,12 @@ static QState top(struct TimeSetter *me)
 	case BUTTON_UP_PRESS_SIGNAL:
 	case BUTTON_UP_REPEAT_SIGNAL:
 		lcd_inc_brightness();
+		settings_set(SETTING_BRIGHTNESS, lcd_get_brightness());
 		return Q_HANDLED();
 	case BUTTON_DOWN_PRESS_SIGNAL:
 	case BUTTON_DOWN_REPEAT_SIGNAL:
 		lcd_dec_brightness();
+		settings_set(SETTING_BRIGHTNESS, lcd_get_brightness());
 		return Q_HANDLED();
 	}
 	return Q_SUPER(&QHsm_top);
@@ -156,6 +168,48 @@ static void displayWithTimeout(struct TimeSetter *me, char *line)
 }
 
 
+/**
+ * Display the days of the week that the alarm goes off, or the day of the
+ * week when setting the time.
+ */
+static void displaySettingDays(struct TimeSetter *me)
+{
+	static const char Q_ROM dayLetters[] = "SMTWTFS";
+	static const char Q_ROM dayNames[] = "SunMonTueWedThuFriSat";
+	char line[17];
+	uint8_t i;
+
+	for (i=0; i<16; i++) {
+		line[i] = ' ';
+	}
+	line[16] = '\0';
+	switch (me->showing) {
+	case SHOWING_DAYS:
+		for (i=0; i<7; i++) {
+			if (me->setDays & (1 << i)) {
+				line[i] = Q_ROM_BYTE(dayLetters[i]);
+			} else {
+				line[i] = '-';
+			}
+		}
+		break;
+	case SHOWING_DAY:
+		Q_ASSERT( me->setDay < 7 );
+		for (i=0; i<3; i++) {
+			line[6+i] = Q_ROM_BYTE(dayNames[(3*me->setDay)+i]);
+		}
+		break;
+	case SHOWING_SNOOZES:
+		Q_ASSERT( me->setSnoozes <= 9 );
+		line[7] = '0' + me->setSnoozes;
+		break;
+	default:
+		Q_ASSERT( 0 );
+	}
+	displayWithTimeout(me, line);
+}
+
+
 /**
  * Display the current state of what we are setting on the bottom line.
  *
@@ -163,12 +217,19 @@ static void displayWithTimeout(struct TimeSetter *me, char *line)
  * timer.  When setting the time, display blank space, hours, minutes, seconds,
  * and countdown timer.  The layout is arranged so that the hours and minutes
  * appear in the same place on the top line in alarm and time setting.
+ *
+ * When setting the days or snoozes, display those instead.
  */
 static void displaySettingTime(struct TimeSetter *me)
 {
 	char line[17];
 	char separator;
 
+	if (SHOWING_TIME != me->showing) {
+		displaySettingDays(me);
+		return;
+	}
+
 	switch (get_time_mode()) {
 	case NORMAL_MODE:
 		separator = ':';
@@ -188,9 +249,16 @@ static void displaySettingTime(struct TimeSetter *me)
 			 me->setTime[2]);
 		break;
 	case SETTING_ALARM:
+#if NALARMS > 1
+		snprintf(line, 17, "%s %02u%c%02u A%u    ",
+			 (me->alarmOn ? "On " : "OFF"),
+			 me->setTime[0], separator, me->setTime[1],
+			 me->alarmIndex + 1);
+#else
 		snprintf(line, 17, "%s %02u%c%02u       ",
 			 (me->alarmOn ? "On " : "OFF"),
 			 me->setTime[0], separator, me->setTime[1]);
+#endif
 		break;
 	default:
 		Q_ASSERT( 0 );
@@ -316,6 +384,7 @@ static QState setTimeState(struct TimeSetter *me)
 	case Q_ENTRY_SIG:
 		SERIALSTR("> setTimeState\r\n");
 		get_times(me->setTime);
+		me->setDay = get_day_of_week();
 		displaySettingTime(me);
 		return Q_HANDLED();
 	case UPDATE_TIME_SET_SIGNAL:
@@ -326,7 +395,7 @@ static QState setTimeState(struct TimeSetter *me)
 		SERIALSTR("< setTimeState");
 		if (me->timeSetChanged) {
 			SERIALSTR(" changed\r\n");
-			set_times(me->setTime);
+			set_day_and_times(me->setDay, me->setTime);
 		} else {
 			SERIALSTR(" no change\r\n");
 		}
@@ -346,10 +415,100 @@ static QState setAlarmPauseState(struct TimeSetter *me)
 		QActive_arm((QActive*)me, 1);
 		return Q_HANDLED();
 	case Q_TIMEOUT_SIG:
+#if NALARMS > 1
+		return Q_TRAN(setAlarmNumberState);
+#else
+		return Q_TRAN(setAlarmOnOffState);
+#endif
+	}
+	return Q_SUPER(setState);
+}
+
+
+/**
+ * Get the settings of the alarm we're about to change.
+ */
+static void getAlarmSetting(struct TimeSetter *me)
+{
+	me->alarmOn = get_alarm_on(&alarm, me->alarmIndex);
+	get_alarm_times(&alarm, me->alarmIndex, me->setTime);
+	me->setDays = get_alarm_days(&alarm, me->alarmIndex);
+	me->setSnoozes = get_alarm_max_snooze(&alarm, me->alarmIndex);
+	if (me->setSnoozes > 9) {
+		me->setSnoozes = 9;
+	}
+}
+
+
+#if NALARMS > 1
+/**
+ * Choose which alarm to set.  The alarm number is shown after the alarm time.
+ */
+static QState setAlarmNumberState(struct TimeSetter *me)
+{
+	static const char Q_ROM setAlarmNumberName[] = "Alarm number:";
+
+	switch (Q_SIG(me)) {
+	case Q_ENTRY_SIG:
+		QActive_arm_sig((QActive*)me, TSET_TOUT,
+				UPDATE_ALARM_NUMBER_TIMEOUT_SIGNAL);
+		me->setTimeouts = N_TSET_TOUTS;
+		displayMenuName(setAlarmNumberName);
+		getAlarmSetting(me);
+		displaySettingTime(me);
+		lcd_set_cursor(1, 11);
+		return Q_HANDLED();
+	case UPDATE_ALARM_NUMBER_TIMEOUT_SIGNAL:
+		Q_ASSERT( me->setTimeouts );
+		me->setTimeouts --;
+		if (0 == me->setTimeouts) {
+			post(me, UPDATE_TIME_TIMEOUT_SIGNAL, 0);
+		} else {
+			displaySettingTime(me);
+			QActive_arm_sig((QActive*)me, TSET_TOUT,
+					UPDATE_ALARM_NUMBER_TIMEOUT_SIGNAL);
+			post(me, UPDATE_TIME_SET_CURSOR_SIGNAL, 0);
+		}
+		return Q_HANDLED();
+	case UPDATE_TIME_SET_CURSOR_SIGNAL:
+		lcd_set_cursor(1, 11);
+		return Q_HANDLED();
+	case BUTTON_UP_PRESS_SIGNAL:
+	case BUTTON_UP_REPEAT_SIGNAL:
+		me->alarmIndex ++;
+		if (NALARMS == me->alarmIndex) {
+			me->alarmIndex = 0;
+		}
+		/* Choosing an alarm doesn't change anything, so we don't
+		   send UPDATE_TIME_SET_SIGNAL. */
+		getAlarmSetting(me);
+		me->setTimeouts = N_TSET_TOUTS;
+		QActive_arm_sig((QActive*)me, TSET_TOUT,
+				UPDATE_ALARM_NUMBER_TIMEOUT_SIGNAL);
+		displaySettingTime(me);
+		lcd_set_cursor(1, 11);
+		return Q_HANDLED();
+	case BUTTON_DOWN_PRESS_SIGNAL:
+	case BUTTON_DOWN_REPEAT_SIGNAL:
+		if (0 == me->alarmIndex) {
+			me->alarmIndex = NALARMS;
+		}
+		me->alarmIndex --;
+		getAlarmSetting(me);
+		me->setTimeouts = N_TSET_TOUTS;
+		QActive_arm_sig((QActive*)me, TSET_TOUT,
+				UPDATE_ALARM_NUMBER_TIMEOUT_SIGNAL);
+		displaySettingTime(me);
+		lcd_set_cursor(1, 11);
+		return Q_HANDLED();
+	case BUTTON_SELECT_PRESS_SIGNAL:
 		return Q_TRAN(setAlarmOnOffState);
+	case BUTTON_SELECT_RELEASE_SIGNAL:
+		return Q_HANDLED();
 	}
 	return Q_SUPER(setState);
 }
+#endif
 
 
 static QState setAlarmOnOffState(struct TimeSetter *me)
@@ -362,12 +521,11 @@ static QState setAlarmOnOffState(struct TimeSetter *me)
 		QActive_arm_sig((QActive*)me, TSET_TOUT,
 				UPDATE_ALARM_TIMEOUT_SIGNAL);
 		me->setTimeouts = N_TSET_TOUTS;
-		me->alarmOn = get_alarm_state(&alarm);
 		displayMenuName(setAlarmOnOffName);
 		/* We have to get the alarm times here since the hours and
 		   minutes are displayed when we are setting the on/off
 		   state. */
-		get_alarm_times(&alarm, me->setTime);
+		getAlarmSetting(me);
 		displaySettingTime(me);
 		lcd_set_cursor(1, 0);
 		return Q_HANDLED();
@@ -409,8 +567,8 @@ static QState setAlarmOnOffState(struct TimeSetter *me)
 			/* The user wants the alarm off.  If that's a new
 			   setting, then tell the alarm to go off. */
 			if (me->timeSetChanged) {
-				set_alarm_times(&timekeeper, me->setTime, 0);
-				post(&alarm, ALARM_OFF_SIGNAL, 0);
+				set_alarm_times(&timekeeper, me->alarmIndex,
+						me->setTime, 0);
 			}
 			return Q_TRAN(setState);
 		}
@@ -435,7 +593,10 @@ static QState setAlarmState(struct TimeSetter *me)
 	case Q_EXIT_SIG:
 		SERIALSTR("< setAlarmState ");
 		if (me->timeSetChanged) {
-			set_alarm_times(&timekeeper, me->setTime, 1);
+			set_alarm_options(&alarm, me->alarmIndex,
+					  me->setDays, me->setSnoozes);
+			set_alarm_times(&timekeeper, me->alarmIndex,
+					me->setTime, 1);
 		} else {
 			if (me->alarmOn) {
 				SERIALSTR("no change, on\r\n");
@@ -456,7 +617,9 @@ static QState setAlarmState(struct TimeSetter *me)
  * or the alarm time we are setting right now.  That decision is based on
  * me->settingWhich, which should not change for the duration of any one time
  * setting user operation.  settingWhich is set by the code that begins the
- * transition to here (in top()), and unset when we exit setState().
+ * transition to here (in top()), and unset when we exit setState().  The
+ * parent is returned with Q_SUPER_DYNAMIC(), so QEP_TRAN_CACHE doesn't keep a
+ * transition path through here that could be wrong the next time.
  */
 static QState setHoursState(struct TimeSetter *me)
 {
@@ -514,12 +677,12 @@ static QState setHoursState(struct TimeSetter *me)
 
 	switch (me->settingWhich) {
 	case SETTING_TIME:
-		return Q_SUPER(setTimeState);
+		return Q_SUPER_DYNAMIC(setTimeState);
 	case SETTING_ALARM:
-		return Q_SUPER(setAlarmState);
+		return Q_SUPER_DYNAMIC(setAlarmState);
 	default:
 		Q_ASSERT(0);
-		return Q_SUPER(setTimeState);
+		return Q_SUPER_DYNAMIC(setTimeState);
 	}
 }
 
@@ -592,7 +755,7 @@ static QState setMinutesState(struct TimeSetter *me)
 		case SETTING_ALARM:
 			/* We don't set the seconds on the alarm, so don't
 			   transition to that state. */
-			return Q_TRAN(setState);
+			return Q_TRAN(setAlarmDaysState);
 		default:
 			Q_ASSERT( 0 );
 			break;
@@ -603,12 +766,12 @@ static QState setMinutesState(struct TimeSetter *me)
 
 	switch (me->settingWhich) {
 	case SETTING_TIME:
-		return Q_SUPER(setTimeState);
+		return Q_SUPER_DYNAMIC(setTimeState);
 	case SETTING_ALARM:
-		return Q_SUPER(setAlarmState);
+		return Q_SUPER_DYNAMIC(setAlarmState);
 	default:
 		Q_ASSERT(0);
-		return Q_SUPER(setTimeState);
+		return Q_SUPER_DYNAMIC(setTimeState);
 	}
 }
 
@@ -665,18 +828,202 @@ static QState setSecondsState(struct TimeSetter *me)
 		lcd_set_cursor(1, 11);
 		return Q_HANDLED();
 	case BUTTON_SELECT_PRESS_SIGNAL:
-		return Q_TRAN(setState);
+		switch (me->settingWhich) {
+		case SETTING_TIME:
+			return Q_TRAN(setDayState);
+		default:
+			return Q_TRAN(setState);
+		}
 	case BUTTON_SELECT_RELEASE_SIGNAL:
 		return Q_HANDLED();
 	}
 
 	switch (me->settingWhich) {
 	case SETTING_TIME:
-		return Q_SUPER(setTimeState);
+		return Q_SUPER_DYNAMIC(setTimeState);
 	case SETTING_ALARM:
-		return Q_SUPER(setAlarmState);
+		return Q_SUPER_DYNAMIC(setAlarmState);
 	default:
 		Q_ASSERT(0);
-		return Q_SUPER(setTimeState);
+		return Q_SUPER_DYNAMIC(setTimeState);
+	}
+}
+
+
+/**
+ * Set the days of the week that the alarm goes off.  Select moves along the
+ * days, and up or down turns the day under the cursor on or off.  With no
+ * days set, the alarm goes off once.
+ */
+static QState setAlarmDaysState(struct TimeSetter *me)
+{
+	static const char Q_ROM setAlarmDaysName[] = "Alarm days:";
+
+	switch (Q_SIG(me)) {
+	case Q_ENTRY_SIG:
+		QActive_arm_sig((QActive*)me, TSET_TOUT,
+				UPDATE_DAYS_TIMEOUT_SIGNAL);
+		me->setTimeouts = N_TSET_TOUTS;
+		me->showing = SHOWING_DAYS;
+		me->daysCursor = 0;
+		displaySettingTime(me);
+		displayMenuName(setAlarmDaysName);
+		lcd_set_cursor(1, me->daysCursor);
+		return Q_HANDLED();
+	case UPDATE_DAYS_TIMEOUT_SIGNAL:
+		Q_ASSERT( me->setTimeouts );
+		me->setTimeouts --;
+		if (0 == me->setTimeouts) {
+			post(me, UPDATE_TIME_TIMEOUT_SIGNAL, 0);
+		} else {
+			displaySettingTime(me);
+			QActive_arm_sig((QActive*)me, TSET_TOUT,
+					UPDATE_DAYS_TIMEOUT_SIGNAL);
+			post(me, UPDATE_TIME_SET_CURSOR_SIGNAL, 0);
+		}
+		return Q_HANDLED();
+	case BUTTON_UP_PRESS_SIGNAL:
+	case BUTTON_DOWN_PRESS_SIGNAL:
+		me->setDays ^= (1 << me->daysCursor);
+		post(me, UPDATE_TIME_SET_SIGNAL, 0);
+		return Q_HANDLED();
+	case BUTTON_UP_REPEAT_SIGNAL:
+	case BUTTON_DOWN_REPEAT_SIGNAL:
+		/* Repeating would just flicker the day on and off. */
+		return Q_HANDLED();
+	case UPDATE_TIME_SET_CURSOR_SIGNAL:
+		lcd_set_cursor(1, me->daysCursor);
+		return Q_HANDLED();
+	case BUTTON_SELECT_PRESS_SIGNAL:
+		me->daysCursor ++;
+		if (7 == me->daysCursor) {
+			return Q_TRAN(setAlarmSnoozesState);
+		}
+		lcd_set_cursor(1, me->daysCursor);
+		return Q_HANDLED();
+	case BUTTON_SELECT_RELEASE_SIGNAL:
+		return Q_HANDLED();
+	case Q_EXIT_SIG:
+		me->showing = SHOWING_TIME;
+		return Q_HANDLED();
+	}
+	return Q_SUPER(setAlarmState);
+}
+
+
+/**
+ * Set the number of times the alarm can be snoozed.
+ */
+static QState setAlarmSnoozesState(struct TimeSetter *me)
+{
+	static const char Q_ROM setAlarmSnoozesName[] = "Alarm snoozes:";
+
+	switch (Q_SIG(me)) {
+	case Q_ENTRY_SIG:
+		QActive_arm_sig((QActive*)me, TSET_TOUT,
+				UPDATE_SNOOZES_TIMEOUT_SIGNAL);
+		me->setTimeouts = N_TSET_TOUTS;
+		me->showing = SHOWING_SNOOZES;
+		displaySettingTime(me);
+		displayMenuName(setAlarmSnoozesName);
+		lcd_set_cursor(1, 7);
+		return Q_HANDLED();
+	case UPDATE_SNOOZES_TIMEOUT_SIGNAL:
+		Q_ASSERT( me->setTimeouts );
+		me->setTimeouts --;
+		if (0 == me->setTimeouts) {
+			post(me, UPDATE_TIME_TIMEOUT_SIGNAL, 0);
+		} else {
+			displaySettingTime(me);
+			QActive_arm_sig((QActive*)me, TSET_TOUT,
+					UPDATE_SNOOZES_TIMEOUT_SIGNAL);
+			post(me, UPDATE_TIME_SET_CURSOR_SIGNAL, 0);
+		}
+		return Q_HANDLED();
+	case BUTTON_UP_PRESS_SIGNAL:
+	case BUTTON_UP_REPEAT_SIGNAL:
+		if (me->setSnoozes < 9) {
+			me->setSnoozes ++;
+		}
+		post(me, UPDATE_TIME_SET_SIGNAL, 0);
+		return Q_HANDLED();
+	case BUTTON_DOWN_PRESS_SIGNAL:
+	case BUTTON_DOWN_REPEAT_SIGNAL:
+		if (me->setSnoozes) {
+			me->setSnoozes --;
+		}
+		post(me, UPDATE_TIME_SET_SIGNAL, 0);
+		return Q_HANDLED();
+	case UPDATE_TIME_SET_CURSOR_SIGNAL:
+		lcd_set_cursor(1, 7);
+		return Q_HANDLED();
+	case BUTTON_SELECT_PRESS_SIGNAL:
+		return Q_TRAN(setState);
+	case BUTTON_SELECT_RELEASE_SIGNAL:
+		return Q_HANDLED();
+	case Q_EXIT_SIG:
+		me->showing = SHOWING_TIME;
+		return Q_HANDLED();
+	}
+	return Q_SUPER(setAlarmState);
+}
+
+
+/**
+ * Set the day of the week, after the time.
+ */
+static QState setDayState(struct TimeSetter *me)
+{
+	static const char Q_ROM setDayName[] = "Set day:";
+
+	switch (Q_SIG(me)) {
+	case Q_ENTRY_SIG:
+		QActive_arm_sig((QActive*)me, TSET_TOUT,
+				UPDATE_DAYS_TIMEOUT_SIGNAL);
+		me->setTimeouts = N_TSET_TOUTS;
+		me->showing = SHOWING_DAY;
+		displaySettingTime(me);
+		displayMenuName(setDayName);
+		lcd_set_cursor(1, 6);
+		return Q_HANDLED();
+	case UPDATE_DAYS_TIMEOUT_SIGNAL:
+		Q_ASSERT( me->setTimeouts );
+		me->setTimeouts --;
+		if (0 == me->setTimeouts) {
+			post(me, UPDATE_TIME_TIMEOUT_SIGNAL, 0);
+		} else {
+			displaySettingTime(me);
+			QActive_arm_sig((QActive*)me, TSET_TOUT,
+					UPDATE_DAYS_TIMEOUT_SIGNAL);
+			post(me, UPDATE_TIME_SET_CURSOR_SIGNAL, 0);
+		}
+		return Q_HANDLED();
+	case BUTTON_UP_PRESS_SIGNAL:
+	case BUTTON_UP_REPEAT_SIGNAL:
+		me->setDay ++;
+		if (7 == me->setDay) {
+			me->setDay = 0;
+		}
+		post(me, UPDATE_TIME_SET_SIGNAL, 0);
+		return Q_HANDLED();
+	case BUTTON_DOWN_PRESS_SIGNAL:
+	case BUTTON_DOWN_REPEAT_SIGNAL:
+		if (0 == me->setDay) {
+			me->setDay = 7;
+		}
+		me->setDay --;
+		post(me, UPDATE_TIME_SET_SIGNAL, 0);
+		return Q_HANDLED();
+	case UPDATE_TIME_SET_CURSOR_SIGNAL:
+		lcd_set_cursor(1, 6);
+		return Q_HANDLED();
+	case BUTTON_SELECT_PRESS_SIGNAL:
+		return Q_TRAN(setState);
+	case BUTTON_SELECT_RELEASE_SIGNAL:
+		return Q_HANDLED();
+	case Q_EXIT_SIG:
+		me->showing = SHOWING_TIME;
+		return Q_HANDLED();
 	}
+	return Q_SUPER(setTimeState);
 }
@@ -31,12 +31,29 @@ struct TimeSetter {
 	uint8_t settingWhich;
 	/** A temporary holder for the alarm state. */
 	uint8_t alarmOn;
+	/** Which alarm we are setting. */
+	uint8_t alarmIndex;
+	/** The days of the week for the alarm we are setting. */
+	uint8_t setDays;
+	/** The number of snoozes for the alarm we are setting. */
+	uint8_t setSnoozes;
+	/** The day of the week when setting the time. */
+	uint8_t setDay;
+	/** The day under the cursor when setting the alarm days. */
+	uint8_t daysCursor;
+	/** What is shown on the bottom line while setting. */
+	uint8_t showing;
 };
 
 
 #define SETTING_ALARM 'A'
 #define SETTING_TIME 'T'
 
+#define SHOWING_TIME 0
+#define SHOWING_DAYS 'D'
+#define SHOWING_DAY 'd'
+#define SHOWING_SNOOZES 'S'
+
 
 extern struct TimeSetter timesetter;
 
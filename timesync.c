@@ -0,0 +1,300 @@
+#include "timesync.h"
+#include "time-sync.h"
+#include "bsp.h"
+#include "serial.h"
+
+
+#ifndef TIME_SYNC
+#error "timesync.c must only be compiled with TIME_SYNC defined"
+#endif
+
+
+/*
+ * All of this runs in the serial interrupts, so the time stamps are taken as
+ * close as we can get to the bytes arriving and leaving, and the reply goes
+ * straight away.
+ *
+ * The time stamps from BSP_sync_stamp() count decimal ticks since startup,
+ * and aren't the time of day.  Timekeeper tells us, once a decimal second,
+ * which stamp the current second started at, and we work out the time of
+ * day from that.
+ *
+ * While the host keeps answering, timekeeper takes the normal seconds from
+ * the slewed timer too (see timesync_in_step()), so the RTC's seconds don't
+ * pull the time back between syncs.
+ */
+
+
+/**
+ * Timer 1 counts per time sync unit (1/65536 of a decimal second) are
+ * 54000 * 32 / 65536, or 3375/128.
+ */
+#define COUNTS_PER_UNIT_NUM 3375L
+#define COUNTS_PER_UNIT_DEN 128L
+
+/**
+ * Decimal seconds without a good exchange before we stop following the host,
+ * about 14 minutes.  The daemon syncs every 10 seconds by default.
+ */
+#ifndef TIME_SYNC_HOLDOVER
+#define TIME_SYNC_HOLDOVER 1000
+#endif
+
+
+/** The frame we're receiving. */
+static uint8_t frame[TIME_SYNC_TIME_FRAME_LEN];
+/** The number of bytes of the frame so far.  Zero when we're waiting for
+    TIME_SYNC_START. */
+static uint8_t frameLen;
+/** When the frame started to arrive. */
+static uint32_t frameStamp;
+
+/** The decimal seconds at the start of the current second, and the stamp at
+    that time. */
+static uint32_t anchorDecimal;
+static uint32_t anchorStamp;
+/** True once we know the time of day. */
+static uint8_t anchored;
+
+/** The POLL we've answered, waiting for its FOLLOWUP. */
+static uint8_t pollSeq;
+static uint8_t pollValid;
+static uint32_t pollT1;
+static uint32_t pollT2;
+
+/** Decimal seconds since the last good exchange, up to TIME_SYNC_HOLDOVER. */
+static uint16_t syncAge = TIME_SYNC_HOLDOVER;
+
+/** True while the REPLY's first byte is waiting to go. */
+static uint8_t replyQueued;
+/** True once the REPLY has started to go, and replyStamp is valid. */
+static uint8_t replyGone;
+static uint32_t replyStamp;
+
+
+/**
+ * Remember where the current decimal second started.  Called by timekeeper
+ * each decimal second, and when the time is set.
+ */
+void timesync_second(uint32_t decimaltime)
+{
+	uint32_t stamp;
+	uint8_t sreg;
+
+	stamp = BSP_sync_second_stamp();
+	sreg = SREG;
+	cli();
+	anchorDecimal = decimaltime;
+	anchorStamp = stamp;
+	anchored = 73;
+	if (syncAge < TIME_SYNC_HOLDOVER) {
+		syncAge ++;
+	}
+	SREG = sreg;
+}
+
+
+/**
+ * The time has been set by hand, so we're not in step with the host any more
+ * until it says so.
+ */
+void timesync_time_set(uint32_t decimaltime)
+{
+	uint8_t sreg;
+
+	timesync_second(decimaltime);
+	sreg = SREG;
+	cli();
+	syncAge = TIME_SYNC_HOLDOVER;
+	pollValid = 0;
+	SREG = sreg;
+}
+
+
+/**
+ * @return true if the host has kept us in step recently.
+ */
+uint8_t timesync_in_step(void)
+{
+	uint8_t inStep;
+	uint8_t sreg;
+
+	sreg = SREG;
+	cli();
+	inStep = (syncAge < TIME_SYNC_HOLDOVER);
+	SREG = sreg;
+	return inStep;
+}
+
+
+/**
+ * Convert a stamp to the time of day in time sync units.
+ */
+static uint32_t clock_time(uint32_t stamp)
+{
+	return (anchorDecimal << 16) + (stamp - anchorStamp);
+}
+
+
+static void send_frame(uint8_t *f, uint8_t len)
+{
+	uint8_t i;
+
+	f[0] = TIME_SYNC_START;
+	f[len-1] = time_sync_check(f, len);
+	for (i=0; i<len; i++) {
+		serial_send_char(f[i]);
+	}
+}
+
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16)
+		| ((uint32_t)p[3] << 24);
+}
+
+
+static void poll(void)
+{
+	uint8_t reply[TIME_SYNC_TIME_FRAME_LEN];
+
+	if (! anchored) {
+		return;
+	}
+	pollSeq = frame[2];
+	pollT1 = get32(frame + 3);
+	pollT2 = clock_time(frameStamp);
+	pollValid = 73;
+
+	reply[1] = TIME_SYNC_REPLY;
+	reply[2] = pollSeq;
+	put32(reply + 3, pollT2);
+	replyGone = 0;
+	replyQueued = 73;
+	send_frame(reply, TIME_SYNC_TIME_FRAME_LEN);
+}
+
+
+static void followup(void)
+{
+	uint8_t result[TIME_SYNC_RESULT_FRAME_LEN];
+	uint32_t t3;
+	uint32_t t4;
+	int32_t offset;
+	int32_t rtt;
+	uint8_t status;
+
+	if (! pollValid || ! replyGone || frame[2] != pollSeq) {
+		return;
+	}
+	pollValid = 0;
+	t3 = clock_time(replyStamp);
+	t4 = get32(frame + 3);
+
+	/* The differences are small, so they're right even if the times
+	   wrapped in between. */
+	offset = ((int32_t)(pollT2 - pollT1) + (int32_t)(t3 - t4)) / 2;
+	rtt = (int32_t)(t4 - pollT1) - (int32_t)(t3 - pollT2);
+
+	if (rtt < 0 || rtt > TIME_SYNC_MAX_RTT) {
+		status = TIME_SYNC_BAD_RTT;
+	} else if (offset > TIME_SYNC_MAX_OFFSET
+		   || offset < -TIME_SYNC_MAX_OFFSET) {
+		status = TIME_SYNC_TOO_FAR;
+	} else if (BSP_slewing()) {
+		status = TIME_SYNC_BUSY;
+		syncAge = 0;
+	} else {
+		/* A positive offset means we're ahead, so take the time
+		   away. */
+		BSP_slew(- offset * COUNTS_PER_UNIT_NUM
+			 / COUNTS_PER_UNIT_DEN);
+		status = TIME_SYNC_SLEWING;
+		syncAge = 0;
+	}
+
+	result[1] = TIME_SYNC_RESULT;
+	result[2] = frame[2];
+	result[3] = status;
+	put32(result + 4, offset);
+	put32(result + 8, rtt);
+	send_frame(result, TIME_SYNC_RESULT_FRAME_LEN);
+}
+
+
+/**
+ * Handle a received byte.  Called from the serial receive interrupt.
+ *
+ * @return true if the byte was part of a time sync frame.
+ */
+uint8_t timesync_rx_byte(uint8_t c)
+{
+	if (0 == frameLen) {
+		if (c != TIME_SYNC_START) {
+			return 0;
+		}
+		frameStamp = BSP_sync_stamp();
+		frame[0] = c;
+		frameLen = 1;
+		return 73;
+	}
+
+	frame[frameLen++] = c;
+	if (2 == frameLen && c != TIME_SYNC_POLL && c != TIME_SYNC_FOLLOWUP) {
+		/* Not one of ours after all. */
+		frameLen = 0;
+		return 73;
+	}
+	if (frameLen < TIME_SYNC_TIME_FRAME_LEN) {
+		return 73;
+	}
+
+	frameLen = 0;
+	if (frame[TIME_SYNC_TIME_FRAME_LEN-1]
+	    != time_sync_check(frame, TIME_SYNC_TIME_FRAME_LEN)) {
+		return 73;
+	}
+	switch (frame[1]) {
+	case TIME_SYNC_POLL:
+		poll();
+		break;
+	case TIME_SYNC_FOLLOWUP:
+		followup();
+		break;
+	}
+	return 73;
+}
+
+
+/**
+ * A byte was received with a framing or overrun error, so any frame we're
+ * part way through is no good.
+ */
+void timesync_rx_error(void)
+{
+	frameLen = 0;
+}
+
+
+/**
+ * TIME_SYNC_START is being sent.  Called from the serial transmit interrupt.
+ * If it's the start of our REPLY, remember when it went.
+ */
+void timesync_tx_start(void)
+{
+	if (replyQueued) {
+		replyStamp = BSP_sync_stamp();
+		replyQueued = 0;
+		replyGone = 73;
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef timesync_h_INCLUDED
+#define timesync_h_INCLUDED
+
+#include "qpn_port.h"
+
+/**
+ * @file
+ *
+ * Keep the clock in step with a host, over the serial port.
+ *
+ * Build with TIME_SYNC=1.  The protocol is described in time-sync.h, and the
+ * host end is time-sync-daemon.
+ */
+
+#ifdef TIME_SYNC
+
+uint8_t timesync_rx_byte(uint8_t c);
+void timesync_rx_error(void);
+void timesync_tx_start(void);
+void timesync_second(uint32_t decimaltime);
+void timesync_time_set(uint32_t decimaltime);
+uint8_t timesync_in_step(void);
+
+#endif
+
+#endif
@@ -278,6 +278,7 @@ SIGNAL(TWI_vect)
 		twint = twint_null;
 	}
 	(*twint)(&twi);
+	QK_ISR_EXIT();
 }
 
 